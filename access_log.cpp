@@ -0,0 +1,278 @@
+#include "access_log.h"
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+
+#define ACCESS_WRITE_BUFFER (256 << 10) // 写线程一次写入文件的最大字节数
+#define ACCESS_LINE_MAX 1024            // 一条记录格式化后的最大长度
+
+// 单生产者单消费者环形队列：只有所属线程写入记录，只有写线程取出
+struct access_ring
+{
+    alignas(64) std::atomic<unsigned long> head; // 写线程下一个要取出的位置
+    alignas(64) std::atomic<unsigned long> tail; // 所属线程下一个要写入的位置
+    unsigned long seq;                           // 所属线程的抽样计数
+    std::atomic<unsigned long> dropped;          // 队列满时丢弃的记录数，只有所属线程写入
+    access_record records[ACCESS_RING_SIZE];
+};
+
+static thread_local access_ring *tl_ring = 0;
+
+access_log::access_log(const char *path, int sample, long rotate_size)
+    : m_path(path), m_sample(sample > 0 ? sample : 1), m_rotate_size(rotate_size), m_file_size(0),
+      m_written(0), m_dropped(0), m_stop(false)
+{
+    m_fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (m_fd < 0)
+    {
+        throw std::exception();
+    }
+    struct stat st;
+    if (fstat(m_fd, &st) == 0)
+    {
+        m_file_size = st.st_size;
+    }
+    for (int i = 0; i < MAX_THREAD_SLOTS; ++i)
+        m_rings[i].store(0, std::memory_order_relaxed);
+    if (pthread_create(&m_thread, NULL, writer_func, this) != 0)
+    {
+        close(m_fd);
+        throw std::exception();
+    }
+}
+
+access_log::~access_log()
+{
+    m_stop.store(true, std::memory_order_release);
+    pthread_join(m_thread, NULL);
+    if (m_fd >= 0)
+    {
+        close(m_fd);
+    }
+    for (int i = 0; i < MAX_THREAD_SLOTS; ++i)
+        delete m_rings[i].load(std::memory_order_relaxed);
+}
+
+// 线程第一次记录时创建自己的队列并登记，线程数超过上限时返回NULL
+access_ring *access_log::thread_ring()
+{
+    if (!tl_ring)
+    {
+        int index = thread_slot();
+        if (index < 0)
+        {
+            return 0;
+        }
+        access_ring *ring = new access_ring;
+        ring->head.store(0, std::memory_order_relaxed);
+        ring->tail.store(0, std::memory_order_relaxed);
+        ring->seq = 0;
+        ring->dropped.store(0, std::memory_order_relaxed);
+        m_rings[index].store(ring, std::memory_order_release);
+        tl_ring = ring;
+    }
+    return tl_ring;
+}
+
+void access_log::log(const sockaddr_in &addr, const char *method, const char *url, int status, long bytes, long queue_ns, long service_ns)
+{
+    access_ring *ring = thread_ring();
+    if (!ring)
+    {
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    if (status < 400 && m_sample > 1 && ring->seq++ % m_sample != 0)
+    {
+        return;
+    }
+    unsigned long tail = ring->tail.load(std::memory_order_relaxed);
+    if (tail - ring->head.load(std::memory_order_acquire) >= ACCESS_RING_SIZE) // 写线程跟不上，不等待
+    {
+        ring->dropped.store(ring->dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return;
+    }
+
+    access_record &r = ring->records[tail & (ACCESS_RING_SIZE - 1)];
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    r.time_ns = ts.tv_sec * 1000000000L + ts.tv_nsec;
+    r.queue_ns = queue_ns;
+    r.service_ns = service_ns;
+    r.bytes = bytes;
+    r.method = method;
+    r.addr = addr.sin_addr.s_addr;
+    r.port = addr.sin_port;
+    r.status = status;
+    if (!url)
+        url = "-";
+    size_t len = strnlen(url, ACCESS_URL_LEN);
+    memcpy(r.url, url, len);
+    r.url_len = len;
+    ring->tail.store(tail + 1, std::memory_order_release);
+}
+
+// URL来自客户端，引号、反斜杠与控制字符按JSON规则转义
+static int escape_json(char *out, const char *s, int len)
+{
+    static const char hex[] = "0123456789abcdef";
+    int n = 0;
+    for (int i = 0; i < len; ++i)
+    {
+        unsigned char c = s[i];
+        if (c == '"' || c == '\\')
+        {
+            out[n++] = '\\';
+            out[n++] = c;
+        }
+        else if (c < 0x20 || c == 0x7f)
+        {
+            memcpy(out + n, "\\u00", 4);
+            out[n + 4] = hex[c >> 4];
+            out[n + 5] = hex[c & 15];
+            n += 6;
+        }
+        else
+        {
+            out[n++] = c;
+        }
+    }
+    return n;
+}
+
+size_t access_log::drain(access_ring *ring, char *buf, size_t len, size_t cap)
+{
+    unsigned long head = ring->head.load(std::memory_order_relaxed);
+    unsigned long tail = ring->tail.load(std::memory_order_acquire);
+    for (; head != tail; ++head)
+    {
+        if (cap - len < ACCESS_LINE_MAX)
+        {
+            flush(buf, len);
+            len = 0;
+        }
+        const access_record &r = ring->records[head & (ACCESS_RING_SIZE - 1)];
+        time_t sec = r.time_ns / 1000000000L;
+        struct tm tm;
+        gmtime_r(&sec, &tm);
+        char client[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &r.addr, client, sizeof(client));
+        char url[ACCESS_URL_LEN * 6];
+        int url_len = escape_json(url, r.url, r.url_len);
+        len += snprintf(buf + len, cap - len,
+                        "{\"time\":\"%04d-%02d-%02dT%02d:%02d:%02d.%03ldZ\",\"client\":\"%s:%d\",\"method\":\"%s\",\"url\":\"%.*s\","
+                        "\"status\":%d,\"bytes\":%ld,\"queue_us\":%.1f,\"service_us\":%.1f}\n",
+                        tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, r.time_ns / 1000000 % 1000,
+                        client, ntohs(r.port), r.method, url_len, url, r.status, r.bytes, r.queue_ns / 1e3, r.service_ns / 1e3);
+        m_written.fetch_add(1, std::memory_order_relaxed);
+    }
+    ring->head.store(head, std::memory_order_release);
+    return len;
+}
+
+void access_log::flush(const char *buf, size_t len)
+{
+    if (m_fd < 0)
+    {
+        return;
+    }
+    size_t done = 0;
+    while (done < len)
+    {
+        ssize_t n = write(m_fd, buf + done, len - done);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            printf("Access log write failed! Errno is: %d\n", errno);
+            break;
+        }
+        done += n;
+    }
+    m_file_size += done;
+    if (m_rotate_size > 0 && m_file_size >= m_rotate_size)
+    {
+        rotate();
+    }
+}
+
+// path.N-1 -> path.N ... path -> path.1，然后重新创建path
+void access_log::rotate()
+{
+    close(m_fd);
+    for (int i = ACCESS_LOG_KEEP; i > 1; --i)
+    {
+        std::string from = m_path + "." + std::to_string(i - 1);
+        std::string to = m_path + "." + std::to_string(i);
+        rename(from.c_str(), to.c_str());
+    }
+    rename(m_path.c_str(), (m_path + ".1").c_str());
+    m_fd = open(m_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    m_file_size = 0;
+    if (m_fd < 0)
+    {
+        printf("Access log reopen failed! Errno is: %d\n", errno);
+    }
+}
+
+void *access_log::writer_func(void *arg)
+{
+    ((access_log *)arg)->writer();
+    return arg;
+}
+
+// 轮询所有线程的队列，有记录时一批写出，没有时短暂休眠；停止前再取一遍
+void access_log::writer()
+{
+    char *buf = (char *)malloc(ACCESS_WRITE_BUFFER);
+    while (true)
+    {
+        bool stop = m_stop.load(std::memory_order_acquire);
+        int rings = thread_slot_count();
+        size_t len = 0;
+        for (int i = 0; i < rings; ++i)
+        {
+            access_ring *ring = m_rings[i].load(std::memory_order_acquire);
+            if (ring)
+                len = drain(ring, buf, len, ACCESS_WRITE_BUFFER);
+        }
+        if (len > 0)
+        {
+            flush(buf, len);
+        }
+        if (stop)
+        {
+            break;
+        }
+        if (len == 0)
+        {
+            struct timespec ts = {0, ACCESS_LOG_FLUSH_MS * 1000000L};
+            nanosleep(&ts, 0);
+        }
+    }
+    free(buf);
+}
+
+void access_log::render_metrics(std::string &out) const
+{
+    unsigned long dropped = m_dropped.load(std::memory_order_relaxed);
+    int rings = thread_slot_count();
+    for (int i = 0; i < rings; ++i)
+    {
+        access_ring *ring = m_rings[i].load(std::memory_order_acquire);
+        if (ring)
+            dropped += ring->dropped.load(std::memory_order_relaxed);
+    }
+    char buf[512];
+    int len = snprintf(buf, sizeof(buf),
+                       "# HELP webserver_access_log_records_total Access log records written.\n"
+                       "# TYPE webserver_access_log_records_total counter\n"
+                       "webserver_access_log_records_total %lu\n"
+                       "# HELP webserver_access_log_dropped_total Access log records dropped because a ring was full.\n"
+                       "# TYPE webserver_access_log_dropped_total counter\n"
+                       "webserver_access_log_dropped_total %lu\n",
+                       m_written.load(std::memory_order_relaxed), dropped);
+    out.append(buf, len);
+}
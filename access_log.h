@@ -0,0 +1,72 @@
+#ifndef ACCESS_LOG_H
+#define ACCESS_LOG_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <string>
+#include <atomic>
+#include <algorithm>
+#include <exception>
+#include "thread_slot.h"
+
+#define ACCESS_URL_LEN 128              // 记录中保存的URL的最大长度，更长的被截断
+#define ACCESS_RING_SIZE 2048           // 每个线程的环形队列能容纳的记录数，必须为2的幂
+#define ACCESS_LOG_FLUSH_MS 10          // 写线程没有新记录时休眠的时间
+#define ACCESS_LOG_ROTATE (64L << 20)   // 日志文件达到该大小时轮转
+#define ACCESS_LOG_KEEP 3               // 轮转后保留的旧文件数：path.1 ... path.N
+
+// 一个请求的访问记录，定长，由工作线程直接写入环形队列，格式化由写线程完成
+struct access_record
+{
+    long time_ns;       // 生成响应的时刻（实时时钟）
+    long queue_ns;      // 在线程池队列中等待的时间，同一批中只有第一个请求有
+    long service_ns;    // 从解析请求到生成响应的时间
+    long bytes;         // 响应的字节数（响应头与响应体）
+    const char *method; // 指向静态字符串
+    uint32_t addr;      // 客户端地址与端口，网络字节序
+    uint16_t port;
+    uint16_t status;
+    uint16_t url_len;
+    char url[ACCESS_URL_LEN];
+};
+
+struct access_ring;
+
+// 异步访问日志：每个线程把记录放入自己的单生产者单消费者环形队列，队列满时丢弃并计数；
+// 写线程轮询所有队列，批量格式化为JSON行写入文件，文件过大时轮转。一个进程只应创建一个实例
+class access_log
+{
+public:
+    // sample为n时正常响应每n个记录一个，错误响应（状态码不小于400）总是记录；打开文件失败时抛出异常
+    access_log(const char *path, int sample = 1, long rotate_size = ACCESS_LOG_ROTATE);
+    ~access_log(); // 停止写线程并写出剩余的记录
+
+    void log(const sockaddr_in &addr, const char *method, const char *url, int status, long bytes, long queue_ns, long service_ns);
+    void render_metrics(std::string &out) const; // Prometheus格式的写入与丢弃计数
+
+private:
+    access_ring *thread_ring();
+    static void *writer_func(void *arg);
+    void writer();
+    size_t drain(access_ring *ring, char *buf, size_t len, size_t cap); // 取出记录格式化到buf，返回新的长度
+    void flush(const char *buf, size_t len);
+    void rotate();
+
+    std::string m_path;
+    int m_fd;
+    int m_sample;
+    long m_rotate_size;
+    long m_file_size;
+    std::atomic<access_ring *> m_rings[MAX_THREAD_SLOTS]; // 各线程的队列，第一次记录时创建
+    std::atomic<unsigned long> m_written;
+    std::atomic<unsigned long> m_dropped; // 超过线程数上限、没有队列的线程丢弃的记录数
+    std::atomic<bool> m_stop;
+    pthread_t m_thread;
+};
+
+#endif
@@ -0,0 +1,291 @@
+#include "asset_pack.h"
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <algorithm>
+#include <unordered_map>
+#include "mime_types.h"
+#include "http_date.h"
+#include "gzip_cache.h"
+
+#define ASSET_ALIGN 64 // 每种表示的起始位置按缓存行对齐
+
+// 与http_conn::add_status_line和add_entity_headers生成的200响应头逐字节相同
+static std::string header_block(const asset &a, long len, bool gzip)
+{
+    char date[HTTP_DATE_LEN + 1];
+    format_http_date(a.st.st_mtime, date);
+    std::string h = "HTTP/1.1 200 OK\r\nContent-Length: " + std::to_string(len) + "\r\nContent-Type: " + a.type + "\r\nETag: ";
+    if (gzip)
+        h.append(a.etag, strlen(a.etag) - 1).append("-gz\"");
+    else
+        h += a.etag;
+    h.append("\r\nLast-Modified: ").append(date, HTTP_DATE_LEN).append("\r\nAccept-Ranges: bytes\r\n");
+    if (gzip)
+        h += "Content-Encoding: gzip\r\n";
+    if (a.compressible)
+        h += "Vary: Accept-Encoding\r\n";
+    return h;
+}
+
+static bool read_file(const std::string &path, std::string &out, long size)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return false;
+    }
+    out.resize(size);
+    long done = 0;
+    while (done < size)
+    {
+        ssize_t n = read(fd, &out[done], size - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        done += n;
+    }
+    close(fd);
+    return done == size;
+}
+
+static size_t align_up(size_t n, size_t a)
+{
+    return (n + a - 1) / a * a;
+}
+
+asset_pack::asset_pack(const char *root, bool gzip) : m_region(0), m_region_size(0), m_skipped(0)
+{
+    std::vector<pending> files;
+    scan(root, "", files);
+
+    // 先全部读入并压缩，得到总大小后一次分配区域
+    std::vector<std::string> data(files.size()), gz(files.size());
+    std::unordered_map<std::string, size_t> index;
+    m_assets.resize(files.size());
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        if (!read_file(files[i].path, data[i], files[i].st.st_size))
+        {
+            throw std::exception();
+        }
+        asset &a = m_assets[i];
+        a.key = files[i].key;
+        a.st = files[i].st;
+        const mime_type_entry *mime = mime_lookup(a.key.c_str());
+        a.type = mime->type;
+        a.compressible = mime->compressible;
+        format_etag(a.st, a.etag, sizeof(a.etag));
+        memset(a.variants, 0, sizeof(a.variants));
+        index[a.key] = i;
+    }
+
+    build_hash();
+
+    // 可压缩的文件优先使用同名的.gz文件，没有时在这里压缩；压缩不变小的只有原始表示
+    size_t total = 0;
+    std::vector<std::string> headers[2];
+    headers[0].resize(files.size());
+    headers[1].resize(files.size());
+    for (size_t i = 0; i < m_assets.size(); ++i)
+    {
+        asset &a = m_assets[i];
+        if (a.compressible)
+        {
+            std::unordered_map<std::string, size_t>::iterator sibling = index.find(a.key + ".gz");
+            if (sibling != index.end())
+            {
+                gz[i] = data[sibling->second];
+            }
+            else if (gzip && !data[i].empty())
+            {
+                char *out;
+                long len = gzip_cache::compress(data[i].data(), data[i].size(), &out);
+                if (len > 0)
+                {
+                    gz[i].assign(out, len);
+                    free(out);
+                }
+            }
+        }
+        headers[0][i] = header_block(a, data[i].size(), false);
+        total += align_up(headers[0][i].size() + data[i].size(), ASSET_ALIGN);
+        if (!gz[i].empty())
+        {
+            headers[1][i] = header_block(a, gz[i].size(), true);
+            total += align_up(headers[1][i].size() + gz[i].size(), ASSET_ALIGN);
+        }
+    }
+
+    if (total > 0)
+    {
+        // 匿名映射不保证按大页对齐，多映射一页后裁掉首尾
+        m_region_size = align_up(total, ASSET_PACK_ALIGN);
+        char *raw = (char *)mmap(0, m_region_size + ASSET_PACK_ALIGN, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (raw == MAP_FAILED)
+        {
+            throw std::exception();
+        }
+        m_region = (char *)align_up((size_t)raw, ASSET_PACK_ALIGN);
+        if (m_region > raw)
+            munmap(raw, m_region - raw);
+        munmap(m_region + m_region_size, raw + ASSET_PACK_ALIGN - m_region);
+        madvise(m_region, m_region_size, MADV_HUGEPAGE); // 不支持透明大页时忽略
+
+        // 每种表示的响应头块后紧跟响应体
+        char *p = m_region;
+        for (size_t i = 0; i < m_assets.size(); ++i)
+        {
+            for (int v = 0; v < 2; ++v)
+            {
+                const std::string &body = v ? gz[i] : data[i];
+                if (v && body.empty())
+                    continue;
+                asset_variant &var = m_assets[i].variants[v];
+                memcpy(p, headers[v][i].data(), headers[v][i].size());
+                var.headers = p;
+                var.header_len = headers[v][i].size();
+                p += var.header_len;
+                memcpy(p, body.data(), body.size());
+                var.body = p;
+                var.body_len = body.size();
+                p = m_region + align_up(p + body.size() - m_region, ASSET_ALIGN);
+            }
+        }
+        mprotect(m_region, m_region_size, PROT_READ);
+    }
+}
+
+asset_pack::~asset_pack()
+{
+    if (m_region)
+    {
+        munmap(m_region, m_region_size);
+    }
+}
+
+// 符号链接指向的文件按文件处理，指向的目录不进入，避免循环；不在资源包中的URL仍从文件系统查找
+void asset_pack::scan(const std::string &dir, const std::string &prefix, std::vector<pending> &files)
+{
+    DIR *d = opendir(dir.c_str());
+    if (!d)
+    {
+        throw std::exception();
+    }
+    struct dirent *ent;
+    while ((ent = readdir(d)) != 0)
+    {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+            continue;
+        pending f;
+        f.path = dir + "/" + ent->d_name;
+        f.key = prefix + "/" + ent->d_name;
+        if (lstat(f.path.c_str(), &f.st) < 0)
+            continue;
+        if (S_ISDIR(f.st.st_mode))
+        {
+            scan(f.path, f.key, files);
+            continue;
+        }
+        if (S_ISLNK(f.st.st_mode) && stat(f.path.c_str(), &f.st) < 0)
+            continue;
+        if (!S_ISREG(f.st.st_mode))
+            continue;
+        if (!(f.st.st_mode & S_IROTH) || f.st.st_size > ASSET_MAX_FILE) // 留给文件系统路径回答403或用sendfile发送
+        {
+            ++m_skipped;
+            continue;
+        }
+        files.push_back(f);
+    }
+    closedir(d);
+}
+
+// FNV-1a
+uint64_t asset_pack::hash_key(const char *key)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (; *key; ++key)
+        h = (h ^ (unsigned char)*key) * 0x100000001b3ULL;
+    return h;
+}
+
+// 用种子扰动键的哈希值后再混合，不同的种子得到近似独立的槽位
+uint32_t asset_pack::slot_of(uint64_t hash, uint32_t seed, size_t n)
+{
+    uint64_t x = hash ^ (seed * 0x9e3779b97f4a7c15ULL);
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x % n;
+}
+
+// 哈希-位移（CHD）：键按哈希值的高位分到桶中，从最大的桶开始为每个桶寻找一个种子，
+// 使桶内所有键落在互不相同的空槽位；n个键恰好占满n个槽位，查找只需两次取模和一次比较
+void asset_pack::build_hash()
+{
+    size_t n = m_assets.size();
+    if (n == 0)
+    {
+        return;
+    }
+    size_t nb = (n + ASSET_BUCKET_SIZE - 1) / ASSET_BUCKET_SIZE;
+    std::vector<uint64_t> hashes(n);
+    std::vector<std::vector<uint32_t> > buckets(nb);
+    for (size_t i = 0; i < n; ++i)
+    {
+        hashes[i] = hash_key(m_assets[i].key.c_str());
+        buckets[(hashes[i] >> 32) % nb].push_back(i);
+    }
+    std::vector<uint32_t> order(nb);
+    for (size_t b = 0; b < nb; ++b)
+        order[b] = b;
+    std::stable_sort(order.begin(), order.end(), [&buckets](uint32_t a, uint32_t b) { return buckets[a].size() > buckets[b].size(); });
+
+    m_seeds.assign(nb, 0);
+    m_slots.assign(n, UINT32_MAX);
+    std::vector<uint32_t> taken;
+    for (size_t k = 0; k < nb; ++k)
+    {
+        const std::vector<uint32_t> &bucket = buckets[order[k]];
+        if (bucket.empty())
+            break;
+        uint32_t seed = 0;
+        for (; seed < ASSET_MAX_SEED; ++seed)
+        {
+            taken.clear();
+            size_t j = 0;
+            for (; j < bucket.size(); ++j)
+            {
+                uint32_t s = slot_of(hashes[bucket[j]], seed, n);
+                if (m_slots[s] != UINT32_MAX || std::find(taken.begin(), taken.end(), s) != taken.end())
+                    break;
+                taken.push_back(s);
+            }
+            if (j == bucket.size())
+                break;
+        }
+        if (seed == ASSET_MAX_SEED)
+        {
+            throw std::exception();
+        }
+        m_seeds[order[k]] = seed;
+        for (size_t j = 0; j < bucket.size(); ++j)
+            m_slots[taken[j]] = bucket[j];
+    }
+}
+
+const asset *asset_pack::find(const char *key) const
+{
+    if (m_slots.empty())
+    {
+        return 0;
+    }
+    uint64_t h = hash_key(key);
+    const asset &a = m_assets[m_slots[slot_of(h, m_seeds[(h >> 32) % m_seeds.size()], m_slots.size())]];
+    return a.key == key ? &a : 0; // 不在资源包中的URL也会落到某个槽位
+}
@@ -0,0 +1,73 @@
+#ifndef ASSET_PACK_H
+#define ASSET_PACK_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+#include <exception>
+
+#define ASSET_MAX_FILE (64L << 20)    // 超过该大小的文件不放入资源包，仍从文件系统发送
+#define ASSET_PACK_ALIGN (2L << 20)   // 资源包区域按大页对齐
+#define ASSET_BUCKET_SIZE 4           // 完美哈希每个桶平均的键数
+#define ASSET_MAX_SEED (1 << 24)      // 为一个桶寻找位移时的最大尝试次数
+
+// 一个文件的一种表示：响应行到Vary的响应头块和紧随其后的响应体，都在资源包区域中
+struct asset_variant
+{
+    const char *headers;
+    int header_len;
+    const char *body; // 为NULL时没有这种表示
+    long body_len;
+};
+
+struct asset
+{
+    std::string key;          // 规范化后的URL
+    const char *type;         // Content-Type
+    bool compressible;        // 响应随Accept-Encoding变化
+    struct stat st;           // 启动时的文件状态，用于ETag与条件请求
+    char etag[64];
+    asset_variant variants[2]; // 下标1为gzip压缩后的内容，压缩不变小时body为NULL
+};
+
+// 启动时读入的只读资源包：资源目录作为不可变的发布版本部署时，把所有文件与预先生成的
+// 响应头连续放在一个按大页对齐的区域中，URL通过启动时构造的最小完美哈希查找；
+// 命中时不访问文件系统。启动之后文件的修改不会反映到资源包中
+class asset_pack
+{
+public:
+    // 扫描root下的所有文件，读取或分配内存失败时抛出异常
+    asset_pack(const char *root, bool gzip = true);
+    ~asset_pack();
+
+    const asset *find(const char *key) const; // 没有时返回NULL
+
+    size_t count() const { return m_assets.size(); }
+    size_t bytes() const { return m_region_size; }
+    long skipped() const { return m_skipped; }
+
+private:
+    struct pending // 扫描到、还没有放入区域的文件
+    {
+        std::string key, path;
+        struct stat st;
+    };
+
+    void scan(const std::string &dir, const std::string &prefix, std::vector<pending> &files);
+    void build_hash();
+    static uint64_t hash_key(const char *key);
+    static uint32_t slot_of(uint64_t hash, uint32_t seed, size_t n);
+
+    std::vector<asset> m_assets;
+    std::vector<uint32_t> m_seeds; // 每个桶的位移种子
+    std::vector<uint32_t> m_slots; // 槽位到资源下标
+    char *m_region;
+    size_t m_region_size;
+    long m_skipped; // 过大或不可读、没有放入资源包的文件数
+};
+
+#endif
@@ -0,0 +1,467 @@
+// HTTP负载生成器：每个线程用自己的epoll驱动一组连接，按场景发送GET请求并记录每个请求的延迟
+// 用法: load_gen [-a addr] [-p port] [-t threads] [-c conns] [-d seconds] [-m close|keepalive|pipeline]
+//               [-D depth] [-i idle_conns] [-u path] [-P server_pid] [-n name]
+//       load_gen -H  只输出表头
+// 结果是一行制表符分隔的数据，列与表头对应，便于保存为基线后逐项比较
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#define MAX_EVENTS 256
+#define HEADER_MAX 8192     // 响应头的最大长度
+#define RECV_BUFFER (64 << 10)
+
+enum MODE
+{
+    MODE_CLOSE,     // 每个请求一个新连接，等服务器关闭后再建立下一个
+    MODE_KEEPALIVE, // 保持连接，每次一个请求
+    MODE_PIPELINE   // 保持连接，每次连续发送depth个请求
+};
+static const char *mode_names[] = {"close", "keepalive", "pipeline"};
+
+static const char *g_header = "scenario\tmode\tconns\tidle\trequests\trps\tp50_us\tp99_us\tp999_us\tcpu_us_per_req\tmb_per_s\terrors";
+
+static struct sockaddr_in g_addr;
+static MODE g_mode = MODE_KEEPALIVE;
+static int g_depth = 1;
+static std::string g_request; // 一批请求的完整内容
+static long g_deadline_ns;
+
+static long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+struct conn
+{
+    int fd;
+    bool idle;          // 只建立连接，不发送请求
+    bool connecting;
+    size_t sent;        // 这一批请求已经发送的字节数
+    int outstanding;    // 已发送但还没有读完响应的请求数
+    long start_ns;      // 这一批请求开始发送的时刻
+    char header[HEADER_MAX];
+    int header_len;
+    long body_left;     // 当前响应还没有读到的响应体字节数，-1表示正在读响应头
+    int status;         // 当前响应的状态码
+};
+
+struct worker
+{
+    pthread_t thread;
+    int epoll_fd;
+    int active, idle;
+    std::vector<conn *> conns;
+    std::vector<long> latencies; // 每个请求的延迟（纳秒）
+    long requests, errors, bytes;
+};
+
+static void watch(worker *w, conn *c, bool want_out, int op)
+{
+    epoll_event ev;
+    ev.data.ptr = c;
+    ev.events = EPOLLIN | EPOLLRDHUP;
+    if (want_out)
+        ev.events |= EPOLLOUT;
+    epoll_ctl(w->epoll_fd, op, c->fd, &ev);
+}
+
+// 建立非阻塞连接，连接完成时触发EPOLLOUT
+static bool open_conn(worker *w, conn *c)
+{
+    c->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (c->fd < 0)
+    {
+        return false;
+    }
+    int one = 1;
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    c->connecting = true;
+    c->sent = 0;
+    c->outstanding = 0;
+    c->header_len = 0;
+    c->body_left = -1;
+    if (connect(c->fd, (struct sockaddr *)&g_addr, sizeof(g_addr)) < 0 && errno != EINPROGRESS)
+    {
+        close(c->fd);
+        c->fd = -1;
+        return false;
+    }
+    watch(w, c, true, EPOLL_CTL_ADD);
+    return true;
+}
+
+static void reopen_conn(worker *w, conn *c)
+{
+    epoll_ctl(w->epoll_fd, EPOLL_CTL_DEL, c->fd, 0);
+    close(c->fd);
+    if (!open_conn(w, c))
+    {
+        w->errors++;
+    }
+}
+
+// 发送这一批请求中剩下的部分，发送缓冲区满时等待EPOLLOUT
+static bool send_batch(worker *w, conn *c)
+{
+    if (c->sent == 0)
+    {
+        c->start_ns = now_ns();
+        c->outstanding = g_depth;
+    }
+    while (c->sent < g_request.size())
+    {
+        ssize_t n = send(c->fd, g_request.data() + c->sent, g_request.size() - c->sent, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EAGAIN)
+            {
+                watch(w, c, true, EPOLL_CTL_MOD);
+                return true;
+            }
+            return false;
+        }
+        c->sent += n;
+    }
+    watch(w, c, false, EPOLL_CTL_MOD);
+    return true;
+}
+
+// 解析响应头中的状态码与Content-Length
+static bool parse_header(conn *c)
+{
+    c->header[c->header_len] = '\0';
+    if (strncmp(c->header, "HTTP/1.1 ", 9) != 0)
+    {
+        return false;
+    }
+    c->status = atoi(c->header + 9);
+    c->body_left = 0;
+    for (char *p = strstr(c->header, "\r\n"); p; p = strstr(p + 2, "\r\n"))
+    {
+        if (strncasecmp(p + 2, "Content-Length:", 15) == 0)
+        {
+            c->body_left = atol(p + 17);
+            break;
+        }
+    }
+    return true;
+}
+
+// 一个响应读完，记录延迟；一批都读完后发送下一批或者等待服务器关闭
+static bool response_done(worker *w, conn *c)
+{
+    long now = now_ns();
+    w->latencies.push_back(now - c->start_ns);
+    w->requests++;
+    if (c->status >= 400)
+        w->errors++;
+    c->header_len = 0;
+    c->body_left = -1;
+    if (--c->outstanding > 0)
+    {
+        return true;
+    }
+    c->sent = 0;
+    if (g_mode == MODE_CLOSE) // 等服务器关闭连接后再建立新连接，TIME_WAIT留在服务器一侧
+    {
+        return true;
+    }
+    return now >= g_deadline_ns || send_batch(w, c);
+}
+
+// 处理读到的数据，其中可能包括多个流水线响应
+static bool consume(worker *w, conn *c, const char *data, long len)
+{
+    while (len > 0)
+    {
+        if (c->body_left < 0) // 读响应头
+        {
+            int old = c->header_len;
+            int n = std::min(len, (long)(HEADER_MAX - 1 - old));
+            memcpy(c->header + old, data, n);
+            c->header_len += n;
+            c->header[c->header_len] = '\0';
+            char *end = strstr(c->header + (old > 3 ? old - 3 : 0), "\r\n\r\n");
+            if (!end)
+            {
+                if (c->header_len >= HEADER_MAX - 1)
+                    return false;
+                return true;
+            }
+            int header_end = end + 4 - c->header;
+            int used = header_end - old;
+            c->header_len = header_end;
+            if (!parse_header(c))
+            {
+                return false;
+            }
+            data += used;
+            len -= used;
+            w->bytes += header_end;
+            if (c->body_left == 0 && !response_done(w, c))
+                return false;
+        }
+        else
+        {
+            long n = std::min(len, c->body_left);
+            c->body_left -= n;
+            data += n;
+            len -= n;
+            w->bytes += n;
+            if (c->body_left == 0 && !response_done(w, c))
+                return false;
+        }
+    }
+    return true;
+}
+
+static void handle_event(worker *w, conn *c, unsigned events, char *buf)
+{
+    if (c->connecting && (events & (EPOLLOUT | EPOLLERR | EPOLLHUP)))
+    {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+        if (err != 0)
+        {
+            w->errors++;
+            reopen_conn(w, c);
+            return;
+        }
+        c->connecting = false;
+        if (c->idle)
+        {
+            watch(w, c, false, EPOLL_CTL_MOD);
+            return;
+        }
+        if (!send_batch(w, c))
+        {
+            w->errors++;
+            reopen_conn(w, c);
+        }
+        return;
+    }
+    if ((events & EPOLLOUT) && c->sent < g_request.size() && !send_batch(w, c))
+    {
+        w->errors++;
+        reopen_conn(w, c);
+        return;
+    }
+    if (!(events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)))
+    {
+        return;
+    }
+    while (true)
+    {
+        ssize_t n = recv(c->fd, buf, RECV_BUFFER, 0);
+        if (n < 0 && errno == EAGAIN)
+        {
+            return;
+        }
+        if (n <= 0) // 服务器关闭了连接
+        {
+            if (c->outstanding > 0 || c->idle) // 请求没有得到完整的响应，或者空闲连接被超时关闭
+                w->errors++;
+            if (now_ns() < g_deadline_ns)
+                reopen_conn(w, c);
+            else
+            {
+                epoll_ctl(w->epoll_fd, EPOLL_CTL_DEL, c->fd, 0);
+                close(c->fd);
+                c->fd = -1;
+            }
+            return;
+        }
+        if (!consume(w, c, buf, n))
+        {
+            w->errors++;
+            reopen_conn(w, c);
+            return;
+        }
+    }
+}
+
+static void *worker_func(void *arg)
+{
+    worker *w = (worker *)arg;
+    char *buf = (char *)malloc(RECV_BUFFER);
+    epoll_event events[MAX_EVENTS];
+    for (int i = 0; i < w->active + w->idle; ++i)
+    {
+        conn *c = new conn;
+        c->idle = i >= w->active;
+        if (!open_conn(w, c))
+            w->errors++;
+        w->conns.push_back(c);
+    }
+    while (now_ns() < g_deadline_ns)
+    {
+        int n = epoll_wait(w->epoll_fd, events, MAX_EVENTS, 10);
+        for (int i = 0; i < n; ++i)
+            handle_event(w, (conn *)events[i].data.ptr, events[i].events, buf);
+    }
+    for (size_t i = 0; i < w->conns.size(); ++i)
+    {
+        if (w->conns[i]->fd >= 0)
+            close(w->conns[i]->fd);
+        delete w->conns[i];
+    }
+    free(buf);
+    return 0;
+}
+
+// 服务器进程已经使用的CPU时间（微秒），读取失败时返回-1
+static long process_cpu_us(int pid)
+{
+    char path[64], stat[1024];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    ssize_t n = read(fd, stat, sizeof(stat) - 1);
+    close(fd);
+    if (n <= 0)
+    {
+        return -1;
+    }
+    stat[n] = '\0';
+    char *p = strrchr(stat, ')'); // 进程名中可能有空格，从最后一个')'之后开始数
+    if (!p)
+    {
+        return -1;
+    }
+    unsigned long utime, stime;
+    if (sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2)
+    {
+        return -1;
+    }
+    return (utime + stime) * 1000000L / sysconf(_SC_CLK_TCK);
+}
+
+static double percentile_us(std::vector<long> &v, double p)
+{
+    if (v.empty())
+    {
+        return 0;
+    }
+    size_t k = std::min(v.size() - 1, (size_t)(p * v.size()));
+    std::nth_element(v.begin(), v.begin() + k, v.end());
+    return v[k] / 1000.0;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *addr = "127.0.0.1", *path = "/index.html", *name = "default";
+    int port = 8080, threads = 2, conns = 16, idle = 0, server_pid = 0;
+    double seconds = 5;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "a:p:t:c:d:m:D:i:u:P:n:H")) != -1)
+    {
+        switch (opt)
+        {
+        case 'a': addr = optarg; break;
+        case 'p': port = atoi(optarg); break;
+        case 't': threads = atoi(optarg); break;
+        case 'c': conns = atoi(optarg); break;
+        case 'd': seconds = atof(optarg); break;
+        case 'D': g_depth = atoi(optarg); break;
+        case 'i': idle = atoi(optarg); break;
+        case 'u': path = optarg; break;
+        case 'P': server_pid = atoi(optarg); break;
+        case 'n': name = optarg; break;
+        case 'H':
+            printf("%s\n", g_header);
+            return 0;
+        case 'm':
+            if (strcmp(optarg, "close") == 0)
+                g_mode = MODE_CLOSE;
+            else if (strcmp(optarg, "keepalive") == 0)
+                g_mode = MODE_KEEPALIVE;
+            else if (strcmp(optarg, "pipeline") == 0)
+                g_mode = MODE_PIPELINE;
+            else
+                return 1;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-a addr] [-p port] [-t threads] [-c conns] [-d seconds] [-m close|keepalive|pipeline] [-D depth] [-i idle] [-u path] [-P server_pid] [-n name] [-H]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (threads <= 0 || conns < threads || g_depth <= 0)
+    {
+        fprintf(stderr, "need at least one connection per thread\n");
+        return 1;
+    }
+    if (g_mode != MODE_PIPELINE)
+        g_depth = 1;
+
+    memset(&g_addr, 0, sizeof(g_addr));
+    g_addr.sin_family = AF_INET;
+    g_addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, addr, &g_addr.sin_addr) != 1)
+    {
+        fprintf(stderr, "bad address %s\n", addr);
+        return 1;
+    }
+    std::string one = std::string("GET ") + path + " HTTP/1.1\r\nHost: " + addr + "\r\nConnection: " +
+                      (g_mode == MODE_CLOSE ? "close" : "keep-alive") + "\r\n\r\n";
+    for (int i = 0; i < g_depth; ++i)
+        g_request += one;
+
+    long cpu_start = server_pid > 0 ? process_cpu_us(server_pid) : -1;
+    long start = now_ns();
+    g_deadline_ns = start + (long)(seconds * 1e9);
+    std::vector<worker> workers(threads);
+    for (int i = 0; i < threads; ++i)
+    {
+        worker &w = workers[i];
+        w.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        w.active = conns / threads + (i < conns % threads);
+        w.idle = idle / threads + (i < idle % threads);
+        w.requests = w.errors = w.bytes = 0;
+        pthread_create(&w.thread, NULL, worker_func, &w);
+    }
+
+    std::vector<long> latencies;
+    long requests = 0, errors = 0, bytes = 0;
+    for (int i = 0; i < threads; ++i)
+    {
+        worker &w = workers[i];
+        pthread_join(w.thread, NULL);
+        close(w.epoll_fd);
+        latencies.insert(latencies.end(), w.latencies.begin(), w.latencies.end());
+        requests += w.requests;
+        errors += w.errors;
+        bytes += w.bytes;
+    }
+    double elapsed = (now_ns() - start) / 1e9;
+    long cpu_end = cpu_start >= 0 ? process_cpu_us(server_pid) : -1;
+    double cpu_per_req = cpu_end >= 0 && requests > 0 ? (double)(cpu_end - cpu_start) / requests : -1;
+
+    double p50 = percentile_us(latencies, 0.50);
+    double p99 = percentile_us(latencies, 0.99);
+    double p999 = percentile_us(latencies, 0.999);
+    printf("%s\t%s\t%d\t%d\t%ld\t%.0f\t%.1f\t%.1f\t%.1f\t%.2f\t%.1f\t%ld\n", name, mode_names[g_mode], conns, idle, requests,
+           requests / elapsed, p50, p99, p999, cpu_per_req, bytes / elapsed / (1 << 20), errors);
+    return 0;
+}
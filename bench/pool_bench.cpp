@@ -0,0 +1,125 @@
+// 线程池基准测试：比较工作窃取线程池与改造前的互斥锁线程池
+// 用法: pool_bench [tasks] [work_ns] [producers]
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include <atomic>
+#include "../thread_pool.h"
+#include "legacy_thread_pool.h"
+
+#define TASK_SLOTS 4096
+
+static std::atomic<long> g_done(0);
+static long g_work_ns = 200;
+
+static long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+// 模拟一次请求处理：忙等约work_ns纳秒
+struct bench_task
+{
+    void process()
+    {
+        long end = now_ns() + g_work_ns;
+        while (now_ns() < end)
+            ;
+        g_done.fetch_add(1, std::memory_order_relaxed);
+    }
+};
+
+static bench_task g_tasks[TASK_SLOTS];
+
+template <typename POOL>
+struct producer_arg
+{
+    POOL *pool;
+    long count;
+    long rejected;
+};
+
+template <typename POOL>
+static void *producer_func(void *arg)
+{
+    producer_arg<POOL> *p = (producer_arg<POOL> *)arg;
+    for (long i = 0; i < p->count; ++i)
+    {
+        while (!p->pool->append(g_tasks + (i % TASK_SLOTS)))
+        {
+            p->rejected++;
+            sched_yield();
+        }
+    }
+    return 0;
+}
+
+// 返回每秒完成的任务数
+template <typename POOL>
+static double run(POOL *pool, long tasks, int producers, long *rejected)
+{
+    g_done.store(0);
+    producer_arg<POOL> args[producers];
+    pthread_t threads[producers];
+
+    long start = now_ns();
+    for (int i = 0; i < producers; ++i)
+    {
+        args[i].pool = pool;
+        args[i].count = tasks / producers;
+        args[i].rejected = 0;
+        pthread_create(threads + i, NULL, producer_func<POOL>, args + i);
+    }
+    for (int i = 0; i < producers; ++i)
+        pthread_join(threads[i], NULL);
+    long total = (tasks / producers) * producers;
+    while (g_done.load(std::memory_order_relaxed) < total)
+        sched_yield();
+    long elapsed = now_ns() - start;
+
+    *rejected = 0;
+    for (int i = 0; i < producers; ++i)
+        *rejected += args[i].rejected;
+    return total * 1e9 / elapsed;
+}
+
+int main(int argc, char *argv[])
+{
+    long tasks = 1000000;
+    int producers = 1;
+    if (argc > 1)
+        tasks = atol(argv[1]);
+    if (argc > 2)
+        g_work_ns = atol(argv[2]);
+    if (argc > 3)
+        producers = atoi(argv[3]);
+
+    const int thread_counts[] = {1, 4, 16, 64};
+    double results[4][2];
+    long rejected[4][2];
+
+    for (int i = 0; i < 4; ++i)
+    {
+        int n = thread_counts[i];
+
+        // 旧线程池的析构函数不会停止工作线程，这里故意不释放
+        legacy_thread_pool<bench_task> *legacy = new legacy_thread_pool<bench_task>(n, MAX_REQUESTS);
+        results[i][0] = run(legacy, tasks, producers, &rejected[i][0]);
+
+        thread_pool<bench_task> *pool = new thread_pool<bench_task>(n, MAX_REQUESTS);
+        results[i][1] = run(pool, tasks, producers, &rejected[i][1]);
+        delete pool;
+    }
+
+    printf("\n# tasks=%ld work_ns=%ld producers=%d\n", tasks, g_work_ns, producers);
+    printf("%-8s %16s %16s %10s %12s %12s\n", "threads", "legacy_tasks/s", "steal_tasks/s", "speedup", "legacy_full", "steal_full");
+    for (int i = 0; i < 4; ++i)
+    {
+        printf("%-8d %16.0f %16.0f %9.2fx %12ld %12ld\n", thread_counts[i], results[i][0], results[i][1],
+               results[i][1] / results[i][0], rejected[i][0], rejected[i][1]);
+    }
+    return 0;
+}
@@ -0,0 +1,54 @@
+#!/bin/bash
+# 端到端基准测试：启动一个本地服务器实例，依次运行各个场景，结果以制表符分隔写到标准输出和$OUT
+# 用法: bench/run_bench.sh [baseline.tsv]
+#   给出基线文件时，逐个场景比较吞吐量、延迟与每个请求的CPU时间
+#   环境变量: PORT DURATION THREADS SERVER_ARGS（传给web_server.out，如"-e uring"） OUT
+cd "$(dirname "$0")/.." || exit 1
+PORT=${PORT:-18080}
+DURATION=${DURATION:-5}
+THREADS=${THREADS:-2}
+OUT=${OUT:-bench_results.tsv}
+BASELINE=$1
+LARGE=bench_large.bin # 放在资源目录中的大文件，测试结束后删除
+
+ulimit -n 8192 2>/dev/null
+head -c $((8 << 20)) /dev/urandom > resource/$LARGE
+./web_server.out $PORT $SERVER_ARGS > /dev/null 2>&1 &
+SERVER=$!
+trap 'kill $SERVER 2>/dev/null; rm -f resource/$LARGE' EXIT
+
+# 等待服务器开始监听
+for i in $(seq 50); do
+    ss -ltn "sport = :$PORT" | grep -q LISTEN && break
+    sleep 0.1
+done
+if ! kill -0 $SERVER 2>/dev/null; then
+    echo "web_server.out failed to start on port $PORT" >&2
+    exit 1
+fi
+
+run()
+{
+    name=$1
+    shift
+    ./load_gen.out -p $PORT -t $THREADS -d $DURATION -P $SERVER -n $name "$@"
+}
+
+{
+    ./load_gen.out -H
+    run short_lived -m close -c 32
+    run keepalive -m keepalive -c 64
+    run pipelined -m pipeline -c 16 -D 16
+    run idle_plus_active -m keepalive -c 8 -i 2000
+    run large_file -m keepalive -c 8 -u /$LARGE
+} | tee $OUT
+
+[ -n "$BASELINE" ] || exit 0
+echo
+echo "compared with $BASELINE (change in percent, negative latency/cpu is better):"
+awk -F'\t' '
+    NR == FNR { if (FNR > 1) { rps[$1] = $6; p50[$1] = $7; p99[$1] = $8; p999[$1] = $9; cpu[$1] = $10 } next }
+    function pct(now, old) { return old > 0 ? sprintf("%+.1f", (now - old) * 100 / old) : "n/a" }
+    FNR == 1 { printf "%-18s %8s %8s %8s %8s %8s\n", "scenario", "rps", "p50", "p99", "p999", "cpu/req"; next }
+    ($1 in rps) { printf "%-18s %8s %8s %8s %8s %8s\n", $1, pct($6, rps[$1]), pct($7, p50[$1]), pct($8, p99[$1]), pct($9, p999[$1]), pct($10, cpu[$1]) }
+' "$BASELINE" $OUT
@@ -0,0 +1,309 @@
+#include "cpu_affinity.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <algorithm>
+#include <map>
+#include <vector>
+
+struct numa_topology
+{
+    int nodes;
+    unsigned char cpu_node[CPU_SETSIZE];
+};
+
+static thread_local int thread_node = -1;
+
+static bool read_line(const char *path, char *buf, size_t len)
+{
+    FILE *f = fopen(path, "r");
+    if (!f)
+    {
+        return false;
+    }
+    bool ok = fgets(buf, len, f) != 0;
+    fclose(f);
+    if (ok)
+    {
+        buf[strcspn(buf, "\n")] = '\0';
+    }
+    return ok;
+}
+
+// 节点列表与CPU列表格式相同；节点号超过上限的CPU算作最后一个节点
+static const numa_topology &topology()
+{
+    static const numa_topology topo = []
+    {
+        numa_topology t;
+        t.nodes = 1;
+        memset(t.cpu_node, 0, sizeof(t.cpu_node));
+        char buf[4096], path[128];
+        cpu_set_t online, cpus;
+        if (!read_line("/sys/devices/system/node/online", buf, sizeof(buf)) || !parse_cpu_list(buf, &online))
+        {
+            return t;
+        }
+        for (int n = 0; n < CPU_SETSIZE; ++n)
+        {
+            if (!CPU_ISSET(n, &online))
+                continue;
+            int node = std::min(n, NUMA_MAX_NODES - 1);
+            t.nodes = std::max(t.nodes, node + 1);
+            snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", n);
+            if (!read_line(path, buf, sizeof(buf)) || !parse_cpu_list(buf, &cpus))
+                continue;
+            for (int c = 0; c < CPU_SETSIZE; ++c)
+            {
+                if (CPU_ISSET(c, &cpus))
+                    t.cpu_node[c] = node;
+            }
+        }
+        return t;
+    }();
+    return topo;
+}
+
+bool parse_cpu_list(const char *s, cpu_set_t *set)
+{
+    CPU_ZERO(set);
+    while (*s)
+    {
+        char *end;
+        long first = strtol(s, &end, 10);
+        if (end == s || first < 0)
+        {
+            return false;
+        }
+        long last = first;
+        if (*end == '-')
+        {
+            s = end + 1;
+            last = strtol(s, &end, 10);
+            if (end == s || last < first)
+                return false;
+        }
+        if (last >= CPU_SETSIZE)
+        {
+            return false;
+        }
+        for (long c = first; c <= last; ++c)
+            CPU_SET(c, set);
+        s = end;
+        if (*s == ',')
+            s++;
+        else if (*s)
+            return false;
+    }
+    return CPU_COUNT(set) > 0;
+}
+
+std::string format_cpu_list(const cpu_set_t *set)
+{
+    std::string s;
+    for (int c = 0; c < CPU_SETSIZE; ++c)
+    {
+        if (!CPU_ISSET(c, set))
+            continue;
+        int last = c;
+        while (last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, set))
+            last++;
+        if (!s.empty())
+            s += ',';
+        s += std::to_string(c);
+        if (last > c)
+            s += '-' + std::to_string(last);
+        c = last;
+    }
+    return s.empty() ? "none" : s;
+}
+
+int numa_node_count()
+{
+    return topology().nodes;
+}
+
+int numa_node_of_cpu(int cpu)
+{
+    return cpu >= 0 && cpu < CPU_SETSIZE ? topology().cpu_node[cpu] : 0;
+}
+
+void numa_node_cpus(const cpu_set_t *set, int node, cpu_set_t *out)
+{
+    CPU_ZERO(out);
+    for (int c = 0; c < CPU_SETSIZE; ++c)
+    {
+        if (CPU_ISSET(c, set) && numa_node_of_cpu(c) == node)
+            CPU_SET(c, out);
+    }
+}
+
+int numa_current_node()
+{
+    if (thread_node >= 0)
+    {
+        return thread_node;
+    }
+    if (numa_node_count() == 1)
+    {
+        return 0;
+    }
+    return numa_node_of_cpu(sched_getcpu());
+}
+
+void numa_set_thread_node(int node)
+{
+    thread_node = node;
+}
+
+int affinity_attr(pthread_attr_t *attr, const cpu_set_t *set)
+{
+    if (!set || CPU_COUNT(set) == 0)
+    {
+        return -1;
+    }
+    pthread_attr_setaffinity_np(attr, sizeof(cpu_set_t), set);
+    int node = -1;
+    for (int c = 0; c < CPU_SETSIZE; ++c)
+    {
+        if (!CPU_ISSET(c, set))
+            continue;
+        if (node >= 0 && numa_node_of_cpu(c) != node)
+            return -1;
+        node = numa_node_of_cpu(c);
+    }
+    return node;
+}
+
+static std::string node_list(const cpu_set_t *set)
+{
+    std::string s;
+    for (int n = 0; n < numa_node_count(); ++n)
+    {
+        cpu_set_t cpus;
+        numa_node_cpus(set, n, &cpus);
+        if (CPU_COUNT(&cpus) == 0)
+            continue;
+        if (!s.empty())
+            s += ',';
+        s += std::to_string(n);
+    }
+    return s.empty() ? "-" : s;
+}
+
+// rps_cpus是逗号分隔的十六进制掩码，最右边是CPU 0
+static void parse_cpu_mask(const char *s, cpu_set_t *set)
+{
+    CPU_ZERO(set);
+    int cpu = 0;
+    for (int i = strlen(s) - 1; i >= 0 && cpu < CPU_SETSIZE; --i)
+    {
+        if (s[i] == ',')
+            continue;
+        int v = s[i] <= '9' ? s[i] - '0' : (s[i] | 0x20) - 'a' + 10;
+        for (int b = 0; b < 4 && cpu < CPU_SETSIZE; ++b, ++cpu)
+        {
+            if (v >> b & 1)
+                CPU_SET(cpu, set);
+        }
+    }
+}
+
+// /proc/interrupts每行最后一列是中断的名字，网卡驱动通常带上接口名与队列号
+static std::map<int, std::string> irq_names()
+{
+    std::map<int, std::string> names;
+    FILE *f = fopen("/proc/interrupts", "r");
+    if (!f)
+    {
+        return names;
+    }
+    char line[4096];
+    while (fgets(line, sizeof(line), f))
+    {
+        char *end;
+        long irq = strtol(line, &end, 10);
+        if (end == line || *end != ':')
+            continue;
+        line[strcspn(line, "\n")] = '\0';
+        char *name = strrchr(line, ' ');
+        names[irq] = name ? name + 1 : "";
+    }
+    fclose(f);
+    return names;
+}
+
+static void list_dir(const char *path, std::vector<std::string> &out)
+{
+    DIR *d = opendir(path);
+    if (!d)
+    {
+        return;
+    }
+    struct dirent *ent;
+    while ((ent = readdir(d)) != 0)
+    {
+        if (ent->d_name[0] != '.')
+            out.push_back(ent->d_name);
+    }
+    closedir(d);
+    std::sort(out.begin(), out.end());
+}
+
+// 只列出有物理设备的接口；MSI中断在设备目录或其上一级（virtio）的msi_irqs下
+void report_nic_affinity(FILE *out)
+{
+    std::vector<std::string> ifaces;
+    list_dir("/sys/class/net", ifaces);
+    std::map<int, std::string> names;
+    bool loaded = false;
+    char path[512], buf[4096];
+    for (size_t i = 0; i < ifaces.size(); ++i)
+    {
+        const char *name = ifaces[i].c_str();
+        snprintf(path, sizeof(path), "/sys/class/net/%s/device", name);
+        if (access(path, F_OK) != 0)
+            continue;
+        if (!loaded)
+        {
+            names = irq_names();
+            loaded = true;
+        }
+        snprintf(path, sizeof(path), "/sys/class/net/%s/device/numa_node", name);
+        const char *node = read_line(path, buf, sizeof(buf)) && atoi(buf) >= 0 ? buf : "-";
+        std::vector<std::string> queues, irqs;
+        snprintf(path, sizeof(path), "/sys/class/net/%s/queues", name);
+        list_dir(path, queues);
+        long rx = std::count_if(queues.begin(), queues.end(), [](const std::string &q) { return q.compare(0, 3, "rx-") == 0; });
+        fprintf(out, "NIC %s: node %s, %ld rx queues\n", name, node, rx);
+
+        snprintf(path, sizeof(path), "/sys/class/net/%s/device/msi_irqs", name);
+        list_dir(path, irqs);
+        if (irqs.empty())
+        {
+            snprintf(path, sizeof(path), "/sys/class/net/%s/device/../msi_irqs", name);
+            list_dir(path, irqs);
+        }
+        for (size_t k = 0; k < irqs.size(); ++k)
+        {
+            int irq = atoi(irqs[k].c_str());
+            cpu_set_t cpus;
+            snprintf(path, sizeof(path), "/proc/irq/%d/smp_affinity_list", irq);
+            if (!read_line(path, buf, sizeof(buf)) || !parse_cpu_list(buf, &cpus))
+                continue;
+            fprintf(out, "  irq %d %s: cpus %s, node %s\n", irq, names.count(irq) ? names[irq].c_str() : "?", format_cpu_list(&cpus).c_str(),
+                    node_list(&cpus).c_str());
+        }
+        for (size_t k = 0; k < queues.size(); ++k)
+        {
+            cpu_set_t cpus;
+            snprintf(path, sizeof(path), "/sys/class/net/%s/queues/%s/rps_cpus", name, queues[k].c_str());
+            if (!read_line(path, buf, sizeof(buf)))
+                continue;
+            parse_cpu_mask(buf, &cpus);
+            if (CPU_COUNT(&cpus) > 0)
+                fprintf(out, "  %s rps: cpus %s, node %s\n", queues[k].c_str(), format_cpu_list(&cpus).c_str(), node_list(&cpus).c_str());
+        }
+    }
+}
@@ -0,0 +1,33 @@
+#ifndef CPU_AFFINITY_H
+#define CPU_AFFINITY_H
+
+#include <stdio.h>
+#include <sched.h>
+#include <pthread.h>
+#include <string>
+
+#define NUMA_MAX_NODES 8 // 按节点分开的对象池与缓冲区池最多的节点数，更多的节点合并到最后一个
+
+// CPU与NUMA节点的拓扑从/sys读取，不依赖libnuma；没有NUMA信息时所有CPU属于节点0。
+// 内存按首次访问分配在访问线程所在的节点上，所以线程绑定到一个节点的CPU后，
+// 它首先分配并写入的连接对象与缓冲区就是节点本地的
+
+// 解析"0-3,8,10-11"形式的CPU列表，格式错误或超出CPU_SETSIZE时返回false
+bool parse_cpu_list(const char *s, cpu_set_t *set);
+std::string format_cpu_list(const cpu_set_t *set);
+
+int numa_node_count();         // 在线的节点数，至少为1，不超过NUMA_MAX_NODES
+int numa_node_of_cpu(int cpu); // 不知道时返回0
+void numa_node_cpus(const cpu_set_t *set, int node, cpu_set_t *out); // set中属于node的CPU
+
+// 当前线程所在的节点：绑定到一个节点的线程返回绑定时记录的节点，其他线程按当前运行的CPU查找
+int numa_current_node();
+void numa_set_thread_node(int node);
+
+// 用set中的CPU设置线程属性，set为空时不绑定；返回set中的CPU都属于的节点，跨节点时返回-1
+int affinity_attr(pthread_attr_t *attr, const cpu_set_t *set);
+
+// 输出各网卡接收队列的中断与RPS所在的CPU和节点，用来与反应堆、工作线程的绑定对齐
+void report_nic_affinity(FILE *out);
+
+#endif
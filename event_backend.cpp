@@ -0,0 +1,222 @@
+#include "event_backend.h"
+#include "http_conn.h"
+#include <algorithm>
+#include <fcntl.h>
+#include <poll.h>
+
+event_backend::event_backend(int id, int port, int backlog, bool reuse_port, http_conn **users, thread_pool<http_conn> *pool, OVERLOAD_POLICY overload)
+    : m_id(id), m_cpu(-1), m_users(users), m_pool(pool), m_overload(overload), m_accept_paused_ms(0), m_accept_log_time(0)
+{
+    struct sockaddr_in address;
+    address.sin_addr.s_addr = INADDR_ANY;
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+
+    m_listen_fd = socket(PF_INET, SOCK_STREAM, 0);
+    if (m_listen_fd < 0)
+    {
+        throw std::exception();
+    }
+
+    int reuse = 1;
+    if (setsockopt(m_listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) != 0) // 端口复用
+    {
+        close(m_listen_fd);
+        throw std::exception();
+    }
+    if (reuse_port && setsockopt(m_listen_fd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) != 0) // 多个监听套接字共享端口
+    {
+        close(m_listen_fd);
+        throw std::exception();
+    }
+    if (bind(m_listen_fd, (struct sockaddr *)&address, sizeof(address)) != 0)
+    {
+        close(m_listen_fd);
+        throw std::exception();
+    }
+    if (listen(m_listen_fd, backlog) != 0)
+    {
+        close(m_listen_fd);
+        throw std::exception();
+    }
+    m_reserve_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+}
+
+event_backend::~event_backend()
+{
+    close(m_listen_fd);
+    if (m_reserve_fd >= 0)
+        close(m_reserve_fd);
+}
+
+int event_backend::m_max_conns = MAX_FD;
+long event_backend::m_max_queue = 0;
+long event_backend::m_max_delay_ms = ADMIT_MAX_DELAY_MS;
+bool event_backend::m_run_inline = false;
+static std::atomic<long> queue_delay_ns(0); // 排队时间的指数滑动平均（权重1/8）
+
+void event_backend::record_queue_delay(long ns)
+{
+    static thread_local unsigned batches = 0;
+    if (batches++ % QUEUE_DELAY_SAMPLE != 0) // 抽样，避免所有工作线程每次都写同一个缓存行
+    {
+        return;
+    }
+    long old = queue_delay_ns.load(std::memory_order_relaxed);
+    queue_delay_ns.store(old + (ns - old) / 8, std::memory_order_relaxed);
+}
+
+// 队列为空时不看排队时间：滑动平均只在有请求时更新，空闲后的旧值不应该继续拒绝连接
+bool event_backend::admit(int fd, const sockaddr_in &addr)
+{
+    bool admitted = fd < MAX_FD && http_conn::m_user_count < m_max_conns;
+    if (admitted && (m_max_queue > 0 || m_max_delay_ms > 0))
+    {
+        long depth = queue_depth();
+        if (m_max_queue > 0 && depth >= m_max_queue)
+            admitted = false;
+        else if (m_max_delay_ms > 0 && depth > 0 && queue_delay_ns.load(std::memory_order_relaxed) > m_max_delay_ms * 1000000L)
+            admitted = false;
+    }
+    if (!admitted)
+    {
+        http_conn::reject(fd, addr);
+    }
+    return admitted;
+}
+
+bool event_backend::accept_failed(int err)
+{
+    time_t now = time(0);
+    if (now != m_accept_log_time)
+    {
+        m_accept_log_time = now;
+        printf("Reactor %d: Accept Error! Errno is: %d\n", m_id, err);
+    }
+    if ((err == EMFILE || err == ENFILE) && m_reserve_fd >= 0)
+    {
+        close(m_reserve_fd);
+        // io_uring后端的监听套接字是阻塞的，先确认有连接在等待
+        struct pollfd pfd = {m_listen_fd, POLLIN, 0};
+        if (poll(&pfd, 1, 0) == 1)
+        {
+            struct sockaddr_in addr;
+            socklen_t len = sizeof(addr);
+            int fd = accept4(m_listen_fd, (struct sockaddr *)&addr, &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            io_stat_add(STAT_ACCEPT);
+            if (fd >= 0)
+                http_conn::reject(fd, addr);
+        }
+        m_reserve_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        if (m_reserve_fd >= 0)
+            return false;
+    }
+    m_accept_paused_ms = timer_wheel::now_ms() + ACCEPT_PAUSE_MS;
+    return true;
+}
+
+bool event_backend::accept_resume()
+{
+    if (!m_accept_paused_ms || timer_wheel::now_ms() < m_accept_paused_ms)
+    {
+        return false;
+    }
+    m_accept_paused_ms = 0;
+    return true;
+}
+
+void *event_backend::run_static(void *arg)
+{
+    event_backend *backend = (event_backend *)arg;
+    if (backend->m_cpu >= 0)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(backend->m_cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        numa_set_thread_node(numa_node_of_cpu(backend->m_cpu)); // 新连接的对象与缓冲区从本节点的池中取得
+    }
+    backend->run();
+    return backend;
+}
+
+void event_backend::set_cpu(int cpu)
+{
+    m_cpu = cpu;
+    setsockopt(m_listen_fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof(cpu)); // 不支持时忽略
+}
+
+// 线程池队列满时连接已经不在后端的监视之下，必须在这里处理或关闭，否则连接永远不会被重新注册
+// 直接处理的请求不计入排队时间，处理完后由want_write在本线程上登记发送
+void event_backend::dispatch(http_conn *conn)
+{
+    if (m_run_inline && conn->can_run_inline())
+    {
+        metric_dispatch(DISPATCH_INLINE);
+        conn->process();
+        return;
+    }
+    conn->set_busy();
+    if (m_pool->append(conn))
+    {
+        metric_dispatch(DISPATCH_POOL);
+        return;
+    }
+    metric_dispatch(DISPATCH_OVERFLOW);
+    if (m_overload == OVERLOAD_INLINE)
+    {
+        conn->process();
+    }
+    else
+    {
+        conn->reject_overload();
+    }
+}
+
+// 定时器最多隔这么久检查一次连接：新的截止时间至少在最短的超时之后，所以截止时间提前时也能按时关闭
+static long timer_check_ms()
+{
+    long check = LONG_MAX;
+    for (int i = 0; i < http_conn::TIMEOUT_NUM; ++i)
+    {
+        if (http_conn::m_timeouts[i] > 0 && http_conn::m_timeouts[i] * 1000L < check)
+            check = http_conn::m_timeouts[i] * 1000L;
+    }
+    return check;
+}
+
+void event_backend::start_timer(http_conn *conn)
+{
+    m_timers.add(std::min(conn->deadline() - timer_wheel::now_ms(), timer_check_ms()), conn, conn->timer_gen());
+}
+
+// 连接的截止时间随读写活动更新，不移动定时器；定时器到期时再按最新的截止时间重新调度或关闭连接
+void event_backend::expire_timers()
+{
+    timer_node *node = m_timers.expire();
+    long now = timer_wheel::now_ms();
+    while (node)
+    {
+        timer_node *next = node->next;
+        http_conn *conn = (http_conn *)node->data;
+        long deadline = conn->deadline();
+        if (conn->timer_gen() != node->gen || conn->sockfd() < 0) // 连接已经关闭或者被其他连接复用
+        {
+            m_timers.remove(node);
+        }
+        else if (deadline == 0) // 正在由工作线程处理
+        {
+            m_timers.reschedule(node, TIMER_BUSY_RECHECK_MS);
+        }
+        else if (deadline > now)
+        {
+            m_timers.reschedule(node, std::min(deadline - now, timer_check_ms()));
+        }
+        else
+        {
+            m_timers.remove(node);
+            conn->close_conn();
+        }
+        node = next;
+    }
+}
@@ -0,0 +1,88 @@
+#ifndef EVENT_BACKEND_H
+#define EVENT_BACKEND_H
+
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <exception>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "thread_pool.h"
+#include "timer_wheel.h"
+
+#define MAX_FD 65534     // 最大的文件描述符个数
+#define LISTEN_BACKLOG 5 // 默认监听队列长度
+#define TIMER_BUSY_RECHECK_MS 1000 // 连接正在由工作线程处理时，隔多久再检查一次超时
+#define ACCEPT_BATCH 64            // 监听套接字每次可读时最多接受的连接数，剩下的留到下一轮
+#define ADMIT_MAX_DELAY_MS 200     // 默认：线程池排队时间的滑动平均超过该值时拒绝新连接
+#define QUEUE_DELAY_SAMPLE 16      // 工作线程每处理这么多批请求更新一次排队时间的滑动平均
+#define ACCEPT_PAUSE_MS 100        // 内存不足等无法立即解决的accept错误后，暂停接受新连接的时间
+
+class http_conn;
+
+// 任务队列满时的处理策略
+enum OVERLOAD_POLICY
+{
+    OVERLOAD_INLINE, // 在反应堆线程上直接处理请求
+    OVERLOAD_REJECT  // 发送预先生成的503响应并关闭连接
+};
+
+// 事件后端：一个监听套接字以及由它接受的连接上的全部I/O
+// 多反应堆模式下每个线程各自拥有一个后端，监听套接字通过SO_REUSEPORT绑定同一端口，由内核分发新连接
+// add只在后端自己的线程上调用，want_read/want_write/remove也可以由工作线程调用
+// 每个后端有自己的时间轮，连接只在所属后端的线程上被超时关闭
+class event_backend
+{
+public:
+    event_backend(int id, int port, int backlog, bool reuse_port, http_conn **users, thread_pool<http_conn> *pool, OVERLOAD_POLICY overload);
+    virtual ~event_backend();
+
+    virtual void run() = 0;                       // 事件循环
+    virtual void add(http_conn *conn) = 0;        // 注册新接受的连接
+    virtual void want_read(http_conn *conn) = 0;  // 等待连接上的新数据
+    virtual void want_write(http_conn *conn) = 0; // 发送连接上已经生成的响应
+    // 注销并关闭连接的套接字；返回false表示内核仍在读取连接的发送缓冲，后端在发送结束后调用conn->finish_close()
+    virtual bool remove(http_conn *conn) = 0;
+
+    // 准入控制：连接数、线程池中等待的连接数或排队时间超过限制时，新连接收到503后被关闭，0表示不限制该项
+    static int m_max_conns;
+    static long m_max_queue;
+    static long m_max_delay_ms;
+    static void record_queue_delay(long ns); // 工作线程抽样更新排队时间的滑动平均
+
+    // 运行到完成：缓冲的请求都命中资源包或文件缓存时在反应堆线程上直接处理，不经过线程池
+    static bool m_run_inline;
+
+    static void *run_static(void *arg); // 供pthread_create调用，绑定了CPU时先把当前线程绑定上去
+    void set_cpu(int cpu);              // 反应堆线程只在cpu上运行，SO_REUSEPORT组内该CPU上收到的新连接优先分给这个反应堆
+    void dispatch(http_conn *conn);     // 将读完数据的连接交给线程池或直接处理，只在后端自己的线程上调用
+    long queue_depth() const { return m_pool->queue_size(); } // 线程池中等待处理的连接数
+
+protected:
+    bool admit(int fd, const sockaddr_in &addr); // 新连接是否可以接受，不能接受时已经回答503并关闭
+    void start_timer(http_conn *conn); // 为新连接加入定时器
+    void expire_timers();              // 关闭超时的连接
+    int timer_wait_ms() const { return m_timers.empty() && !m_accept_paused_ms ? -1 : TIMER_TICK_MS; } // 事件循环最长的等待时间
+
+    // accept失败时调用。文件描述符用尽时关闭预留的描述符，接受一个连接回答503后关闭，再重新预留；
+    // 否则（内存不足等）暂停接受新连接ACCEPT_PAUSE_MS，避免水平触发的监听套接字空转。返回是否暂停
+    bool accept_failed(int err);
+    bool accept_resume(); // 暂停到期时返回true，调用者重新开始接受新连接
+
+    int m_id;
+    int m_cpu; // 绑定的CPU，-1为不绑定
+    int m_listen_fd;
+    http_conn **m_users; // 按套接字索引的连接，所有后端共享，没有连接的位置为NULL
+    thread_pool<http_conn> *m_pool;
+    OVERLOAD_POLICY m_overload;
+    timer_wheel m_timers;
+    int m_reserve_fd;         // 预留的文件描述符，描述符用尽时腾出来接受连接
+    long m_accept_paused_ms;  // 暂停接受新连接直到这个时间，0为没有暂停
+    time_t m_accept_log_time; // 上一次输出accept错误的时间，持续出错时每秒只输出一次
+};
+
+#endif
@@ -0,0 +1,303 @@
+#include "file_cache.h"
+#include <dirent.h>
+#include <poll.h>
+#include <sys/inotify.h>
+
+#define WATCH_MASK (IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB | IN_CREATE | IN_DELETE | IN_DELETE_SELF | IN_MOVED_FROM | IN_MOVED_TO)
+
+file_cache::file_cache(const char *root, size_t capacity, size_t max_entry)
+    : m_root(root), m_max_entry(max_entry), m_table(FILE_CACHE_SLOTS, FILE_CACHE_PROBE, capacity), m_generation(0), m_stop(false)
+{
+    if (max_entry == 0)
+    {
+        throw std::exception();
+    }
+    if (m_max_entry > capacity)
+        m_max_entry = capacity;
+
+    // 没有inotify就无法得知文件被修改，此时不能使用缓存
+    m_inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (m_inotify_fd < 0)
+    {
+        throw std::exception();
+    }
+    add_watch("");
+
+    if (pthread_create(&m_watch_thread, NULL, watch_func_static, this) != 0)
+    {
+        close(m_inotify_fd);
+        throw std::exception();
+    }
+}
+
+file_cache::~file_cache()
+{
+    m_stop = true;
+    pthread_join(m_watch_thread, NULL);
+    close(m_inotify_fd);
+}
+
+// FNV-1a
+uint32_t file_cache::hash_key(const char *key)
+{
+    uint32_t h = 2166136261u;
+    for (; *key; ++key)
+    {
+        h ^= (unsigned char)*key;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+bool file_cache::normalize_url(const char *url, char *out, size_t out_len)
+{
+    size_t len = 0;
+    const char *p = url;
+    if (out_len < 2 || *p != '/')
+    {
+        return false;
+    }
+
+    while (*p && *p != '?' && *p != '#')
+    {
+        while (*p == '/')
+            ++p;
+        const char *seg = p;
+        while (*p && *p != '/' && *p != '?' && *p != '#')
+            ++p;
+        size_t seg_len = p - seg;
+
+        if (seg_len == 0 || (seg_len == 1 && seg[0] == '.'))
+        {
+            continue;
+        }
+        if (seg_len == 2 && seg[0] == '.' && seg[1] == '.')
+        {
+            if (len == 0) // 越过资源根目录
+            {
+                return false;
+            }
+            while (len > 0 && out[--len] != '/') // 去掉最后一段及其前面的'/'
+                ;
+            continue;
+        }
+        if (len + 1 + seg_len + 1 > out_len)
+        {
+            return false;
+        }
+        out[len++] = '/';
+        memcpy(out + len, seg, seg_len);
+        len += seg_len;
+    }
+    if (len == 0)
+    {
+        out[len++] = '/';
+    }
+    out[len] = '\0';
+    return true;
+}
+
+cache_entry *file_cache::acquire(const char *key)
+{
+    return m_table.acquire(hash_key(key), key);
+}
+
+void file_cache::release(cache_entry *entry)
+{
+    m_table.release(entry);
+}
+
+cache_entry *file_cache::load(const char *key, const char *path, const struct stat &st)
+{
+    if (!S_ISREG(st.st_mode) || (size_t)st.st_size > m_max_entry)
+    {
+        return 0;
+    }
+    unsigned generation = m_generation.load(std::memory_order_acquire);
+
+    // 在锁外读文件
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return 0;
+    }
+    char *data = (char *)malloc(st.st_size > 0 ? st.st_size : 1);
+    off_t have = 0;
+    while (data && have < st.st_size)
+    {
+        ssize_t n = pread(fd, data + have, st.st_size - have, have);
+        if (n <= 0)
+        {
+            free(data);
+            data = 0;
+            break;
+        }
+        have += n;
+    }
+    close(fd);
+    if (!data)
+    {
+        return 0;
+    }
+
+    cache_entry *entry = new cache_entry;
+    entry->key = key;
+    entry->hash = hash_key(key);
+    entry->data = data;
+    entry->st = st;
+    entry->refs.store(1, std::memory_order_relaxed);
+    entry->referenced.store(true, std::memory_order_relaxed);
+
+    m_table.lock();
+    // 读取期间发生过失效，读到的内容可能已经过时
+    if (m_generation.load(std::memory_order_acquire) != generation)
+    {
+        m_table.unlock();
+        delete entry;
+        return 0;
+    }
+    cache_entry *e = m_table.insert(entry);
+    m_table.unlock();
+    if (e != entry) // 其他线程已经插入
+    {
+        delete entry;
+    }
+    return e;
+}
+
+void file_cache::invalidate(const char *key)
+{
+    m_table.lock();
+    m_generation.fetch_add(1, std::memory_order_release);
+    m_table.remove(hash_key(key), key);
+    m_table.reclaim();
+    m_table.unlock();
+}
+
+void file_cache::invalidate_prefix(const char *prefix)
+{
+    size_t len = strlen(prefix);
+    m_table.lock();
+    m_generation.fetch_add(1, std::memory_order_release);
+    for (size_t i = 0; i < m_table.slots(); ++i)
+    {
+        cache_entry *e = m_table.at(i);
+        if (e && e->key.compare(0, len, prefix) == 0 && (e->key.size() == len || e->key[len] == '/'))
+        {
+            m_table.remove(i);
+        }
+    }
+    m_table.reclaim();
+    m_table.unlock();
+}
+
+void file_cache::clear()
+{
+    m_table.lock();
+    m_generation.fetch_add(1, std::memory_order_release);
+    for (size_t i = 0; i < m_table.slots(); ++i)
+    {
+        m_table.remove(i);
+    }
+    m_table.reclaim();
+    m_table.unlock();
+}
+
+// 递归地为dir（相对资源根目录）及其子目录添加inotify监视
+void file_cache::add_watch(const std::string &dir)
+{
+    std::string path = m_root + dir;
+    int wd = inotify_add_watch(m_inotify_fd, path.c_str(), WATCH_MASK | IN_ONLYDIR);
+    if (wd < 0)
+    {
+        printf("File cache: cannot watch %s, errno is: %d\n", path.c_str(), errno);
+        return;
+    }
+    m_watch_dirs[wd] = dir;
+
+    DIR *d = opendir(path.c_str());
+    if (!d)
+    {
+        return;
+    }
+    struct dirent *ent;
+    while ((ent = readdir(d)) != NULL)
+    {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+            continue;
+        std::string child = dir + "/" + ent->d_name;
+        struct stat st;
+        if (stat((m_root + child).c_str(), &st) == 0 && S_ISDIR(st.st_mode))
+            add_watch(child);
+    }
+    closedir(d);
+}
+
+void *file_cache::watch_func_static(void *arg)
+{
+    file_cache *cache = (file_cache *)arg;
+    cache->watch_func();
+    return cache;
+}
+
+void file_cache::watch_func()
+{
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct pollfd pfd;
+    pfd.fd = m_inotify_fd;
+    pfd.events = POLLIN;
+
+    while (!m_stop)
+    {
+        // 超时的时候顺便释放已经没有读者的条目
+        if (poll(&pfd, 1, 1000) <= 0)
+        {
+            m_table.lock();
+            m_table.reclaim();
+            m_table.unlock();
+            continue;
+        }
+
+        ssize_t len;
+        while ((len = ::read(m_inotify_fd, buf, sizeof(buf))) > 0)
+        {
+            for (char *p = buf; p < buf + len;)
+            {
+                struct inotify_event *ev = (struct inotify_event *)p;
+                p += sizeof(struct inotify_event) + ev->len;
+
+                if (ev->mask & IN_Q_OVERFLOW) // 事件丢失，只能全部失效
+                {
+                    clear();
+                    continue;
+                }
+                std::unordered_map<int, std::string>::iterator it = m_watch_dirs.find(ev->wd);
+                if (it == m_watch_dirs.end())
+                    continue;
+                if (ev->mask & IN_IGNORED)
+                {
+                    m_watch_dirs.erase(it);
+                    continue;
+                }
+                if (ev->len == 0) // 事件针对被监视的目录本身
+                {
+                    if (ev->mask & IN_DELETE_SELF)
+                        invalidate_prefix(it->second.empty() ? "" : it->second.c_str());
+                    continue;
+                }
+
+                std::string key = it->second + "/" + ev->name;
+                if (ev->mask & IN_ISDIR)
+                {
+                    if (ev->mask & (IN_CREATE | IN_MOVED_TO))
+                        add_watch(key);
+                    invalidate_prefix(key.c_str());
+                }
+                else
+                {
+                    invalidate(key.c_str());
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,82 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <atomic>
+#include <exception>
+#include "hazard_table.h"
+
+#define FILE_CACHE_SIZE (64 << 20)       // 默认缓存总大小
+#define FILE_CACHE_MAX_ENTRY (1 << 20)   // 单个文件超过该大小时不缓存
+#define FILE_CACHE_SLOTS 8192            // 哈希表槽位数，必须为2的幂
+#define FILE_CACHE_PROBE 8               // 线性探测的最大距离
+
+// 缓存的文件内容，读者持有引用期间内容保持不变
+struct cache_entry
+{
+    std::string key;  // 规范化后的URL
+    uint32_t hash;
+    char *data;       // 文件内容，用malloc分配
+    struct stat st;   // 读入时的文件状态
+    std::atomic<int> refs;        // 正在使用该条目的请求数
+    std::atomic<bool> referenced; // CLOCK淘汰算法的访问位
+    std::atomic<std::string *> headers[2]; // 预先生成的200响应头块，下标1为作为gzip压缩内容发送时；第一次使用时生成
+
+    cache_entry() : data(0) { headers[0].store(0, std::memory_order_relaxed); headers[1].store(0, std::memory_order_relaxed); }
+    ~cache_entry() { free(data); delete headers[0].load(); delete headers[1].load(); }
+    size_t cost() const { return st.st_size; }
+};
+
+// 所有工作线程共享的静态文件缓存，以规范化后的URL为键
+// 条目放在hazard_table中，读者不加锁，插入、淘汰和失效由写者在表的互斥锁内完成；
+// 后台线程通过inotify监视资源目录，文件被修改后对应的条目立即失效
+class file_cache
+{
+public:
+    file_cache(const char *root, size_t capacity = FILE_CACHE_SIZE, size_t max_entry = FILE_CACHE_MAX_ENTRY);
+    ~file_cache();
+
+    // 查找条目，命中时引用计数加一，使用完后必须调用release
+    cache_entry *acquire(const char *key);
+    // 把path的内容读入缓存并返回已加引用的条目，文件过大或读取期间缓存失效时返回NULL
+    cache_entry *load(const char *key, const char *path, const struct stat &st);
+    void release(cache_entry *entry);
+
+    void invalidate(const char *key); // 使一个URL失效
+    void invalidate_prefix(const char *prefix);
+    void clear();
+
+    size_t max_entry() const { return m_max_entry; }
+
+    // 规范化URL：去掉查询串，合并多余的'/'，处理"."与".."；越过根目录时返回false
+    static bool normalize_url(const char *url, char *out, size_t out_len);
+
+private:
+    static uint32_t hash_key(const char *key);
+
+    void add_watch(const std::string &dir);
+    static void *watch_func_static(void *arg);
+    void watch_func();
+
+    std::string m_root;
+    size_t m_max_entry;
+    hazard_table<cache_entry> m_table;
+    std::atomic<unsigned> m_generation; // 每次失效加一，用于丢弃读取期间被修改的文件
+
+    int m_inotify_fd;
+    std::unordered_map<int, std::string> m_watch_dirs; // inotify watch描述符 -> 相对资源根目录的路径
+    pthread_t m_watch_thread;
+    std::atomic<bool> m_stop;
+};
+
+#endif
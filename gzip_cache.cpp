@@ -0,0 +1,141 @@
+#include "gzip_cache.h"
+#include <zlib.h>
+#include <time.h>
+
+gzip_cache::gzip_cache(size_t capacity) : m_table(GZIP_CACHE_SLOTS, GZIP_CACHE_PROBE, capacity), m_stop(false)
+{
+    if (pthread_create(&m_reclaim_thread, NULL, reclaim_func, this) != 0)
+    {
+        throw std::exception();
+    }
+}
+
+gzip_cache::~gzip_cache()
+{
+    m_stop.store(true, std::memory_order_release);
+    pthread_join(m_reclaim_thread, NULL);
+}
+
+// 没有新的压缩结果插入时，被淘汰的条目只能在这里释放
+void *gzip_cache::reclaim_func(void *arg)
+{
+    gzip_cache *cache = (gzip_cache *)arg;
+    while (!cache->m_stop.load(std::memory_order_acquire))
+    {
+        struct timespec ts = {0, GZIP_RECLAIM_MS * 1000000L};
+        nanosleep(&ts, 0);
+        cache->m_table.lock();
+        cache->m_table.reclaim();
+        cache->m_table.unlock();
+    }
+    return cache;
+}
+
+file_id gzip_cache::make_id(const struct stat &st)
+{
+    file_id id;
+    id.dev = st.st_dev;
+    id.ino = st.st_ino;
+    id.size = st.st_size;
+    id.mtime_sec = st.st_mtim.tv_sec;
+    id.mtime_nsec = st.st_mtim.tv_nsec;
+    return id;
+}
+
+long gzip_cache::compress(const char *data, long len, char **out)
+{
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    // windowBits加16生成gzip格式而不是zlib格式
+    if (deflateInit2(&zs, GZIP_LEVEL, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        return -1;
+    }
+    uLong bound = deflateBound(&zs, len);
+    char *buf = (char *)malloc(bound);
+    if (!buf)
+    {
+        deflateEnd(&zs);
+        return -1;
+    }
+    zs.next_in = (Bytef *)data;
+    zs.avail_in = len;
+    zs.next_out = (Bytef *)buf;
+    zs.avail_out = bound;
+    int ret = deflate(&zs, Z_FINISH);
+    long out_len = zs.total_out;
+    deflateEnd(&zs);
+    if (ret != Z_STREAM_END || out_len >= len)
+    {
+        free(buf);
+        return -1;
+    }
+    *out = buf;
+    return out_len;
+}
+
+gzip_entry *gzip_cache::acquire(const struct stat &st)
+{
+    file_id id = make_id(st);
+    return m_table.acquire(file_id_hash()(id), id);
+}
+
+void gzip_cache::release(gzip_entry *entry)
+{
+    m_table.release(entry);
+}
+
+gzip_entry *gzip_cache::load(const char *path, const struct stat &st, const char *data)
+{
+    if (!S_ISREG(st.st_mode) || st.st_size <= 0 || st.st_size > GZIP_MAX_FILE)
+    {
+        return 0;
+    }
+
+    // 在锁外读文件并压缩
+    char *content = 0;
+    if (!data)
+    {
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            return 0;
+        }
+        content = (char *)malloc(st.st_size);
+        off_t have = 0;
+        while (content && have < st.st_size)
+        {
+            ssize_t n = pread(fd, content + have, st.st_size - have, have);
+            if (n <= 0)
+            {
+                free(content);
+                content = 0;
+                break;
+            }
+            have += n;
+        }
+        close(fd);
+        if (!content)
+        {
+            return 0;
+        }
+        data = content;
+    }
+
+    gzip_entry *entry = new gzip_entry;
+    entry->key = make_id(st);
+    entry->hash = file_id_hash()(entry->key);
+    entry->len = compress(data, st.st_size, &entry->data);
+    entry->refs.store(1, std::memory_order_relaxed);
+    entry->referenced.store(true, std::memory_order_relaxed);
+    free(content);
+
+    m_table.lock();
+    gzip_entry *e = m_table.insert(entry);
+    m_table.unlock();
+    if (e != entry) // 其他线程已经压缩过
+    {
+        delete entry;
+    }
+    return e;
+}
@@ -0,0 +1,90 @@
+#ifndef GZIP_CACHE_H
+#define GZIP_CACHE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <exception>
+#include "hazard_table.h"
+
+#define GZIP_CACHE_SIZE (16 << 20)  // 默认压缩缓存总大小
+#define GZIP_MAX_FILE (1 << 20)     // 超过该大小的文件不在运行时压缩
+#define GZIP_LEVEL 6                // zlib压缩级别
+#define GZIP_CACHE_SLOTS 1024       // 哈希表槽位数，必须为2的幂
+#define GZIP_CACHE_PROBE 8          // 线性探测的最大距离
+#define GZIP_RECLAIM_MS 100         // 后台线程释放已移出条目的间隔
+
+// 文件的标识：设备、inode、大小与修改时间，文件被修改后标识随之改变
+struct file_id
+{
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    long mtime_sec, mtime_nsec;
+
+    bool operator==(const file_id &o) const
+    {
+        return dev == o.dev && ino == o.ino && size == o.size && mtime_sec == o.mtime_sec && mtime_nsec == o.mtime_nsec;
+    }
+};
+
+struct file_id_hash
+{
+    size_t operator()(const file_id &id) const
+    {
+        return (id.ino * 0x9e3779b97f4a7c15ull) ^ (id.dev << 16) ^ id.size ^ (id.mtime_nsec << 8) ^ id.mtime_sec;
+    }
+};
+
+// 运行时压缩的结果，读者持有引用期间内容保持不变
+struct gzip_entry
+{
+    file_id key;
+    size_t hash;
+    char *data; // gzip格式的内容，用malloc分配
+    long len;   // 压缩后的长度，-1表示压缩后不会变小，应直接发送原文件
+    std::atomic<int> refs;
+    std::atomic<bool> referenced;       // CLOCK淘汰算法的访问位
+    std::atomic<std::string *> headers; // 预先生成的200响应头块，第一次使用时生成
+
+    gzip_entry() : data(0), headers(0) {}
+    ~gzip_entry() { free(data); delete headers.load(); }
+    // 占用的字节数，不可压缩的条目也计入自身的大小，避免无限增长
+    size_t cost() const { return sizeof(gzip_entry) + (len > 0 ? len : 0); }
+};
+
+// 以原文件标识为键的gzip压缩结果缓存，第一次请求时压缩，之后直接发送缓存的字节
+// 文件被修改后标识改变，旧条目不再被命中，按CLOCK规则被淘汰
+// 与file_cache相同，条目放在hazard_table中，读者不加锁；
+// 被淘汰的条目除了在下次插入时，也由后台线程定期检查，读者用完后释放
+class gzip_cache
+{
+public:
+    gzip_cache(size_t capacity = GZIP_CACHE_SIZE);
+    ~gzip_cache();
+
+    // 查找原文件的压缩结果，命中时引用计数加一，使用完后必须调用release
+    gzip_entry *acquire(const struct stat &st);
+    // 压缩原文件并放入缓存，data为NULL时从path读取；返回已加引用的条目，无法压缩时返回NULL
+    gzip_entry *load(const char *path, const struct stat &st, const char *data);
+    void release(gzip_entry *entry);
+
+    static long compress(const char *data, long len, char **out); // 压缩结果用malloc分配，不变小时返回-1
+
+private:
+    static file_id make_id(const struct stat &st);
+    static void *reclaim_func(void *arg);
+
+    hazard_table<gzip_entry> m_table;
+    pthread_t m_reclaim_thread;
+    std::atomic<bool> m_stop;
+};
+
+#endif
@@ -0,0 +1,254 @@
+#ifndef HAZARD_TABLE_H
+#define HAZARD_TABLE_H
+
+#include <stddef.h>
+#include <pthread.h>
+#include <vector>
+#include <atomic>
+#include <exception>
+#include "thread_slot.h"
+
+// 读者不加锁的定长哈希表，按字节数限制容量，满了按CLOCK规则淘汰；file_cache与gzip_cache共用
+// 条目类型T需要有成员key（用==与查找的键比较）、hash、refs（引用计数）、referenced（CLOCK访问位）
+// 与cost()（计入容量的字节数），析构时释放自己持有的全部内容。
+// 读者通过冒险指针保护从槽位读出的条目，再增加引用计数；
+// 插入与移出由写者在lock()与unlock()之间完成，被移出的条目等到没有引用、也没有冒险指针指向它时才释放
+template <typename T>
+class hazard_table
+{
+public:
+    // slots必须为2的幂，probe为线性探测的最大距离
+    hazard_table(size_t slots, int probe, size_t capacity)
+        : m_mask(slots - 1), m_probe(probe), m_capacity(capacity), m_bytes(0), m_clock_hand(0)
+    {
+        if (slots == 0 || (slots & (slots - 1)) != 0 || probe <= 0 || capacity == 0)
+        {
+            throw std::exception();
+        }
+        m_slots = new std::atomic<T *>[slots];
+        for (size_t i = 0; i < slots; ++i)
+            m_slots[i].store(0, std::memory_order_relaxed);
+        m_hazards = new hazard_slot[MAX_THREAD_SLOTS];
+        for (int i = 0; i < MAX_THREAD_SLOTS; ++i)
+            m_hazards[i].ptr.store(0, std::memory_order_relaxed);
+        if (pthread_mutex_init(&m_write_mutex, NULL) != 0)
+        {
+            delete[] m_slots;
+            delete[] m_hazards;
+            throw std::exception();
+        }
+    }
+
+    ~hazard_table()
+    {
+        for (size_t i = 0; i <= m_mask; ++i)
+            delete m_slots[i].load();
+        for (size_t i = 0; i < m_retired.size(); ++i)
+            delete m_retired[i];
+        pthread_mutex_destroy(&m_write_mutex);
+        delete[] m_slots;
+        delete[] m_hazards;
+    }
+
+    // 查找条目，命中时引用计数加一，使用完后必须调用release；超过线程数上限的线程总是不命中
+    template <typename K>
+    T *acquire(size_t hash, const K &key)
+    {
+        int slot = thread_slot();
+        if (slot < 0)
+        {
+            return 0;
+        }
+        std::atomic<T *> &hazard = m_hazards[slot].ptr;
+
+        for (int i = 0; i < m_probe; ++i)
+        {
+            std::atomic<T *> &s = m_slots[(hash + i) & m_mask];
+            T *e = s.load(std::memory_order_acquire);
+            while (e)
+            {
+                // 先公布冒险指针再确认条目仍在槽位中，此后写者不会释放它
+                hazard.store(e, std::memory_order_seq_cst);
+                T *again = s.load(std::memory_order_seq_cst);
+                if (again == e)
+                    break;
+                e = again;
+            }
+            if (!e)
+            {
+                continue;
+            }
+            if (e->hash == hash && e->key == key)
+            {
+                e->refs.fetch_add(1, std::memory_order_seq_cst);
+                hazard.store(0, std::memory_order_seq_cst);
+                e->referenced.store(true, std::memory_order_relaxed);
+                return e;
+            }
+        }
+        hazard.store(0, std::memory_order_release);
+        return 0;
+    }
+
+    void release(T *entry)
+    {
+        entry->refs.fetch_sub(1, std::memory_order_seq_cst);
+    }
+
+    void lock() { pthread_mutex_lock(&m_write_mutex); }
+    void unlock() { pthread_mutex_unlock(&m_write_mutex); }
+
+    // 以下需持有lock()
+
+    // 放入已加引用的entry并返回它；表中已有相同键的条目时给那个条目加引用并返回，entry由调用者释放
+    T *insert(T *entry)
+    {
+        int free_index = -1;
+        for (int i = 0; i < m_probe; ++i)
+        {
+            size_t index = (entry->hash + i) & m_mask;
+            T *e = m_slots[index].load(std::memory_order_relaxed);
+            if (!e)
+            {
+                if (free_index < 0)
+                    free_index = index;
+            }
+            else if (e->hash == entry->hash && e->key == entry->key) // 其他线程已经插入
+            {
+                e->refs.fetch_add(1, std::memory_order_seq_cst);
+                return e;
+            }
+        }
+
+        if (free_index < 0)
+        {
+            // 探测范围内没有空位，按CLOCK规则在范围内淘汰一个
+            for (int round = 0; round < 2 && free_index < 0; ++round)
+            {
+                for (int i = 0; i < m_probe; ++i)
+                {
+                    size_t index = (entry->hash + i) & m_mask;
+                    T *e = m_slots[index].load(std::memory_order_relaxed);
+                    if (!e->referenced.exchange(false, std::memory_order_relaxed))
+                    {
+                        remove(index);
+                        free_index = index;
+                        break;
+                    }
+                }
+            }
+            if (free_index < 0) // 访问位一直被读者重新置位，直接淘汰第一个
+            {
+                free_index = entry->hash & m_mask;
+                remove(free_index);
+            }
+        }
+
+        evict_for(entry->cost());
+        m_bytes += entry->cost();
+        m_slots[free_index].store(entry, std::memory_order_release);
+        reclaim();
+        return entry;
+    }
+
+    // 移出键为key的条目
+    template <typename K>
+    void remove(size_t hash, const K &key)
+    {
+        for (int i = 0; i < m_probe; ++i)
+        {
+            size_t index = (hash + i) & m_mask;
+            T *e = m_slots[index].load(std::memory_order_relaxed);
+            if (e && e->hash == hash && e->key == key)
+            {
+                remove(index);
+            }
+        }
+    }
+
+    // 移出一个槽位中的条目，与slots()、at()一起用于遍历整个表
+    void remove(size_t index)
+    {
+        T *e = m_slots[index].load(std::memory_order_relaxed);
+        if (!e)
+        {
+            return;
+        }
+        m_slots[index].store(0, std::memory_order_seq_cst);
+        m_bytes -= e->cost();
+        m_retired.push_back(e);
+    }
+
+    size_t slots() const { return m_mask + 1; }
+    T *at(size_t index) const { return m_slots[index].load(std::memory_order_relaxed); }
+
+    // 已移出的条目不会再被acquire找到，没有引用、也没有读者的冒险指针指向它时就可以释放
+    void reclaim()
+    {
+        if (m_retired.empty())
+        {
+            return;
+        }
+        std::vector<T *> hazards;
+        int threads = thread_slot_count();
+        for (int i = 0; i < threads; ++i)
+        {
+            T *e = m_hazards[i].ptr.load(std::memory_order_seq_cst);
+            if (e)
+                hazards.push_back(e);
+        }
+
+        size_t kept = 0;
+        for (size_t i = 0; i < m_retired.size(); ++i)
+        {
+            T *e = m_retired[i];
+            bool busy = e->refs.load(std::memory_order_seq_cst) > 0;
+            for (size_t j = 0; !busy && j < hazards.size(); ++j)
+                busy = hazards[j] == e;
+            if (busy)
+            {
+                m_retired[kept++] = e;
+            }
+            else
+            {
+                delete e;
+            }
+        }
+        m_retired.resize(kept);
+    }
+
+private:
+    // CLOCK淘汰，直到能放下bytes大小的新条目
+    void evict_for(size_t bytes)
+    {
+        size_t scanned = 0;
+        while (m_bytes + bytes > m_capacity && scanned < 2 * (m_mask + 1))
+        {
+            size_t index = m_clock_hand;
+            m_clock_hand = (m_clock_hand + 1) & m_mask;
+            ++scanned;
+
+            T *e = m_slots[index].load(std::memory_order_relaxed);
+            if (e && !e->referenced.exchange(false, std::memory_order_relaxed))
+            {
+                remove(index);
+            }
+        }
+    }
+
+    struct alignas(64) hazard_slot
+    {
+        std::atomic<T *> ptr;
+    };
+
+    size_t m_mask;
+    int m_probe;
+    size_t m_capacity, m_bytes; // m_bytes只由写者修改
+    std::atomic<T *> *m_slots;
+    size_t m_clock_hand;
+    pthread_mutex_t m_write_mutex;
+    std::vector<T *> m_retired; // 已移出表、等待释放的条目
+    hazard_slot *m_hazards;
+};
+
+#endif
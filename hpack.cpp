@@ -0,0 +1,462 @@
+#include "hpack.h"
+#include <stdio.h>
+#include <vector>
+
+// RFC 7541附录B的Huffman编码表，下标256为EOS
+static const uint32_t huffman_codes[257] = {
+    0x1ff8, 0x7fffd8, 0xfffffe2, 0xfffffe3, 0xfffffe4, 0xfffffe5, 0xfffffe6, 0xfffffe7,
+    0xfffffe8, 0xffffea, 0x3ffffffc, 0xfffffe9, 0xfffffea, 0x3ffffffd, 0xfffffeb, 0xfffffec,
+    0xfffffed, 0xfffffee, 0xfffffef, 0xffffff0, 0xffffff1, 0xffffff2, 0x3ffffffe, 0xffffff3,
+    0xffffff4, 0xffffff5, 0xffffff6, 0xffffff7, 0xffffff8, 0xffffff9, 0xffffffa, 0xffffffb,
+    0x14, 0x3f8, 0x3f9, 0xffa, 0x1ff9, 0x15, 0xf8, 0x7fa,
+    0x3fa, 0x3fb, 0xf9, 0x7fb, 0xfa, 0x16, 0x17, 0x18,
+    0x0, 0x1, 0x2, 0x19, 0x1a, 0x1b, 0x1c, 0x1d,
+    0x1e, 0x1f, 0x5c, 0xfb, 0x7ffc, 0x20, 0xffb, 0x3fc,
+    0x1ffa, 0x21, 0x5d, 0x5e, 0x5f, 0x60, 0x61, 0x62,
+    0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a,
+    0x6b, 0x6c, 0x6d, 0x6e, 0x6f, 0x70, 0x71, 0x72,
+    0xfc, 0x73, 0xfd, 0x1ffb, 0x7fff0, 0x1ffc, 0x3ffc, 0x22,
+    0x7ffd, 0x3, 0x23, 0x4, 0x24, 0x5, 0x25, 0x26,
+    0x27, 0x6, 0x74, 0x75, 0x28, 0x29, 0x2a, 0x7,
+    0x2b, 0x76, 0x2c, 0x8, 0x9, 0x2d, 0x77, 0x78,
+    0x79, 0x7a, 0x7b, 0x7ffe, 0x7fc, 0x3ffd, 0x1ffd, 0xffffffc,
+    0xfffe6, 0x3fffd2, 0xfffe7, 0xfffe8, 0x3fffd3, 0x3fffd4, 0x3fffd5, 0x7fffd9,
+    0x3fffd6, 0x7fffda, 0x7fffdb, 0x7fffdc, 0x7fffdd, 0x7fffde, 0xffffeb, 0x7fffdf,
+    0xffffec, 0xffffed, 0x3fffd7, 0x7fffe0, 0xffffee, 0x7fffe1, 0x7fffe2, 0x7fffe3,
+    0x7fffe4, 0x1fffdc, 0x3fffd8, 0x7fffe5, 0x3fffd9, 0x7fffe6, 0x7fffe7, 0xffffef,
+    0x3fffda, 0x1fffdd, 0xfffe9, 0x3fffdb, 0x3fffdc, 0x7fffe8, 0x7fffe9, 0x1fffde,
+    0x7fffea, 0x3fffdd, 0x3fffde, 0xfffff0, 0x1fffdf, 0x3fffdf, 0x7fffeb, 0x7fffec,
+    0x1fffe0, 0x1fffe1, 0x3fffe0, 0x1fffe2, 0x7fffed, 0x3fffe1, 0x7fffee, 0x7fffef,
+    0xfffea, 0x3fffe2, 0x3fffe3, 0x3fffe4, 0x7ffff0, 0x3fffe5, 0x3fffe6, 0x7ffff1,
+    0x3ffffe0, 0x3ffffe1, 0xfffeb, 0x7fff1, 0x3fffe7, 0x7ffff2, 0x3fffe8, 0x1ffffec,
+    0x3ffffe2, 0x3ffffe3, 0x3ffffe4, 0x7ffffde, 0x7ffffdf, 0x3ffffe5, 0xfffff1, 0x1ffffed,
+    0x7fff2, 0x1fffe3, 0x3ffffe6, 0x7ffffe0, 0x7ffffe1, 0x3ffffe7, 0x7ffffe2, 0xfffff2,
+    0x1fffe4, 0x1fffe5, 0x3ffffe8, 0x3ffffe9, 0xffffffd, 0x7ffffe3, 0x7ffffe4, 0x7ffffe5,
+    0xfffec, 0xfffff3, 0xfffed, 0x1fffe6, 0x3fffe9, 0x1fffe7, 0x1fffe8, 0x7ffff3,
+    0x3fffea, 0x3fffeb, 0x1ffffee, 0x1ffffef, 0xfffff4, 0xfffff5, 0x3ffffea, 0x7ffff4,
+    0x3ffffeb, 0x7ffffe6, 0x3ffffec, 0x3ffffed, 0x7ffffe7, 0x7ffffe8, 0x7ffffe9, 0x7ffffea,
+    0x7ffffeb, 0xffffffe, 0x7ffffec, 0x7ffffed, 0x7ffffee, 0x7ffffef, 0x7fffff0, 0x3ffffee,
+    0x3fffffff,
+};
+static const uint8_t huffman_lengths[257] = {
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+    28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+    6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+    5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+    13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+    15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+    6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+    20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+    21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+    20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+    30,
+};
+
+// RFC 7541附录A的静态表，下标从1开始
+static const hpack_static_entry static_table[HPACK_STATIC_COUNT + 1] = {
+    {"", ""},
+    {":authority", ""},
+    {":method", "GET"},
+    {":method", "POST"},
+    {":path", "/"},
+    {":path", "/index.html"},
+    {":scheme", "http"},
+    {":scheme", "https"},
+    {":status", "200"},
+    {":status", "204"},
+    {":status", "206"},
+    {":status", "304"},
+    {":status", "400"},
+    {":status", "404"},
+    {":status", "500"},
+    {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""},
+    {"accept-ranges", ""},
+    {"accept", ""},
+    {"access-control-allow-origin", ""},
+    {"age", ""},
+    {"allow", ""},
+    {"authorization", ""},
+    {"cache-control", ""},
+    {"content-disposition", ""},
+    {"content-encoding", ""},
+    {"content-language", ""},
+    {"content-length", ""},
+    {"content-location", ""},
+    {"content-range", ""},
+    {"content-type", ""},
+    {"cookie", ""},
+    {"date", ""},
+    {"etag", ""},
+    {"expect", ""},
+    {"expires", ""},
+    {"from", ""},
+    {"host", ""},
+    {"if-match", ""},
+    {"if-modified-since", ""},
+    {"if-none-match", ""},
+    {"if-range", ""},
+    {"if-unmodified-since", ""},
+    {"last-modified", ""},
+    {"link", ""},
+    {"location", ""},
+    {"max-forwards", ""},
+    {"proxy-authenticate", ""},
+    {"proxy-authorization", ""},
+    {"range", ""},
+    {"referer", ""},
+    {"refresh", ""},
+    {"retry-after", ""},
+    {"server", ""},
+    {"set-cookie", ""},
+    {"strict-transport-security", ""},
+    {"transfer-encoding", ""},
+    {"user-agent", ""},
+    {"vary", ""},
+    {"via", ""},
+    {"www-authenticate", ""},
+};
+
+// Huffman解码树：非负的子节点是下一个节点，负数-(sym + 1)是解出的符号
+struct huffman_node
+{
+    int16_t child[2];
+};
+
+static std::vector<huffman_node> build_huffman_tree()
+{
+    std::vector<huffman_node> tree(1, huffman_node{{0, 0}});
+    for (int sym = 0; sym <= 256; ++sym)
+    {
+        int node = 0;
+        for (int i = huffman_lengths[sym] - 1; i >= 0; --i)
+        {
+            int bit = (huffman_codes[sym] >> i) & 1;
+            if (i == 0)
+            {
+                tree[node].child[bit] = -(sym + 1);
+            }
+            else
+            {
+                if (tree[node].child[bit] == 0)
+                {
+                    tree[node].child[bit] = tree.size();
+                    tree.push_back(huffman_node{{0, 0}});
+                }
+                node = tree[node].child[bit];
+            }
+        }
+    }
+    return tree;
+}
+
+// 末尾不足一个符号的填充位必须是EOS编码的前缀（全为1）且少于8位
+static bool huffman_decode(const unsigned char *p, size_t len, std::string &out)
+{
+    static const std::vector<huffman_node> tree = build_huffman_tree();
+    int node = 0, pad_bits = 0;
+    bool pad_ones = true;
+    for (size_t i = 0; i < len; ++i)
+    {
+        for (int b = 7; b >= 0; --b)
+        {
+            int bit = (p[i] >> b) & 1;
+            int next = tree[node].child[bit];
+            ++pad_bits;
+            pad_ones = pad_ones && bit;
+            if (next < 0)
+            {
+                int sym = -next - 1;
+                if (sym == 256)
+                    return false;
+                out += (char)sym;
+                node = 0;
+                pad_bits = 0;
+                pad_ones = true;
+            }
+            else if (next == 0) // 不存在的编码
+            {
+                return false;
+            }
+            else
+            {
+                node = next;
+            }
+        }
+    }
+    return pad_bits < 8 && pad_ones;
+}
+
+// 带前缀的整数（RFC 7541 5.1），限制在2^28以内
+static bool decode_int(const unsigned char *&p, const unsigned char *end, int prefix, uint32_t *out)
+{
+    if (p >= end)
+        return false;
+    uint32_t mask = (1u << prefix) - 1;
+    uint32_t value = *p++ & mask;
+    if (value < mask)
+    {
+        *out = value;
+        return true;
+    }
+    for (int shift = 0; shift <= 21; shift += 7)
+    {
+        if (p >= end)
+            return false;
+        unsigned char b = *p++;
+        value += (uint32_t)(b & 0x7f) << shift;
+        if (!(b & 0x80))
+        {
+            *out = value;
+            return true;
+        }
+    }
+    return false;
+}
+
+static int encode_int(char *out, int prefix, unsigned char first, uint32_t value)
+{
+    uint32_t mask = (1u << prefix) - 1;
+    if (value < mask)
+    {
+        out[0] = first | value;
+        return 1;
+    }
+    out[0] = first | mask;
+    value -= mask;
+    int n = 1;
+    while (value >= 0x80)
+    {
+        out[n++] = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    out[n++] = value;
+    return n;
+}
+
+static bool decode_string(const unsigned char *&p, const unsigned char *end, std::string &out)
+{
+    if (p >= end)
+        return false;
+    bool huffman = *p & 0x80;
+    uint32_t len;
+    if (!decode_int(p, end, 7, &len) || len > (size_t)(end - p))
+        return false;
+    out.clear();
+    if (huffman)
+    {
+        if (!huffman_decode(p, len, out))
+            return false;
+    }
+    else
+    {
+        out.assign((const char *)p, len);
+    }
+    p += len;
+    return true;
+}
+
+static int encode_string(char *out, const char *s, int len)
+{
+    int n = encode_int(out, 7, 0, len);
+    memcpy(out + n, s, len);
+    return n + len;
+}
+
+void hpack_table::evict(size_t need)
+{
+    while (!m_entries.empty() && m_size + need > m_max)
+    {
+        const hpack_entry &e = m_entries.back();
+        m_size -= e.name.size() + e.value.size() + HPACK_ENTRY_OVERHEAD;
+        m_entries.pop_back();
+    }
+}
+
+void hpack_table::set_max(size_t max)
+{
+    m_max = max;
+    evict(0);
+}
+
+// 比整个表还大的条目使表变空，本身也不加入
+void hpack_table::insert(const std::string &name, const std::string &value)
+{
+    size_t size = name.size() + value.size() + HPACK_ENTRY_OVERHEAD;
+    if (size > m_max)
+    {
+        m_entries.clear();
+        m_size = 0;
+        return;
+    }
+    evict(size);
+    m_entries.push_front(hpack_entry{name, value});
+    m_size += size;
+}
+
+bool hpack_table::get(uint32_t index, const char **name, int *name_len, const char **value, int *value_len) const
+{
+    if (index == 0)
+    {
+        return false;
+    }
+    if (index <= HPACK_STATIC_COUNT)
+    {
+        *name = static_table[index].name;
+        *name_len = strlen(*name);
+        *value = static_table[index].value;
+        *value_len = strlen(*value);
+        return true;
+    }
+    index -= HPACK_STATIC_COUNT + 1;
+    if (index >= m_entries.size())
+    {
+        return false;
+    }
+    const hpack_entry &e = m_entries[index];
+    *name = e.name.data();
+    *name_len = e.name.size();
+    *value = e.value.data();
+    *value_len = e.value.size();
+    return true;
+}
+
+uint32_t hpack_table::find(const char *name, const char *value, int value_len, uint32_t *name_index) const
+{
+    *name_index = 0;
+    for (uint32_t i = 1; i <= HPACK_STATIC_COUNT; ++i)
+    {
+        if (strcmp(static_table[i].name, name) != 0)
+            continue;
+        if (!*name_index)
+            *name_index = i;
+        if ((int)strlen(static_table[i].value) == value_len && memcmp(static_table[i].value, value, value_len) == 0)
+            return i;
+    }
+    for (size_t i = 0; i < m_entries.size(); ++i)
+    {
+        const hpack_entry &e = m_entries[i];
+        if (e.name != name)
+            continue;
+        if (!*name_index)
+            *name_index = i + HPACK_STATIC_COUNT + 1;
+        if ((int)e.value.size() == value_len && memcmp(e.value.data(), value, value_len) == 0)
+            return i + HPACK_STATIC_COUNT + 1;
+    }
+    return 0;
+}
+
+int hpack_decoder::decode(const unsigned char *p, size_t len, char *out, size_t out_len, header_field *fields, int max, bool *overflow)
+{
+    const unsigned char *end = p + len;
+    size_t used = 0;
+    int count = 0;
+    bool field_seen = false;
+    std::string name, value;
+    *overflow = false;
+    while (p < end)
+    {
+        unsigned char b = *p;
+        const char *n, *v;
+        int n_len, v_len;
+        uint32_t index;
+        if (b & 0x80) // 索引的字段
+        {
+            if (!decode_int(p, end, 7, &index) || !m_table.get(index, &n, &n_len, &v, &v_len))
+                return -1;
+            name.assign(n, n_len);
+            value.assign(v, v_len);
+        }
+        else if ((b & 0xe0) == 0x20) // 动态表大小更新，只能出现在头部块开头
+        {
+            if (field_seen || !decode_int(p, end, 5, &index) || index > m_limit)
+                return -1;
+            m_table.set_max(index);
+            continue;
+        }
+        else // 带索引的字面值（01），或不索引、永不索引的字面值（0000、0001）
+        {
+            bool incremental = (b & 0xc0) == 0x40;
+            if (!decode_int(p, end, incremental ? 6 : 4, &index))
+                return -1;
+            if (index == 0)
+            {
+                if (!decode_string(p, end, name))
+                    return -1;
+            }
+            else
+            {
+                if (!m_table.get(index, &n, &n_len, &v, &v_len))
+                    return -1;
+                name.assign(n, n_len);
+            }
+            if (!decode_string(p, end, value))
+                return -1;
+            if (incremental)
+                m_table.insert(name, value);
+        }
+        field_seen = true;
+
+        if (count >= max || used + name.size() + value.size() + 2 > out_len)
+        {
+            *overflow = true;
+            continue;
+        }
+        header_field &f = fields[count++];
+        memcpy(out + used, name.c_str(), name.size() + 1);
+        f.name.data = out + used;
+        f.name.len = name.size();
+        used += name.size() + 1;
+        memcpy(out + used, value.c_str(), value.size() + 1);
+        f.value.data = out + used;
+        f.value.len = value.size();
+        used += value.size() + 1;
+    }
+    return count;
+}
+
+void hpack_encoder::set_max(size_t max)
+{
+    m_table.set_max(max < HPACK_TABLE_SIZE ? max : HPACK_TABLE_SIZE);
+    m_pending_update = true;
+}
+
+int hpack_encoder::begin(char *out)
+{
+    if (!m_pending_update)
+    {
+        return 0;
+    }
+    m_pending_update = false;
+    return encode_int(out, 5, 0x20, m_table.max());
+}
+
+int hpack_encoder::add(char *out, const char *name, const char *value, int value_len, bool indexed)
+{
+    uint32_t name_index;
+    uint32_t index = m_table.find(name, value, value_len, &name_index);
+    if (index)
+    {
+        return encode_int(out, 7, 0x80, index);
+    }
+    int n;
+    if (indexed)
+    {
+        n = encode_int(out, 6, 0x40, name_index);
+        m_table.insert(name, std::string(value, value_len));
+    }
+    else
+    {
+        n = encode_int(out, 4, 0, name_index);
+    }
+    if (!name_index)
+        n += encode_string(out + n, name, strlen(name));
+    return n + encode_string(out + n, value, value_len);
+}
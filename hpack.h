@@ -0,0 +1,80 @@
+#ifndef HPACK_H
+#define HPACK_H
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <deque>
+#include "http_scan.h"
+
+#define HPACK_TABLE_SIZE 4096   // 动态表大小的默认值（SETTINGS_HEADER_TABLE_SIZE）
+#define HPACK_ENTRY_OVERHEAD 32 // 每个条目在名字与值之外计入的大小
+#define HPACK_STATIC_COUNT 61   // 静态表的条目数，动态表的下标从62开始
+
+struct hpack_static_entry
+{
+    const char *name;
+    const char *value;
+};
+
+struct hpack_entry
+{
+    std::string name;
+    std::string value;
+};
+
+// 动态表：新条目在前，超过大小上限时从最旧的一端淘汰
+class hpack_table
+{
+public:
+    hpack_table(size_t max = HPACK_TABLE_SIZE) : m_size(0), m_max(max) {}
+
+    void set_max(size_t max); // 缩小时立即淘汰
+    size_t max() const { return m_max; }
+    void insert(const std::string &name, const std::string &value);
+    // index从1开始，先是静态表再是动态表；越界时返回false
+    bool get(uint32_t index, const char **name, int *name_len, const char **value, int *value_len) const;
+    // 查找名字与值都相同的条目，返回下标，只有名字相同时通过name_index返回，都没有时返回0
+    uint32_t find(const char *name, const char *value, int value_len, uint32_t *name_index) const;
+
+private:
+    void evict(size_t need);
+
+    std::deque<hpack_entry> m_entries;
+    size_t m_size, m_max;
+};
+
+// 解码器：每个连接一个，对端的头部块必须按收到的顺序解码，动态表才能与对端保持一致
+class hpack_decoder
+{
+public:
+    hpack_decoder() : m_limit(HPACK_TABLE_SIZE) {}
+
+    // 解码一个完整的头部块，名字与值依次复制到out（各以'\0'结尾），fields指向其中；
+    // 返回字段数，格式错误时返回-1（连接必须以COMPRESSION_ERROR关闭）；
+    // out或fields放不下时仍然解码完整个块以保持动态表同步，并设置*overflow
+    int decode(const unsigned char *p, size_t len, char *out, size_t out_len, header_field *fields, int max, bool *overflow);
+
+private:
+    hpack_table m_table;
+    size_t m_limit; // 本端通告的动态表大小上限，对端的大小更新不能超过它
+};
+
+// 编码器：不做Huffman编码；调用者指定的字段加入动态表，之后相同的字段只需一个字节
+class hpack_encoder
+{
+public:
+    hpack_encoder() : m_pending_update(false) {}
+
+    void set_max(size_t max); // 对端的SETTINGS_HEADER_TABLE_SIZE，在下一个头部块开始时通知对端
+    int begin(char *out);     // 开始一个头部块，返回写入的字节数
+    // 写入一个字段，返回写入的字节数；out至少要有名字与值的长度加上10个字节
+    int add(char *out, const char *name, const char *value, int value_len, bool indexed);
+    int add(char *out, const char *name, const char *value, bool indexed) { return add(out, name, value, strlen(value), indexed); }
+
+private:
+    hpack_table m_table;
+    bool m_pending_update;
+};
+
+#endif
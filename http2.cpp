@@ -0,0 +1,829 @@
+#include "http2.h"
+
+// http_conn的HTTP/2部分：帧的解析与生成、流量控制和流的轮转发送，请求本身仍由do_request处理
+// 连接仍然是读完再写的半双工方式：一批帧发送完毕后，窗口允许时继续发送，否则等待WINDOW_UPDATE
+
+extern char default_url[];
+extern const char *error_400_form;
+extern const char *error_403_form;
+extern const char *error_404_form;
+extern const char *error_416_form;
+extern const char *error_500_form;
+
+static const char upgrade_response[] = "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n";
+
+static inline uint32_t get_u32(const unsigned char *p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static inline void put_u32(unsigned char *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static void frame_header(char *out, int len, int type, int flags, uint32_t id)
+{
+    unsigned char *f = (unsigned char *)out;
+    f[0] = len >> 16;
+    f[1] = len >> 8;
+    f[2] = len;
+    f[3] = type;
+    f[4] = flags;
+    put_u32(f + 5, id);
+}
+
+// HTTP2-Settings是base64url编码、没有填充的SETTINGS帧负载
+static int base64url_decode(const char *s, int len, unsigned char *out, int max)
+{
+    unsigned value = 0;
+    int bits = 0, n = 0;
+    for (int i = 0; i < len; ++i)
+    {
+        char c = s[i];
+        int d;
+        if (c >= 'A' && c <= 'Z')
+            d = c - 'A';
+        else if (c >= 'a' && c <= 'z')
+            d = c - 'a' + 26;
+        else if (c >= '0' && c <= '9')
+            d = c - '0' + 52;
+        else if (c == '-' || c == '+')
+            d = 62;
+        else if (c == '_' || c == '/')
+            d = 63;
+        else if (c == '=')
+            break;
+        else
+            return -1;
+        value = value << 6 | d;
+        bits += 6;
+        if (bits >= 8)
+        {
+            bits -= 8;
+            if (n >= max)
+                return -1;
+            out[n++] = value >> bits;
+        }
+    }
+    return n;
+}
+
+h2_session::h2_session()
+    : preface_pending(true), last_stream(0), continuation(0), block_stream(0), block_end_stream(false),
+      conn_window(H2_DEFAULT_WINDOW), initial_window(H2_DEFAULT_WINDOW), max_frame(H2_MAX_FRAME),
+      goaway_sent(false), goaway_received(false), active(0), next(0), reset_next(0), out(0), out_len(0), out_flushed(0)
+{
+    memset(streams, 0, sizeof(streams));
+    memset(reset, 0, sizeof(reset));
+}
+
+bool h2_session::pending() const
+{
+    for (int i = 0; i < H2_MAX_STREAMS; ++i)
+    {
+        const h2_stream &st = streams[i];
+        if (st.id && (!st.headers_sent || (st.remaining > 0 && st.window > 0 && conn_window > 0)))
+            return true;
+    }
+    return false;
+}
+
+int http_conn::h2_preface() const
+{
+    if (m_check_state != CHECK_STATE_REQUESTLINE || m_checked_idx != 0 || m_read_idx == 0)
+    {
+        return -1;
+    }
+    int n = std::min(m_read_idx, H2_PREFACE_LEN);
+    if (memcmp(m_read_buf, H2_PREFACE, n) != 0)
+    {
+        return -1;
+    }
+    return n == H2_PREFACE_LEN ? 1 : 0;
+}
+
+// 有请求体的请求不升级，省去在升级前读完请求体
+bool http_conn::h2_upgrade_requested() const
+{
+    return m_method == GET && m_known[HEADER_HTTP2_SETTINGS].data && has_token(m_known[HEADER_UPGRADE], "h2c") && m_content_length == 0;
+}
+
+bool http_conn::h2_apply_upgrade()
+{
+    const str_view &v = m_known[HEADER_HTTP2_SETTINGS];
+    unsigned char payload[256];
+    int len = base64url_decode(v.data, v.len, payload, sizeof(payload));
+    return len >= 0 && len % 6 == 0 && h2_settings(payload, len);
+}
+
+// 升级时先回答101，再以服务器的SETTINGS开始HTTP/2，升级请求本身作为流1回答；
+// 请求处理完后读缓冲区换成能放下最大帧的大小
+bool http_conn::start_h2(bool upgrade)
+{
+    m_h2 = new h2_session();
+    if (upgrade && !h2_apply_upgrade())
+    {
+        free_h2();
+        return false;
+    }
+    if (upgrade)
+    {
+        if (!m_write_buf)
+        {
+            m_write_buf = buffer_pool::alloc(WRITE_BUFFER_SIZE);
+        }
+        int start = m_write_idx;
+        add_raw(upgrade_response, sizeof(upgrade_response) - 1);
+        add_iov(m_write_buf + start, m_write_idx - start);
+        metric_status(101);
+    }
+
+    unsigned char settings[12];
+    settings[0] = 0;
+    settings[1] = H2_SETTINGS_MAX_CONCURRENT_STREAMS;
+    put_u32(settings + 2, H2_MAX_STREAMS);
+    settings[6] = 0;
+    settings[7] = H2_SETTINGS_MAX_HEADER_LIST_SIZE;
+    put_u32(settings + 8, H2_MAX_HEADER_LIST);
+    h2_put_frame(H2_SETTINGS, 0, 0, settings, sizeof(settings));
+
+    if (upgrade)
+    {
+        h2_stream *st = &m_h2->streams[0];
+        st->id = 1;
+        st->remote_closed = true;
+        st->window = m_h2->initial_window;
+        m_h2->last_stream = 1;
+        m_h2->active = 1;
+        h2_respond(st, GET_REQUEST);
+    }
+
+    char *buf = buffer_pool::alloc(H2_READ_BUFFER_SIZE);
+    if (m_read_buf)
+    {
+        memcpy(buf, m_read_buf, m_read_idx);
+        buffer_pool::release(m_read_buf, m_read_size);
+    }
+    m_read_buf = buf;
+    m_read_size = H2_READ_BUFFER_SIZE;
+    return true;
+}
+
+void http_conn::free_h2()
+{
+    if (!m_h2)
+    {
+        return;
+    }
+    for (int i = 0; i < H2_MAX_STREAMS; ++i)
+    {
+        if (m_h2->streams[i].id)
+            release_body(m_h2->streams[i].body);
+    }
+    if (m_h2->out)
+    {
+        buffer_pool::release(m_h2->out, H2_WRITE_BUFFER_SIZE);
+    }
+    delete m_h2;
+    m_h2 = 0;
+}
+
+void http_conn::h2_put_frame(int type, int flags, uint32_t id, const void *payload, int len)
+{
+    h2_session *s = m_h2;
+    if (!s->out)
+    {
+        s->out = buffer_pool::alloc(H2_WRITE_BUFFER_SIZE);
+        s->out_len = 0;
+        s->out_flushed = 0;
+    }
+    frame_header(s->out + s->out_len, len, type, flags, id);
+    if (len > 0)
+        memcpy(s->out + s->out_len + H2_FRAME_HEADER, payload, len);
+    s->out_len += H2_FRAME_HEADER + len;
+}
+
+void http_conn::h2_flush_out()
+{
+    h2_session *s = m_h2;
+    if (s->out_len > s->out_flushed)
+    {
+        add_iov(s->out + s->out_flushed, s->out_len - s->out_flushed);
+        s->out_flushed = s->out_len;
+    }
+}
+
+bool http_conn::h2_goaway(int error)
+{
+    if (!m_h2->goaway_sent)
+    {
+        unsigned char payload[8];
+        put_u32(payload, m_h2->last_stream);
+        put_u32(payload + 4, error);
+        h2_put_frame(H2_GOAWAY, 0, 0, payload, sizeof(payload));
+        m_h2->goaway_sent = true;
+    }
+    return false;
+}
+
+void http_conn::h2_rst(uint32_t id, int error)
+{
+    unsigned char payload[4];
+    put_u32(payload, error);
+    h2_put_frame(H2_RST_STREAM, 0, id, payload, sizeof(payload));
+    m_h2->reset[m_h2->reset_next++ % H2_RESET_HISTORY] = id;
+}
+
+h2_stream *http_conn::h2_find(uint32_t id)
+{
+    for (int i = 0; i < H2_MAX_STREAMS; ++i)
+    {
+        if (m_h2->streams[i].id == id)
+            return &m_h2->streams[i];
+    }
+    return 0;
+}
+
+// 本端重置流时对端可能已经发出了这个流上的帧，这些帧必须忽略（RFC 9113 5.1）
+bool http_conn::h2_was_reset(uint32_t id)
+{
+    for (int i = 0; i < H2_RESET_HISTORY; ++i)
+    {
+        if (m_h2->reset[i] == id)
+            return true;
+    }
+    return false;
+}
+
+// 前一批帧已经发送完毕，流的响应体没有被引用，可以立即释放
+void http_conn::h2_close_stream(h2_stream *st)
+{
+    release_body(st->body);
+    st->id = 0;
+    m_h2->active--;
+}
+
+bool http_conn::h2_settings(const unsigned char *p, int len)
+{
+    h2_session *s = m_h2;
+    for (int i = 0; i + 6 <= len; i += 6)
+    {
+        int id = p[i] << 8 | p[i + 1];
+        uint32_t value = get_u32(p + i + 2);
+        switch (id)
+        {
+        case H2_SETTINGS_HEADER_TABLE_SIZE:
+            s->encoder.set_max(value);
+            break;
+        case H2_SETTINGS_ENABLE_PUSH: // 本端从不推送
+            if (value > 1)
+                return h2_goaway(H2_PROTOCOL_ERROR);
+            break;
+        case H2_SETTINGS_INITIAL_WINDOW_SIZE: // 已有流的窗口按差值调整，可以变为负数
+        {
+            if (value > H2_MAX_WINDOW)
+                return h2_goaway(H2_FLOW_CONTROL_ERROR);
+            long delta = (long)value - s->initial_window;
+            for (int k = 0; k < H2_MAX_STREAMS; ++k)
+            {
+                if (s->streams[k].id && (s->streams[k].window += delta) > H2_MAX_WINDOW)
+                    return h2_goaway(H2_FLOW_CONTROL_ERROR);
+            }
+            s->initial_window = value;
+            break;
+        }
+        case H2_SETTINGS_MAX_FRAME_SIZE:
+            if (value < H2_MAX_FRAME || value > 0xffffff)
+                return h2_goaway(H2_PROTOCOL_ERROR);
+            s->max_frame = value;
+            break;
+        default: // 其余设置只限制对端发送的内容，忽略未知的设置
+            break;
+        }
+    }
+    return true;
+}
+
+// 解析读缓冲区中完整的帧；写缓冲区快满时停下，剩下的帧在这一批发送完后继续处理
+bool http_conn::process_h2()
+{
+    h2_session *s = m_h2;
+    const unsigned char *buf = (const unsigned char *)m_read_buf;
+    int pos = m_checked_idx;
+    if (s->preface_pending && m_read_idx > pos)
+    {
+        int n = std::min(m_read_idx - pos, H2_PREFACE_LEN);
+        if (memcmp(buf + pos, H2_PREFACE, n) != 0)
+        {
+            h2_goaway(H2_PROTOCOL_ERROR);
+        }
+        else if (n == H2_PREFACE_LEN)
+        {
+            pos += n;
+            s->preface_pending = false;
+        }
+    }
+    while (!s->preface_pending && !s->goaway_sent && m_read_idx - pos >= H2_FRAME_HEADER)
+    {
+        const unsigned char *f = buf + pos;
+        int len = f[0] << 16 | f[1] << 8 | f[2];
+        if (len > H2_MAX_FRAME)
+        {
+            h2_goaway(H2_FRAME_SIZE_ERROR);
+            break;
+        }
+        if (m_read_idx - pos < H2_FRAME_HEADER + len || (s->out && H2_WRITE_BUFFER_SIZE - s->out_len < H2_CONTROL_RESERVE))
+        {
+            break;
+        }
+        pos += H2_FRAME_HEADER + len;
+        if (!h2_frame(f[3], f[4], get_u32(f + 5) & 0x7fffffff, f + H2_FRAME_HEADER, len))
+        {
+            break;
+        }
+    }
+    int left = m_read_idx - pos;
+    if (left > 0 && pos > 0)
+    {
+        memmove(m_read_buf, m_read_buf + pos, left);
+    }
+    m_read_idx = left;
+    m_checked_idx = 0;
+    m_start_line = 0;
+    m_request_start = 0;
+    if (m_read_idx == 0)
+    {
+        release_read_buf();
+    }
+
+    if (!s->goaway_sent)
+    {
+        h2_fill();
+    }
+    if (s->out)
+    {
+        h2_flush_out();
+    }
+    bool done = s->goaway_sent || (s->goaway_received && s->active == 0);
+    if (bytes_to_send > 0)
+    {
+        m_keep_alive = !done;
+        return send_response();
+    }
+    if (done)
+    {
+        close_conn();
+        return false;
+    }
+    release_write_buf();
+    // 有流在等待窗口时按发送超时计算
+    set_deadline(s->active > 0 ? TIMEOUT_WRITE : s->preface_pending ? TIMEOUT_HEADER : TIMEOUT_IDLE);
+    m_backend->want_read(this);
+    return false;
+}
+
+bool http_conn::h2_frame(int type, int flags, uint32_t id, const unsigned char *p, int len)
+{
+    h2_session *s = m_h2;
+    if (s->continuation && (type != H2_CONTINUATION || id != s->continuation))
+    {
+        return h2_goaway(H2_PROTOCOL_ERROR);
+    }
+    switch (type)
+    {
+    case H2_DATA:
+    {
+        if (id == 0 || id > s->last_stream)
+            return h2_goaway(H2_PROTOCOL_ERROR);
+        h2_stream *st = h2_find(id);
+        if (!st && !h2_was_reset(id)) // 对端发送END_STREAM后流已经关闭
+            return h2_goaway(H2_STREAM_CLOSED);
+        // 请求体不使用，收到多少就立即归还多少窗口；被忽略的DATA同样计入了连接窗口
+        if (len > 0)
+        {
+            unsigned char inc[4];
+            put_u32(inc, len);
+            h2_put_frame(H2_WINDOW_UPDATE, 0, 0, inc, 4);
+            if (st && !st->remote_closed && !(flags & H2_FLAG_END_STREAM))
+                h2_put_frame(H2_WINDOW_UPDATE, 0, id, inc, 4);
+        }
+        if (st && st->remote_closed) // 半关闭（远端）的流上不能再有DATA
+        {
+            h2_rst(id, H2_STREAM_CLOSED);
+            h2_close_stream(st);
+        }
+        else if (st && (flags & H2_FLAG_END_STREAM))
+        {
+            st->remote_closed = true;
+        }
+        return true;
+    }
+    case H2_HEADERS:
+    {
+        if (id == 0 || !(id & 1))
+            return h2_goaway(H2_PROTOCOL_ERROR);
+        int off = 0, pad = 0;
+        if (flags & H2_FLAG_PADDED)
+        {
+            if (len < 1)
+                return h2_goaway(H2_FRAME_SIZE_ERROR);
+            pad = p[0];
+            off = 1;
+        }
+        if (flags & H2_FLAG_PRIORITY) // 不按优先级调度
+            off += 5;
+        if (off + pad > len)
+            return h2_goaway(H2_PROTOCOL_ERROR);
+        s->block.assign((const char *)p + off, len - off - pad);
+        s->block_stream = id;
+        s->block_end_stream = flags & H2_FLAG_END_STREAM;
+        if (!(flags & H2_FLAG_END_HEADERS))
+        {
+            s->continuation = id;
+            return true;
+        }
+        return h2_headers_done();
+    }
+    case H2_CONTINUATION:
+        if (!s->continuation)
+            return h2_goaway(H2_PROTOCOL_ERROR);
+        if (s->block.size() + len > H2_MAX_HEADER_BLOCK)
+            return h2_goaway(H2_ENHANCE_YOUR_CALM);
+        s->block.append((const char *)p, len);
+        if (!(flags & H2_FLAG_END_HEADERS))
+            return true;
+        s->continuation = 0;
+        return h2_headers_done();
+    case H2_PRIORITY:
+        if (id == 0)
+            return h2_goaway(H2_PROTOCOL_ERROR);
+        if (len != 5)
+            h2_rst(id, H2_FRAME_SIZE_ERROR);
+        return true;
+    case H2_RST_STREAM:
+    {
+        if (id == 0 || id > s->last_stream)
+            return h2_goaway(H2_PROTOCOL_ERROR);
+        if (len != 4)
+            return h2_goaway(H2_FRAME_SIZE_ERROR);
+        h2_stream *st = h2_find(id);
+        if (st)
+            h2_close_stream(st);
+        return true;
+    }
+    case H2_SETTINGS:
+        if (id != 0)
+            return h2_goaway(H2_PROTOCOL_ERROR);
+        if (flags & H2_FLAG_ACK)
+            return len == 0 || h2_goaway(H2_FRAME_SIZE_ERROR);
+        if (len % 6 != 0)
+            return h2_goaway(H2_FRAME_SIZE_ERROR);
+        if (!h2_settings(p, len))
+            return false;
+        h2_put_frame(H2_SETTINGS, H2_FLAG_ACK, 0, 0, 0);
+        return true;
+    case H2_PUSH_PROMISE: // 客户端不能推送
+        return h2_goaway(H2_PROTOCOL_ERROR);
+    case H2_PING:
+        if (id != 0)
+            return h2_goaway(H2_PROTOCOL_ERROR);
+        if (len != 8)
+            return h2_goaway(H2_FRAME_SIZE_ERROR);
+        if (!(flags & H2_FLAG_ACK))
+            h2_put_frame(H2_PING, H2_FLAG_ACK, 0, p, 8);
+        return true;
+    case H2_GOAWAY:
+        if (id != 0)
+            return h2_goaway(H2_PROTOCOL_ERROR);
+        s->goaway_received = true;
+        return true;
+    case H2_WINDOW_UPDATE:
+    {
+        if (len != 4)
+            return h2_goaway(H2_FRAME_SIZE_ERROR);
+        if (id > s->last_stream) // 空闲的流上只能收到HEADERS与PRIORITY
+            return h2_goaway(H2_PROTOCOL_ERROR);
+        long inc = get_u32(p) & 0x7fffffff;
+        if (id == 0)
+        {
+            if (inc == 0)
+                return h2_goaway(H2_PROTOCOL_ERROR);
+            if ((s->conn_window += inc) > H2_MAX_WINDOW)
+                return h2_goaway(H2_FLOW_CONTROL_ERROR);
+            return true;
+        }
+        // 已关闭的流上的WINDOW_UPDATE不是错误（RFC 9113 6.9），对端可能在收到END_STREAM前发出
+        h2_stream *st = h2_find(id);
+        if (st && (inc == 0 || (st->window += inc) > H2_MAX_WINDOW))
+        {
+            h2_rst(id, inc == 0 ? H2_PROTOCOL_ERROR : H2_FLOW_CONTROL_ERROR);
+            h2_close_stream(st);
+        }
+        return true;
+    }
+    default: // 忽略未知类型的帧
+        return true;
+    }
+}
+
+// 头部块必须按收到的顺序全部解码，动态表才能与客户端保持一致，即使这个流会被拒绝
+bool http_conn::h2_headers_done()
+{
+    h2_session *s = m_h2;
+    header_field fields[MAX_HEADERS];
+    bool overflow;
+    int n = s->decoder.decode((const unsigned char *)s->block.data(), s->block.size(), s->headers, sizeof(s->headers), fields, MAX_HEADERS, &overflow);
+    if (n < 0)
+    {
+        return h2_goaway(H2_COMPRESSION_ERROR);
+    }
+    uint32_t id = s->block_stream;
+    if (id <= s->last_stream)
+    {
+        h2_stream *st = h2_find(id);
+        if (!st) // 已经关闭的流：本端重置过的忽略，否则是对端在END_STREAM之后又发送头部块（RFC 9113 5.1）
+            return h2_was_reset(id) || h2_goaway(H2_STREAM_CLOSED);
+        if (st->remote_closed)
+        {
+            h2_rst(id, H2_STREAM_CLOSED);
+            h2_close_stream(st);
+        }
+        else if (s->block_end_stream) // 尾部字段，不使用
+        {
+            st->remote_closed = true;
+        }
+        return true;
+    }
+    s->last_stream = id;
+
+    h2_stream *st = 0;
+    for (int i = 0; i < H2_MAX_STREAMS && !st; ++i)
+    {
+        if (!s->streams[i].id)
+            st = &s->streams[i];
+    }
+    if (!st)
+    {
+        h2_rst(id, H2_REFUSED_STREAM);
+        return true;
+    }
+    memset(st, 0, sizeof(*st));
+    st->id = id;
+    st->remote_closed = s->block_end_stream;
+    st->window = s->initial_window;
+    s->active++;
+
+    // 伪头字段对应HTTP/1.1的请求行，其余请求头与HTTP/1.1一样识别
+    HTTP_CODE ret = overflow ? BAD_REQUEST : GET_REQUEST;
+    bool get = false;
+    for (int i = 0; i < n; ++i)
+    {
+        const header_field &f = fields[i];
+        if (f.name.data[0] == ':')
+        {
+            if (strcmp(f.name.data, ":method") == 0)
+                get = strcmp(f.value.data, "GET") == 0;
+            else if (strcmp(f.name.data, ":path") == 0)
+                m_url = f.value.data;
+            continue;
+        }
+        int known = known_header(f.name.data, f.name.len);
+        if (known == HEADER_CONNECTION || known == HEADER_UPGRADE) // HTTP/2中不允许的连接级请求头
+            ret = BAD_REQUEST;
+        else if (known >= 0)
+            m_known[known] = f.value;
+        if (known == HEADER_RANGE)
+            m_range_count = std::max(parse_range(f.value, m_ranges, MAX_RANGES), 0);
+    }
+    if (!get || !m_url || m_url[0] != '/')
+        ret = BAD_REQUEST;
+    else if (m_url[1] == '\0')
+        m_url = default_url;
+    h2_respond(st, ret);
+    return true;
+}
+
+// 响应体与HTTP/1.1来自同一条路径；多个区间时按RFC允许的方式忽略Range，返回整个文件
+void http_conn::h2_respond(h2_stream *st, HTTP_CODE ret)
+{
+    long start = metric_now_ns();
+    io_stat_add(STAT_REQUESTS);
+    if (ret == GET_REQUEST)
+    {
+        if (m_range_count > 1)
+            m_range_count = 0;
+        ret = do_request();
+        metric_observe(STAGE_REQUEST, metric_now_ns() - start);
+    }
+    if (ret != FILE_REQUEST) // 没有响应体时立即归还do_request可能持有的映射或缓存条目
+    {
+        response_body current = {m_file_address, m_file_stat.st_size, m_cache_entry, m_gzip_entry, m_asset};
+        release_body(current);
+        m_file_address = 0;
+        m_cache_entry = 0;
+        m_gzip_entry = 0;
+        m_asset = 0;
+    }
+    if (ret != FILE_REQUEST && ret != NOT_MODIFIED)
+    {
+        m_gzip = false;
+        m_vary = false;
+        m_etag[0] = '\0';
+    }
+    st->content_type = m_content_type;
+    strcpy(st->etag, m_etag);
+    st->last_modified = m_last_modified;
+    st->gzip = m_gzip;
+    st->vary = m_vary;
+    st->range_total = -1;
+    st->content_length = 0;
+
+    const char *form = 0;
+    switch (ret)
+    {
+    case FILE_REQUEST:
+        st->status = 200;
+        st->body.address = m_file_address;
+        st->body.size = m_file_stat.st_size;
+        st->body.entry = m_cache_entry;
+        st->body.gzip = m_gzip_entry;
+        st->body.asset = m_asset;
+        m_file_address = 0;
+        m_cache_entry = 0;
+        m_gzip_entry = 0;
+        m_asset = 0;
+        st->data = st->body.address;
+        st->remaining = st->body.address ? st->body.size : 0;
+        if (m_range_count == 1)
+        {
+            const byte_range &r = m_ranges[0];
+            st->status = 206;
+            st->data += r.first;
+            st->remaining = r.last - r.first + 1;
+            st->range_first = r.first;
+            st->range_last = r.last;
+            st->range_total = st->body.size;
+        }
+        st->content_length = st->remaining;
+        break;
+    case NOT_MODIFIED:
+        st->status = 304;
+        st->content_length = -1;
+        break;
+    case RANGE_NOT_SATISFIABLE:
+        st->status = 416;
+        st->range_first = -1;
+        st->range_total = m_file_stat.st_size;
+        form = error_416_form;
+        break;
+    case BAD_REQUEST:
+        st->status = 400;
+        form = error_400_form;
+        break;
+    case NO_RESOURCE:
+        st->status = 404;
+        form = error_404_form;
+        break;
+    case FORBIDDEN_REQUEST:
+        st->status = 403;
+        form = error_403_form;
+        break;
+    default:
+        st->status = 500;
+        form = error_500_form;
+        break;
+    }
+    if (form)
+    {
+        st->content_type = "text/html";
+        st->data = form;
+        st->remaining = st->content_length = strlen(form);
+    }
+    m_status = st->status;
+    metric_status(st->status);
+    if (m_access_log)
+    {
+        m_access_log->log(m_address, m_url ? "GET" : "-", m_url, st->status, st->remaining, 0, metric_now_ns() - start);
+    }
+    next_request();
+}
+
+// 与HTTP/1.1的响应头相同，去掉连接级的Connection；变化少的字段加入动态表
+void http_conn::h2_send_headers(h2_stream *st)
+{
+    h2_session *s = m_h2;
+    char *f = s->out + s->out_len;
+    char *p = f + H2_FRAME_HEADER;
+    char value[64];
+    p += s->encoder.begin(p);
+    snprintf(value, sizeof(value), "%d", st->status);
+    p += s->encoder.add(p, ":status", value, false);
+    if (st->content_length >= 0)
+    {
+        snprintf(value, sizeof(value), "%ld", st->content_length);
+        p += s->encoder.add(p, "content-length", value, false);
+        p += s->encoder.add(p, "content-type", st->content_type, true);
+    }
+    if (st->etag[0])
+    {
+        char date[HTTP_DATE_LEN + 1];
+        format_http_date(st->last_modified, date);
+        p += s->encoder.add(p, "etag", st->etag, false);
+        p += s->encoder.add(p, "last-modified", date, HTTP_DATE_LEN, false);
+        p += s->encoder.add(p, "accept-ranges", "bytes", true);
+    }
+    if (st->gzip)
+        p += s->encoder.add(p, "content-encoding", "gzip", true);
+    if (st->vary)
+        p += s->encoder.add(p, "vary", "Accept-Encoding", true);
+    if (st->range_total >= 0)
+    {
+        if (st->range_first < 0)
+            snprintf(value, sizeof(value), "bytes */%ld", st->range_total);
+        else
+            snprintf(value, sizeof(value), "bytes %ld-%ld/%ld", st->range_first, st->range_last, st->range_total);
+        p += s->encoder.add(p, "content-range", value, false);
+    }
+    char date[HTTP_DATE_LEN];
+    http_date::now(date);
+    p += s->encoder.add(p, "date", date, HTTP_DATE_LEN, true);
+
+    frame_header(f, p - f - H2_FRAME_HEADER, H2_HEADERS, H2_FLAG_END_HEADERS | (st->remaining == 0 ? H2_FLAG_END_STREAM : 0), st->id);
+    s->out_len = p - s->out;
+    st->headers_sent = true;
+}
+
+// 最后一个帧进入这一批时，响应体改由这一批持有，发送完毕后释放
+bool http_conn::h2_finish_stream(h2_stream *st)
+{
+    const response_body &b = st->body;
+    if (b.address || b.entry || b.gzip)
+    {
+        if (m_body_count >= MAX_PIPELINE)
+            return false;
+        m_bodies[m_body_count++] = b;
+    }
+    memset(&st->body, 0, sizeof(st->body));
+    return true;
+}
+
+// 每一轮每个流最多发送一个帧，从上次的下一个流开始，大文件不会独占连接
+void http_conn::h2_fill()
+{
+    h2_session *s = m_h2;
+    int first = s->next;
+    s->next = (s->next + 1) % H2_MAX_STREAMS;
+    bool progress = true;
+    while (progress)
+    {
+        progress = false;
+        for (int k = 0; k < H2_MAX_STREAMS; ++k)
+        {
+            h2_stream *st = &s->streams[(first + k) % H2_MAX_STREAMS];
+            if (!st->id)
+                continue;
+            if (!s->out)
+            {
+                s->out = buffer_pool::alloc(H2_WRITE_BUFFER_SIZE);
+                s->out_len = 0;
+                s->out_flushed = 0;
+            }
+            bool end;
+            if (!st->headers_sent)
+            {
+                if (H2_WRITE_BUFFER_SIZE - s->out_len < H2_HEADERS_RESERVE || (st->remaining == 0 && !h2_finish_stream(st)))
+                    return;
+                h2_send_headers(st);
+                end = st->remaining == 0;
+            }
+            else
+            {
+                long n = std::min(std::min(st->remaining, (long)s->max_frame), std::min(st->window, s->conn_window));
+                if (n <= 0)
+                    continue;
+                end = n == st->remaining;
+                if (H2_WRITE_BUFFER_SIZE - s->out_len < H2_CONTROL_RESERVE || m_iv_count + 3 > MAX_IOV || (end && !h2_finish_stream(st)))
+                    return;
+                frame_header(s->out + s->out_len, n, H2_DATA, end ? H2_FLAG_END_STREAM : 0, st->id);
+                s->out_len += H2_FRAME_HEADER;
+                h2_flush_out();
+                add_iov((char *)st->data, n);
+                st->data += n;
+                st->remaining -= n;
+                st->window -= n;
+                s->conn_window -= n;
+            }
+            progress = true;
+            if (end)
+            {
+                if (!st->remote_closed) // 不再需要请求的剩余部分
+                    h2_rst(st->id, H2_NO_ERROR);
+                h2_close_stream(st);
+            }
+        }
+    }
+}
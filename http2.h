@@ -0,0 +1,127 @@
+#ifndef HTTP2_H
+#define HTTP2_H
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include "hpack.h"
+#include "http_conn.h"
+
+#define H2_PREFACE "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n" // 客户端的连接前言
+#define H2_PREFACE_LEN 24
+#define H2_FRAME_HEADER 9
+#define H2_MAX_FRAME 16384                      // 双方默认的最大帧长度，本端不提高接收上限
+#define H2_MAX_STREAMS 32                       // SETTINGS_MAX_CONCURRENT_STREAMS
+#define H2_MAX_HEADER_LIST 8192                 // SETTINGS_MAX_HEADER_LIST_SIZE，解码后的请求头总长度
+#define H2_MAX_HEADER_BLOCK (4 * H2_MAX_FRAME)  // HEADERS与CONTINUATION拼接后头部块的上限
+#define H2_DEFAULT_WINDOW 65535                 // 流与连接的初始流量控制窗口
+#define H2_MAX_WINDOW 0x7fffffffL
+#define H2_READ_BUFFER_SIZE (32 << 10)          // 升级后的读缓冲区，至少能放下一个最大的帧
+#define H2_WRITE_BUFFER_SIZE (16 << 10)         // 帧头、头部块与控制帧
+#define H2_HEADERS_RESERVE 1024                 // 写缓冲区剩余空间少于该值时不再生成HEADERS帧
+#define H2_CONTROL_RESERVE 64                   // 剩余空间少于该值时不再解析帧，先发送已经生成的回复
+#define H2_RESET_HISTORY 16                     // 记住最近由本端重置的流，其上仍在路上的帧被忽略
+
+enum H2_FRAME_TYPE
+{
+    H2_DATA,
+    H2_HEADERS,
+    H2_PRIORITY,
+    H2_RST_STREAM,
+    H2_SETTINGS,
+    H2_PUSH_PROMISE,
+    H2_PING,
+    H2_GOAWAY,
+    H2_WINDOW_UPDATE,
+    H2_CONTINUATION
+};
+
+enum H2_FLAG
+{
+    H2_FLAG_END_STREAM = 0x1,
+    H2_FLAG_ACK = 0x1,
+    H2_FLAG_END_HEADERS = 0x4,
+    H2_FLAG_PADDED = 0x8,
+    H2_FLAG_PRIORITY = 0x20
+};
+
+enum H2_SETTING
+{
+    H2_SETTINGS_HEADER_TABLE_SIZE = 1,
+    H2_SETTINGS_ENABLE_PUSH,
+    H2_SETTINGS_MAX_CONCURRENT_STREAMS,
+    H2_SETTINGS_INITIAL_WINDOW_SIZE,
+    H2_SETTINGS_MAX_FRAME_SIZE,
+    H2_SETTINGS_MAX_HEADER_LIST_SIZE
+};
+
+enum H2_ERROR
+{
+    H2_NO_ERROR,
+    H2_PROTOCOL_ERROR,
+    H2_INTERNAL_ERROR,
+    H2_FLOW_CONTROL_ERROR,
+    H2_SETTINGS_TIMEOUT,
+    H2_STREAM_CLOSED,
+    H2_FRAME_SIZE_ERROR,
+    H2_REFUSED_STREAM,
+    H2_CANCEL,
+    H2_COMPRESSION_ERROR,
+    H2_CONNECT_ERROR,
+    H2_ENHANCE_YOUR_CALM
+};
+
+// 一个正在回答的流；请求在头部块完整时立即处理，响应的元数据与响应体保存到发送完毕
+struct h2_stream
+{
+    uint32_t id;        // 0表示空闲的槽位
+    bool remote_closed; // 客户端已经发送END_STREAM
+    bool headers_sent;
+    int status;
+    long window;        // 发送窗口
+
+    const char *content_type;
+    char etag[64];      // 为空时不发送ETag与Last-Modified
+    time_t last_modified;
+    bool gzip, vary;
+    long content_length;
+    long range_first, range_last, range_total; // Content-Range；range_total为-1时没有，range_first为-1时为"bytes */total"
+
+    const char *data;   // 尚未发送的响应体
+    long remaining;
+    response_body body; // 持有的响应体，最后一个DATA帧进入一批响应时交给这一批
+};
+
+// 一个HTTP/2连接的状态，升级时创建，连接关闭时释放
+struct h2_session
+{
+    h2_session();
+    bool pending() const; // 是否有可以立即发送的帧（窗口允许）
+
+    hpack_decoder decoder;
+    hpack_encoder encoder;
+    bool preface_pending;   // 还没有收到客户端的连接前言
+    uint32_t last_stream;   // 客户端用过的最大流标识符
+    uint32_t continuation;  // 正在等待CONTINUATION的流，0表示没有
+    uint32_t block_stream;  // 正在拼接的头部块所属的流
+    bool block_end_stream;
+    std::string block;      // 拼接中的头部块
+    long conn_window;       // 连接级发送窗口
+    long initial_window;    // 对端的SETTINGS_INITIAL_WINDOW_SIZE
+    int max_frame;          // 对端的SETTINGS_MAX_FRAME_SIZE
+    bool goaway_sent;       // 出错后已经发送GOAWAY，发送完毕后关闭连接
+    bool goaway_received;   // 对端不再发起新的流，回答完现有的流后关闭连接
+    int active;             // 正在回答的流数
+    int next;               // 轮转发送的起点
+    uint32_t reset[H2_RESET_HISTORY]; // 最近由本端发送RST_STREAM的流
+    int reset_next;
+    h2_stream streams[H2_MAX_STREAMS];
+
+    char *out;              // 这一批的帧，发送完毕后归还
+    int out_len;
+    int out_flushed;        // 已经加入待发送数据的位置
+    char headers[H2_MAX_HEADER_LIST]; // 解码后的请求头
+};
+
+#endif
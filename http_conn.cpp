@@ -1,35 +1,122 @@
 #include "http_conn.h"
+#include "http2.h"
+#include "upload.h"
 
 const char *resources_root_path = "/resource"; // Web资源目录
+char default_url[] = "/index.html";             // 请求"/"时返回的文件
 
 const char *ok_200_title = "OK";
+const char *created_201_title = "Created";
+const char *created_201_form = "The file was uploaded.\n";
+const char *no_content_204_title = "No Content";
+const char *not_modified_304_title = "Not Modified";
+const char *partial_206_title = "Partial Content";
 const char *error_400_title = "Bad Request";
 const char *error_400_form = "Your request has bad syntax or is inherently impossible to satisfy.\n";
 const char *error_403_title = "Forbidden";
 const char *error_403_form = "You do not have permission to get file from this server.\n";
 const char *error_404_title = "Not Found";
 const char *error_404_form = "The requested file was not found on this server.\n";
+const char *error_405_title = "Method Not Allowed";
+const char *error_405_form = "The requested method is not allowed for this resource.\n";
+const char *error_411_title = "Length Required";
+const char *error_411_form = "An upload needs a Content-Length or a chunked body.\n";
+const char *error_413_title = "Payload Too Large";
+const char *error_413_form = "The request body is larger than the server accepts.\n";
+const char *error_416_title = "Range Not Satisfiable";
+const char *error_416_form = "The requested range is not satisfiable.\n";
 const char *error_500_title = "Internal Error";
 const char *error_500_form = "There was an unusual problem serving the requested file.\n";
+const char *error_503_title = "Service Unavailable";
+const char *error_503_form = "The server is temporarily overloaded, please try again later.\n";
 
-int http_conn::m_epoll_fd;
-int http_conn::m_user_count;
+// 预先生成的完整503响应，过载时直接发送，不经过状态机
+static std::string build_overload_response()
+{
+    char buf[512];
+    int len = snprintf(buf, sizeof(buf), "HTTP/1.1 503 %s\r\nContent-Length: %d\r\nContent-Type:text/html\r\nConnection: close\r\nRetry-After: 1\r\n\r\n%s",
+                       error_503_title, (int)strlen(error_503_form), error_503_form);
+    return std::string(buf, len);
+}
+static const std::string overload_response = build_overload_response();
+
+// multipart/byteranges的分隔符，进程启动时随机生成一次
+static std::string build_range_boundary()
+{
+    unsigned char bytes[8];
+    if (getrandom(bytes, sizeof(bytes), 0) != (ssize_t)sizeof(bytes))
+    {
+        unsigned long seed = (unsigned long)time(0) ^ (unsigned long)getpid();
+        memcpy(bytes, &seed, sizeof(bytes));
+    }
+    char buf[32];
+    for (int i = 0; i < 8; ++i)
+        sprintf(buf + 2 * i, "%02x", bytes[i]);
+    return std::string(buf);
+}
+static const std::string range_boundary = build_range_boundary();
+static const std::string multipart_type = "multipart/byteranges; boundary=" + range_boundary;
+
+std::atomic<int> http_conn::m_user_count(0);
+file_cache *http_conn::m_file_cache = 0;
+gzip_cache *http_conn::m_gzip_cache = 0;
+access_log *http_conn::m_access_log = 0;
+asset_pack *http_conn::m_asset_pack = 0;
+
+static const char *method_names[] = {"GET", "POST", "HEAD", "PUT", "DELETE", "TRACE", "OPTIONS", "CONNECT"};
+long http_conn::m_sendfile_threshold = SENDFILE_THRESHOLD;
+int http_conn::m_timeouts[TIMEOUT_NUM] = {HEADER_TIMEOUT, BODY_TIMEOUT, KEEPALIVE_TIMEOUT, WRITE_TIMEOUT};
+char http_conn::m_upload_dir[MAX_FILENAME_LEN] = "";
+long http_conn::m_upload_max = (long)UPLOAD_MAX_MB << 20;
+
+// 连接对象池：对象只构造一次，进程退出前不会析构，时间轮检查已经关闭的连接时不会访问已释放的内存。
+// 每个NUMA节点一个池，反应堆从自己节点的池中取得对象，对象所在的块由该节点的线程分配并构造
+static slab_pool<http_conn> **conn_pools = []
+{
+    slab_pool<http_conn> **pools = new slab_pool<http_conn> *[numa_node_count()];
+    for (int n = 0; n < numa_node_count(); ++n)
+        pools[n] = new slab_pool<http_conn>(MAX_FD);
+    return pools;
+}();
+
+http_conn *http_conn::create()
+{
+    int node = numa_current_node();
+    http_conn *conn = conn_pools[node]->alloc();
+    conn->m_pool_node = node;
+    return conn;
+}
+
+static std::string build_doc_root()
+{
+    char *cwd = get_current_dir_name();
+    std::string root = std::string(cwd ? cwd : ".") + resources_root_path;
+    free(cwd);
+    return root;
+}
+
+// 资源目录在第一次调用时确定，之后不再随工作目录变化
+const char *http_conn::doc_root()
+{
+    static const std::string root = build_doc_root();
+    return root.c_str();
+}
 
 void add_fd(int epoll_fd, int fd)
 {
     epoll_event event;
     event.data.fd = fd;
     event.events = EPOLLIN | EPOLLET | EPOLLRDHUP | EPOLLONESHOT;
-    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
-
-    int opt = fcntl(fd, F_GETFL) | O_NONBLOCK;
-    fcntl(fd, F_SETFL, opt);
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event); // 套接字由accept4创建时已经是非阻塞的
+    io_stat_add(STAT_EPOLL_CTL);
 }
 
 void remove_fd(int epoll_fd, int fd)
 {
     epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, 0);
     close(fd);
+    io_stat_add(STAT_EPOLL_CTL);
+    io_stat_add(STAT_SOCKET);
 }
 
 void modify_fd(int epoll_fd, int fd, int ev)
@@ -38,47 +125,91 @@ void modify_fd(int epoll_fd, int fd, int ev)
     event.data.fd = fd;
     event.events = ev | EPOLLET | EPOLLRDHUP | EPOLLONESHOT;
     epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &event);
+    io_stat_add(STAT_EPOLL_CTL);
 }
 
-// 关闭连接
+// 关闭连接，归还缓冲区后把对象放回对象池，之后不能再访问该连接
 void http_conn::close_conn()
 {
     if (m_sockfd != -1)
     {
-        remove_fd(m_epoll_fd, m_sockfd);
+        bool idle = m_backend->remove(this);
         m_sockfd = -1;
-        m_user_count--;
-
-        in_addr client_ip;
-        client_ip.s_addr = m_address.sin_addr.s_addr;
-        printf("Disconnection: %s:%d\tConnection Num: %d\n", inet_ntoa(client_ip), ntohs(m_address.sin_port), m_user_count);
+        if (idle)
+            finish_close();
     }
 }
 
+void http_conn::finish_close()
+{
+    unmap();
+    free_h2();
+    free_upload();
+    release_read_buf();
+    release_write_buf();
+    m_read_size = READ_BUFFER_SIZE;
+    m_user_count--;
+    conn_pools[m_pool_node]->release(this);
+}
+
+// 尽力发送预先生成的503响应，不等待。先读掉已经到达的请求数据，
+// 否则关闭时接收缓冲区中还有数据，内核会发送RST，客户端可能来不及读到503
+static void send_overload(int fd, const sockaddr_in &addr)
+{
+    char discard[4096];
+    while (recv(fd, discard, sizeof(discard), MSG_DONTWAIT) > 0)
+        io_stat_add(STAT_RECV);
+    ssize_t sent = send(fd, overload_response.data(), overload_response.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+    io_stat_add(STAT_RECV);
+    io_stat_add(STAT_SEND);
+    metric_status(503);
+    if (sent > 0)
+        metric_bytes_sent(sent);
+    if (http_conn::m_access_log)
+        http_conn::m_access_log->log(addr, "-", 0, 503, sent > 0 ? sent : 0, 0, 0);
+}
+
+// 任务队列已满时由反应堆调用，尽力发送503后关闭连接
+void http_conn::reject_overload()
+{
+    send_overload(m_sockfd, m_address);
+    close_conn();
+}
+
+// 准入控制拒绝的连接还没有连接对象，直接关闭套接字
+void http_conn::reject(int fd, const sockaddr_in &addr)
+{
+    send_overload(fd, addr);
+    close(fd);
+    io_stat_add(STAT_SOCKET);
+}
+
 // 初始化连接,外部调用初始化套接字地址
-void http_conn::init(int socket_fd, const sockaddr_in &client_addr)
+void http_conn::init(int socket_fd, const sockaddr_in &client_addr, event_backend *backend)
 {
+    m_timer_gen.fetch_add(1, std::memory_order_acq_rel);
+    m_backend = backend;
     m_sockfd = socket_fd;
     m_address = client_addr;
-
-    // 端口复用
-    int reuse = 1;
-    setsockopt(m_sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
-    add_fd(m_epoll_fd, socket_fd);
+    m_file_address = 0;
+    m_cache_entry = 0;
+    m_gzip_entry = 0;
+    m_asset = 0;
+    m_file_fd = -1;
+    m_body_count = 0;
+    m_queued_ns = 0;
+    m_write_start_ns = 0;
     m_user_count++;
 
-    in_addr client_ip;
-    client_ip.s_addr = m_address.sin_addr.s_addr;
-    printf("New Connection: %s:%d\tConnection Num: %d\n", inet_ntoa(client_ip), ntohs(m_address.sin_port), m_user_count);
-
     reset();
+    set_deadline(TIMEOUT_HEADER);
+    m_backend->add(this);
 }
 
-// 重置HTTP状态
+// 重置HTTP状态，缓冲区直接归还，不清零
 void http_conn::reset()
 {
     bytes_to_send = 0;
-    bytes_have_send = 0;
 
     m_check_state = CHECK_STATE_REQUESTLINE; // 初始状态为检查请求行
     m_method = GET;                          // 默认请求方式为GET
@@ -88,26 +219,144 @@ void http_conn::reset()
     m_start_line = 0;
     m_checked_idx = 0;
     m_read_idx = 0;
+    m_request_start = 0;
     m_write_idx = 0;
-    m_headers.clear();
+    m_iv_count = 0;
+    m_iv_index = 0;
+    m_header_count = 0;
+    memset(m_known, 0, sizeof(m_known));
+    m_content_length = 0;
     m_content = 0;
+    m_keep_alive = false;
+    m_gzip = false;
+    m_vary = false;
+    m_content_type = DEFAULT_MIME_TYPE;
+    m_etag[0] = '\0';
+    m_range_count = 0;
+    m_request_deadline = 0;
+    release_read_buf();
+    release_write_buf();
+}
 
-    bzero(m_read_buf, READ_BUFFER_SIZE);
-    bzero(m_write_buf, WRITE_BUFFER_SIZE);
-    bzero(m_real_file, MAX_FILENAME_LEN);
+void http_conn::release_read_buf()
+{
+    if (m_read_buf)
+    {
+        buffer_pool::release(m_read_buf, m_read_size);
+        m_read_buf = 0;
+    }
 }
 
-// 循环读取客户数据，直到无数据可读或者对方关闭连接
+void http_conn::release_write_buf()
+{
+    if (m_write_buf)
+    {
+        buffer_pool::release(m_write_buf, WRITE_BUFFER_SIZE);
+        m_write_buf = 0;
+    }
+    if (m_range_buf)
+    {
+        buffer_pool::release(m_range_buf, RANGE_BUFFER_SIZE);
+        m_range_buf = 0;
+    }
+    if (m_h2 && m_h2->out)
+    {
+        buffer_pool::release(m_h2->out, H2_WRITE_BUFFER_SIZE);
+        m_h2->out = 0;
+        m_h2->out_len = 0;
+        m_h2->out_flushed = 0;
+    }
+}
+
+// 一个请求已经生成响应，之后的数据属于流水线中的下一个请求
+void http_conn::next_request()
+{
+    m_check_state = CHECK_STATE_REQUESTLINE;
+    m_method = GET;
+    m_url = 0;
+    m_version = 0;
+    m_header_count = 0;
+    memset(m_known, 0, sizeof(m_known));
+    m_content_length = 0;
+    m_content = 0;
+    m_gzip = false;
+    m_vary = false;
+    m_content_type = DEFAULT_MIME_TYPE;
+    m_etag[0] = '\0';
+    m_range_count = 0;
+    m_request_deadline = 0;
+    m_start_line = m_checked_idx;
+    m_request_start = m_checked_idx;
+}
+
+// 丢弃已经处理的请求，为后续数据腾出空间；解析到一半的请求中指向读缓冲区的指针一起移动
+void http_conn::compact_read_buf()
+{
+    int shift = m_request_start;
+    if (shift == 0)
+    {
+        return;
+    }
+    memmove(m_read_buf, m_read_buf + shift, m_read_idx - shift);
+    m_read_idx -= shift;
+    m_checked_idx -= shift;
+    m_start_line -= shift;
+    m_request_start = 0;
+    if (m_url && m_url != default_url)
+        m_url -= shift;
+    if (m_version)
+        m_version -= shift;
+    for (int i = 0; i < m_header_count; ++i)
+    {
+        m_header_fields[i].name.data -= shift;
+        m_header_fields[i].value.data -= shift;
+    }
+    for (int i = 0; i < HEADER_NUM; ++i)
+    {
+        if (m_known[i].data)
+            m_known[i].data -= shift;
+    }
+}
+
+// 请求头从第一个字节开始计算总的期限，防止一点一点发送请求头的慢速客户端一直占用连接；
+// 其余种类在每次活动后重新计时。只写入一个时间戳，定时器本身不移动
+void http_conn::set_deadline(TIMEOUT_KIND kind)
+{
+    long deadline = LONG_MAX;
+    if (m_timeouts[kind] > 0)
+    {
+        deadline = timer_wheel::now_ms() + m_timeouts[kind] * 1000L;
+    }
+    if (kind == TIMEOUT_HEADER)
+    {
+        if (m_request_deadline == 0)
+            m_request_deadline = deadline;
+        deadline = m_request_deadline;
+    }
+    m_deadline.store(deadline, std::memory_order_release);
+}
+
+// 循环读取客户数据，直到无数据可读、读缓冲区已满或者对方关闭连接
+// 缓冲区满时剩下的数据留在套接字中，处理完已读到的请求后重新注册读事件时会再次触发
 bool http_conn::read()
 {
-    if (m_read_idx >= READ_BUFFER_SIZE)
+    if (m_upload) // 请求体由工作线程直接从套接字搬到文件
+    {
+        return true;
+    }
+    if (m_read_idx >= m_read_size)
     {
         return false;
     }
+    if (!m_read_buf)
+    {
+        m_read_buf = buffer_pool::alloc(m_read_size);
+    }
     int bytes_read = 0;
-    while (true)
+    while (m_read_idx < m_read_size)
     {
-        bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx, 0); // 接收数据到读缓冲区
+        bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, m_read_size - m_read_idx, 0); // 接收数据到读缓冲区
+        io_stat_add(STAT_RECV);
         if (bytes_read == -1)
         {
             if (errno == EAGAIN || errno == EWOULDBLOCK) // 没有数据
@@ -125,6 +374,22 @@ bool http_conn::read()
     return true;
 }
 
+// 事件后端已经把数据读到自己的缓冲区，复制到读缓冲区
+bool http_conn::receive(const char *data, int len)
+{
+    if (len > m_read_size - m_read_idx)
+    {
+        return false;
+    }
+    if (!m_read_buf)
+    {
+        m_read_buf = buffer_pool::alloc(m_read_size);
+    }
+    memcpy(m_read_buf + m_read_idx, data, len);
+    m_read_idx += len;
+    return true;
+}
+
 // 主状态机，解析请求
 http_conn::HTTP_CODE http_conn::process_read()
 {
@@ -134,33 +399,33 @@ http_conn::HTTP_CODE http_conn::process_read()
     while (((m_check_state == CHECK_STATE_CONTENT) && (line_status == LINE_OK)) || ((line_status = parse_line()) == LINE_OK))
     {
         text = get_line();
+        char *line_end = m_read_buf + m_checked_idx - 2; // 行尾的"\r\n"已经被替换为'\0'
         m_start_line = m_checked_idx;
 
         switch (m_check_state)
         {
         case CHECK_STATE_REQUESTLINE:
         {
-            ret = parse_request_line(text);
+            ret = parse_request_line(text, line_end);
             if (ret == BAD_REQUEST)
                 return BAD_REQUEST;
             break;
         }
         case CHECK_STATE_HEADER:
         {
-            ret = parse_headers(text);
+            ret = parse_headers(text, line_end);
             if (ret == BAD_REQUEST)
                 return BAD_REQUEST;
             else if (ret == GET_REQUEST)
-                return do_request();
+                return GET_REQUEST;
             break;
         }
         case CHECK_STATE_CONTENT:
         {
             ret = parse_content(text);
             if (ret == GET_REQUEST)
-                return do_request();
-            line_status = LINE_OPEN;
-            break;
+                return GET_REQUEST;
+            return NO_REQUEST; // 不能再用parse_line扫描请求体，否则m_checked_idx越过已经到达的部分
         }
         default:
         {
@@ -168,105 +433,132 @@ http_conn::HTTP_CODE http_conn::process_read()
         }
         }
     }
+    if (line_status == LINE_BAD)
+    {
+        return BAD_REQUEST;
+    }
     return NO_REQUEST;
 }
 
-// 解析一行
+// 解析一行：向量化地查找'\r'或'\n'，从上次停下的位置继续
 http_conn::LINE_STATUS http_conn::parse_line()
 {
-    char temp;
-    for (; m_checked_idx < m_read_idx; ++m_checked_idx)
+    const char *end = m_read_buf + m_read_idx;
+    const char *p = find_eol(m_read_buf + m_checked_idx, end);
+    m_checked_idx = p - m_read_buf;
+    if (p == end)
     {
-        temp = m_read_buf[m_checked_idx];
-        if (temp == '\r')
-        {
-            if ((m_checked_idx + 1) == m_read_idx)
-            {
-                return LINE_OPEN;
-            }
-            else if (m_read_buf[m_checked_idx + 1] == '\n')
-            {
-                m_read_buf[m_checked_idx++] = '\0';
-                m_read_buf[m_checked_idx++] = '\0';
-                return LINE_OK;
-            }
-            return LINE_BAD;
-        }
-        else if (temp == '\n')
-        {
-            if ((m_checked_idx > 1) && (m_read_buf[m_checked_idx - 1] == '\r'))
-            {
-                m_read_buf[m_checked_idx - 1] = '\0';
-                m_read_buf[m_checked_idx++] = '\0';
-                return LINE_OK;
-            }
-            return LINE_BAD;
-        }
+        return LINE_OPEN;
     }
-    return LINE_OPEN;
+    if (*p == '\n') // 前面没有'\r'的'\n'
+    {
+        return LINE_BAD;
+    }
+    if ((m_checked_idx + 1) == m_read_idx) // '\n'还没有到达
+    {
+        return LINE_OPEN;
+    }
+    if (m_read_buf[m_checked_idx + 1] == '\n')
+    {
+        m_read_buf[m_checked_idx++] = '\0';
+        m_read_buf[m_checked_idx++] = '\0';
+        return LINE_OK;
+    }
+    return LINE_BAD;
 }
 
-// 解析请求行
-http_conn::HTTP_CODE http_conn::parse_request_line(char *text)
+static bool is_blank(char c)
 {
-    m_url = strpbrk(text, " \t");
-    if (!m_url)
+    return c == ' ' || c == '\t';
+}
+
+// 解析请求行，text到end之间是不含行尾的一行
+http_conn::HTTP_CODE http_conn::parse_request_line(char *text, char *end)
+{
+    char *method_end = (char *)find_either(text, end, ' ', '\t');
+    if (method_end == end)
     {
         return BAD_REQUEST;
     }
-    *m_url++ = '\0';
-
-    char *method = text; // HTTP方法
-    if (strcasecmp(method, "GET") == 0)
+    if (method_end - text == 3 && strncasecmp(text, "GET", 3) == 0) // HTTP方法
         m_method = GET;
+    else if (method_end - text == 3 && strncasecmp(text, "PUT", 3) == 0)
+        m_method = PUT;
+    else if (method_end - text == 4 && strncasecmp(text, "POST", 4) == 0)
+        m_method = POST;
     else
         return BAD_REQUEST;
 
-    m_version = strpbrk(m_url, " \t");
-    if (!m_version)
+    char *url = method_end + 1;
+    char *url_end = (char *)find_either(url, end, ' ', '\t');
+    if (url_end == end)
     {
         return BAD_REQUEST;
     }
-    *m_version++ = '\0'; // HTTP版本
-    if (strcasecmp(m_version, "HTTP/1.1") != 0)
+    *url_end = '\0';
+    m_version = url_end + 1; // HTTP版本
+    if (end - m_version != 8 || strncasecmp(m_version, "HTTP/1.1", 8) != 0)
     {
         return BAD_REQUEST;
     }
 
-    if (strncasecmp(m_url, "http://", 7) == 0)
-        m_url += 7;
+    if (strncasecmp(url, "http://", 7) == 0)
+        url += 7;
 
-    m_url = strchr(m_url, '/');
-    if (!m_url || strlen(m_url) == 1)
-    {
-        strcpy(m_url, "/index.html");
-    }
-    else if (m_url[0] != '/')
+    url = strchr(url, '/');
+    if (!url)
     {
         return BAD_REQUEST;
     }
+    m_url = url[1] == '\0' ? default_url : url;
     m_check_state = CHECK_STATE_HEADER; // 检查状态变成检查请求头
     return NO_REQUEST;
 }
 
-// 解析请求头
-http_conn::HTTP_CODE http_conn::parse_headers(char *text)
+// 解析请求头：名字和值作为片段保存，不复制；已知的请求头按哈希识别
+http_conn::HTTP_CODE http_conn::parse_headers(char *text, char *end)
 {
     // 空行，请求头解析完毕
-    if (text[0] == '\0')
+    if (text == end)
     {
-        if (m_headers.find("Content-Length") != m_headers.end() && stoi(m_headers["Content-Length"]) > 0)
+        if (m_method != GET) // 上传的请求体不读入读缓冲区，由start_upload流式写入文件
+        {
+            return GET_REQUEST;
+        }
+        if (m_content_length > 0)
         {
             m_check_state = CHECK_STATE_CONTENT;
             return NO_REQUEST;
         }
         return GET_REQUEST;
     }
-    else
+
+    char *colon = (char *)memchr(text, ':', end - text);
+    if (!colon || colon == text || m_header_count >= MAX_HEADERS)
     {
-        char *value = strpbrk(text, ":");
-        *value++ = '\0';
-        m_headers[text] = ++value;
+        return BAD_REQUEST;
+    }
+    const char *value = colon + 1;
+    const char *value_end = end;
+    while (value < value_end && is_blank(*value))
+        ++value;
+    while (value_end > value && is_blank(value_end[-1]))
+        --value_end;
+
+    header_field &field = m_header_fields[m_header_count++];
+    field.name.data = text;
+    field.name.len = colon - text;
+    field.value.data = value;
+    field.value.len = value_end - value;
+
+    int id = known_header(text, colon - text);
+    if (id >= 0)
+    {
+        m_known[id] = field.value;
+        if (id == HEADER_CONTENT_LENGTH && !parse_length(field.value, &m_content_length))
+            return BAD_REQUEST;
+        if (id == HEADER_RANGE) // 无法解析的Range被忽略，返回整个文件
+            m_range_count = std::max(parse_range(field.value, m_ranges, MAX_RANGES), 0);
     }
     return NO_REQUEST;
 }
@@ -274,10 +566,10 @@ http_conn::HTTP_CODE http_conn::parse_headers(char *text)
 // 解析请求体
 http_conn::HTTP_CODE http_conn::parse_content(char *text)
 {
-    if (m_read_idx >= (stoi(m_headers["Content-Length"]) + m_checked_idx))
+    if (m_read_idx >= (m_content_length + m_checked_idx))
     {
-        text[stoi(m_headers["Content-Length"])] = '\0';
-        m_content = text;
+        m_content = text; // 请求体之后可能紧跟着下一个请求，不能写入'\0'
+        m_checked_idx += m_content_length;
         return GET_REQUEST;
     }
     return NO_REQUEST;
@@ -285,202 +577,1053 @@ http_conn::HTTP_CODE http_conn::parse_content(char *text)
 
 http_conn::HTTP_CODE http_conn::do_request()
 {
-    int len = 0;
-    strcpy(m_real_file, get_current_dir_name());
-    len += strlen(m_real_file);
-    strncpy(m_real_file + len, resources_root_path, MAX_FILENAME_LEN - len - 1);
-    len += strlen(resources_root_path);
-    strncpy(m_real_file + len, m_url, MAX_FILENAME_LEN - len - 1);
+    char key[MAX_FILENAME_LEN];
+    if (!file_cache::normalize_url(m_url, key, sizeof(key)))
+    {
+        return BAD_REQUEST;
+    }
+    if (m_method != GET)
+    {
+        return start_upload(key);
+    }
+    if (strcmp(key, METRICS_URL) == 0) // 保留的URL，不对应资源目录中的文件
+    {
+        return metrics_request();
+    }
+    char real_file[MAX_FILENAME_LEN]; // 请求的文件路径
+    snprintf(real_file, MAX_FILENAME_LEN, "%s%s", doc_root(), key);
+    const mime_type_entry *mime = mime_lookup(key);
+    m_content_type = mime->type;
+    m_vary = mime->compressible;
+
+    // 命中资源包或缓存时不访问文件系统
+    const asset *packed = m_asset_pack ? m_asset_pack->find(key) : 0;
+    if (packed)
+    {
+        m_file_stat = packed->st;
+    }
+    else if (m_file_cache && (m_cache_entry = m_file_cache->acquire(key)) != 0)
+    {
+        m_file_stat = m_cache_entry->st;
+        m_file_address = m_cache_entry->data;
+    }
+    else
+    {
+        io_stat_add(STAT_FILE);
+        if (stat(real_file, &m_file_stat) < 0) // 获取real_file文件的相关的状态信息
+        {
+            return NO_RESOURCE;
+        }
+
+        if (!(m_file_stat.st_mode & S_IROTH)) // 判断访问权限
+        {
+            return FORBIDDEN_REQUEST;
+        }
+
+        if (S_ISDIR(m_file_stat.st_mode)) // 判断是否是目录
+        {
+            return BAD_REQUEST;
+        }
+    }
+
+    // ETag由原文件的inode、大小和修改时间生成，gzip压缩后的内容是另一种表示，加上"-gz"区分
+    if (packed)
+        strcpy(m_etag, packed->etag);
+    else
+        format_etag(m_file_stat, m_etag, sizeof(m_etag));
+    m_last_modified = m_file_stat.st_mtime;
+    bool gzip_ok = m_vary && accepts_coding(m_known[HEADER_ACCEPT_ENCODING], "gzip");
+
+    // 客户端缓存仍然有效时不打开文件
+    if (not_modified(gzip_ok))
+    {
+        if (m_cache_entry)
+        {
+            m_file_cache->release(m_cache_entry);
+            m_cache_entry = 0;
+            m_file_address = 0;
+        }
+        return NOT_MODIFIED;
+    }
+
+    // 区间总是针对未压缩的文件
+    if (m_range_count > 0 && !if_range_matches())
+    {
+        m_range_count = 0;
+    }
+    if (m_range_count > 0 && resolve_ranges(m_file_stat.st_size) == 0)
+    {
+        if (m_cache_entry)
+        {
+            m_file_cache->release(m_cache_entry);
+            m_cache_entry = 0;
+            m_file_address = 0;
+        }
+        return RANGE_NOT_SATISFIABLE;
+    }
+
+    if (packed)
+    {
+        // 响应头块与响应体都在资源包中，发送完毕后不需要释放
+        int v = m_range_count == 0 && gzip_ok && packed->variants[1].body ? 1 : 0;
+        if (v)
+        {
+            strcpy(m_etag + strlen(m_etag) - 1, "-gz\"");
+            m_gzip = true;
+        }
+        m_asset = &packed->variants[v];
+        m_file_address = (char *)m_asset->body;
+        m_file_stat.st_size = m_asset->body_len;
+        return FILE_REQUEST;
+    }
+    if (m_range_count == 0 && gzip_ok && use_gzip(key, real_file))
+    {
+        strcpy(m_etag + strlen(m_etag) - 1, "-gz\"");
+        return FILE_REQUEST;
+    }
+    if (m_cache_entry)
+    {
+        return FILE_REQUEST;
+    }
+    HTTP_CODE ret = open_file(key, real_file);
+    if (ret == FILE_REQUEST && m_range_count > 1 && m_file_fd >= 0)
+    {
+        // 多个区间与分段头交替发送，改为映射到内存，由一个iovec列表引用
+        m_file_address = (char *)mmap(0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, m_file_fd, 0);
+        close(m_file_fd);
+        m_file_fd = -1;
+        io_stat_add(STAT_FILE, 2);
+        if (m_file_address == MAP_FAILED)
+        {
+            m_file_address = 0;
+            return INTERNAL_ERROR;
+        }
+    }
+    return ret;
+}
+
+// 抓取时才汇总各线程的指标；响应体放在匿名映射中，与映射的文件一样在发送完毕后munmap
+http_conn::HTTP_CODE http_conn::metrics_request()
+{
+    std::string body;
+    metric_gauges gauges = {m_user_count.load(std::memory_order_relaxed), (long)thread_pool<http_conn>::total_queue_size(), thread_pool<http_conn>::total_threads(),
+                            thread_pool<http_conn>::total_started(), thread_pool<http_conn>::total_retired()};
+    metrics_render(body, gauges);
+    if (m_access_log)
+        m_access_log->render_metrics(body);
+    char *address = (char *)mmap(0, body.size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (address == MAP_FAILED)
+    {
+        return INTERNAL_ERROR;
+    }
+    memcpy(address, body.data(), body.size());
+    memset(&m_file_stat, 0, sizeof(m_file_stat));
+    m_file_stat.st_size = body.size();
+    m_file_address = address;
+    m_content_type = "text/plain; version=0.0.4; charset=utf-8";
+    m_vary = false;
+    m_range_count = 0;
+    return FILE_REQUEST;
+}
 
-    if (stat(m_real_file, &m_file_stat) < 0) // 获取m_real_file文件的相关的状态信息
+// 实体标签用强比较，弱标签永远不匹配；日期必须与修改时间完全相同
+bool http_conn::if_range_matches()
+{
+    const str_view &v = m_known[HEADER_IF_RANGE];
+    if (!v.data)
     {
-        return NO_RESOURCE;
+        return true;
     }
+    if (v.len > 0 && (v.data[0] == '"' || v.data[0] == 'W'))
+    {
+        return (size_t)v.len == strlen(m_etag) && memcmp(v.data, m_etag, v.len) == 0;
+    }
+    time_t date;
+    return parse_http_date(v, &date) && date == m_last_modified;
+}
 
-    if (!(m_file_stat.st_mode & S_IROTH)) // 判断访问权限
+int http_conn::resolve_ranges(long size)
+{
+    int count = 0;
+    for (int i = 0; i < m_range_count; ++i)
     {
-        return FORBIDDEN_REQUEST;
+        byte_range r = m_ranges[i];
+        if (r.first < 0) // 最后last个字节
+        {
+            if (r.last == 0)
+                continue;
+            r.first = r.last >= size ? 0 : size - r.last;
+            r.last = size - 1;
+        }
+        else
+        {
+            if (r.first >= size)
+                continue;
+            if (r.last < 0 || r.last >= size)
+                r.last = size - 1;
+        }
+        m_ranges[count++] = r;
     }
+    m_range_count = count;
+    return count;
+}
 
-    if (S_ISDIR(m_file_stat.st_mode)) // 判断是否是目录
+// If-None-Match优先，存在时忽略If-Modified-Since
+bool http_conn::not_modified(bool gzip_ok)
+{
+    const str_view &none_match = m_known[HEADER_IF_NONE_MATCH];
+    if (none_match.data)
     {
-        return BAD_REQUEST;
+        if (etag_matches(none_match, m_etag))
+        {
+            return true;
+        }
+        if (!gzip_ok)
+        {
+            return false;
+        }
+        char gzip_etag[sizeof(m_etag)];
+        snprintf(gzip_etag, sizeof(gzip_etag), "%.*s-gz\"", (int)strlen(m_etag) - 1, m_etag);
+        if (etag_matches(none_match, gzip_etag))
+        {
+            strcpy(m_etag, gzip_etag);
+            return true;
+        }
+        return false;
+    }
+    time_t since;
+    return parse_http_date(m_known[HEADER_IF_MODIFIED_SINCE], &since) && m_last_modified <= since;
+}
+
+http_conn::HTTP_CODE http_conn::open_file(const char *key, const char *path)
+{
+    // 大文件不缓存也不映射，由write()用sendfile直接从页缓存发送；HTTP/2的响应体要分成帧，总是映射
+    if (m_sendfile_threshold > 0 && m_file_stat.st_size >= m_sendfile_threshold && !m_h2)
+    {
+        io_stat_add(STAT_FILE);
+        m_file_fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (m_file_fd < 0)
+        {
+            return NO_RESOURCE;
+        }
+        m_file_offset = 0;
+        return FILE_REQUEST;
     }
 
-    int fd = open(m_real_file, O_RDONLY);
+    if (m_file_cache && (m_cache_entry = m_file_cache->load(key, path, m_file_stat)) != 0)
+    {
+        io_stat_add(STAT_FILE, 3);
+        m_file_stat = m_cache_entry->st;
+        m_file_address = m_cache_entry->data;
+        return FILE_REQUEST;
+    }
+
+    io_stat_add(STAT_FILE, 3);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return NO_RESOURCE;
+    }
     m_file_address = (char *)mmap(0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0); // 创建内存映射
     close(fd);
+    if (m_file_address == MAP_FAILED)
+    {
+        m_file_address = 0;
+        return m_file_stat.st_size == 0 ? FILE_REQUEST : INTERNAL_ERROR;
+    }
     return FILE_REQUEST;
 }
 
-// 解除内存映射
-void http_conn::unmap()
+// m_file_stat是原文件的状态，原文件命中缓存时m_cache_entry持有它，否则还没有打开
+// 运行时压缩过的结果优先：命中时不再查找.gz文件，因此压缩之后才出现的.gz文件要等原文件修改后才会使用
+bool http_conn::use_gzip(const char *key, const char *path)
 {
-    if (m_file_address)
+    gzip_entry *gz = m_gzip_cache ? m_gzip_cache->acquire(m_file_stat) : 0;
+    if (!gz)
+    {
+        if (open_gzip_sibling(key, path))
+        {
+            return true;
+        }
+        if (m_gzip_cache)
+        {
+            if (!m_file_address)
+                io_stat_add(STAT_FILE, 3);
+            gz = m_gzip_cache->load(path, m_file_stat, m_file_address);
+        }
+    }
+    if (!gz)
     {
-        munmap(m_file_address, m_file_stat.st_size);
+        return false;
+    }
+    if (gz->len < 0) // 压缩后不会变小
+    {
+        m_gzip_cache->release(gz);
+        return false;
+    }
+    if (m_cache_entry)
+    {
+        m_file_cache->release(m_cache_entry);
+        m_cache_entry = 0;
+    }
+    m_gzip_entry = gz;
+    m_file_address = gz->data;
+    m_file_stat.st_size = gz->len;
+    m_gzip = true;
+    return true;
+}
+
+// .gz文件与其他文件一样经过缓存、sendfile或内存映射，被修改时由缓存的inotify监视失效
+bool http_conn::open_gzip_sibling(const char *key, const char *path)
+{
+    char gz_key[MAX_FILENAME_LEN], gz_path[MAX_FILENAME_LEN];
+    if (snprintf(gz_key, sizeof(gz_key), "%s.gz", key) >= (int)sizeof(gz_key) ||
+        snprintf(gz_path, sizeof(gz_path), "%s.gz", path) >= (int)sizeof(gz_path))
+    {
+        return false;
+    }
+
+    struct stat orig_stat = m_file_stat;
+    cache_entry *orig_entry = m_cache_entry;
+    cache_entry *entry = m_file_cache ? m_file_cache->acquire(gz_key) : 0;
+    if (entry)
+    {
+        m_cache_entry = entry;
+        m_file_stat = entry->st;
+        m_file_address = entry->data;
+    }
+    else
+    {
+        io_stat_add(STAT_FILE);
+        struct stat st;
+        if (stat(gz_path, &st) < 0 || !S_ISREG(st.st_mode) || !(st.st_mode & S_IROTH))
+        {
+            return false;
+        }
+        m_cache_entry = 0;
         m_file_address = 0;
+        m_file_stat = st;
+        if (open_file(gz_key, gz_path) != FILE_REQUEST) // 恢复成原文件
+        {
+            m_file_stat = orig_stat;
+            m_cache_entry = orig_entry;
+            m_file_address = orig_entry ? orig_entry->data : 0;
+            return false;
+        }
+    }
+    if (orig_entry)
+    {
+        m_file_cache->release(orig_entry);
     }
+    m_gzip = true;
+    return true;
 }
 
-// 发送HTTP响应
-bool http_conn::write()
+void release_body(const response_body &body)
+{
+    if (body.asset)
+    {
+        return;
+    }
+    if (body.gzip)
+    {
+        http_conn::m_gzip_cache->release(body.gzip);
+    }
+    else if (body.entry)
+    {
+        http_conn::m_file_cache->release(body.entry);
+    }
+    else if (body.address)
+    {
+        munmap(body.address, body.size);
+        io_stat_add(STAT_FILE);
+    }
+}
+
+// 释放一批响应的响应体：解除内存映射、归还缓存条目或关闭sendfile的文件
+void http_conn::unmap()
 {
-    int temp = 0;
+    if (m_file_fd >= 0)
+    {
+        close(m_file_fd);
+        m_file_fd = -1;
+        io_stat_add(STAT_FILE);
+    }
+    for (int i = 0; i < m_body_count; ++i)
+    {
+        release_body(m_bodies[i]);
+    }
+    m_body_count = 0;
+    response_body current = {m_file_address, m_file_stat.st_size, m_cache_entry, m_gzip_entry, m_asset};
+    release_body(current);
+    m_file_address = 0;
+    m_cache_entry = 0;
+    m_gzip_entry = 0;
+    m_asset = 0;
+}
 
+// 可写事件到达后继续发送HTTP响应，只在事件后端自己的线程上调用
+bool http_conn::write()
+{
     if (bytes_to_send == 0)
     {
-        modify_fd(m_epoll_fd, m_sockfd, EPOLLIN);
         reset();
+        set_deadline(TIMEOUT_IDLE);
+        m_backend->want_read(this);
         return true;
     }
 
-    while (1)
+    SEND_STATUS ret = send_pending();
+    if (ret == SEND_BLOCKED) // TCP写缓冲满
     {
-        temp = writev(m_sockfd, m_iv, m_iv_count); // 分散写入数据
-        if (temp <= -1)
+        set_deadline(TIMEOUT_WRITE);
+        m_backend->want_write(this);
+        return true;
+    }
+    if (ret == SEND_ERROR || !finish_response())
+    {
+        return false;
+    }
+    if (has_buffered_request()) // 流水线中还有已经读到的请求
+    {
+        m_backend->dispatch(this);
+    }
+    else
+    {
+        set_deadline(TIMEOUT_IDLE);
+        m_backend->want_read(this);
+    }
+    return true;
+}
+
+http_conn::SEND_STATUS http_conn::send_pending()
+{
+    while (bytes_to_send > 0)
+    {
+        ssize_t temp;
+        if (m_iv_index < m_iv_count)
+        {
+            // 一批响应的响应头和内存中的响应体一次分散写入，后面还有sendfile时用MSG_MORE让内核与文件内容合并成满的报文段
+            temp = sendmsg(m_sockfd, pending_msg(), MSG_NOSIGNAL | (m_file_fd >= 0 ? MSG_MORE : 0));
+        }
+        else
         {
-            if (errno == EAGAIN) // TCP写缓冲满
+            off_t offset = m_file_offset;
+            temp = sendfile(m_sockfd, m_file_fd, &offset, bytes_to_send);
+            if (temp == 0) // 文件在发送过程中被截断
             {
-                modify_fd(m_epoll_fd, m_sockfd, EPOLLOUT);
-                return true;
+                unmap();
+                return SEND_ERROR;
             }
-            else
+        }
+        io_stat_add(STAT_SEND);
+        if (temp <= -1)
+        {
+            if (errno == EAGAIN)
             {
-                unmap();
-                return false;
+                return SEND_BLOCKED;
             }
+            unmap();
+            return SEND_ERROR;
         }
+        consume(temp);
+    }
+    return SEND_DONE;
+}
 
-        bytes_have_send += temp;
-        bytes_to_send -= temp;
-        // 修改下一轮开始发送的位置
-        if (bytes_have_send >= m_iv[0].iov_len)
+// 发送缓冲区通常是空的，响应生成后先直接发送，省去一次等待可写的注册与唤醒；
+// 连接此时不在事件后端中等待任何事件，不会与反应堆同时访问。继续处理流水线时截止时间保持为0，
+// 只在交还给事件后端之前设置
+bool http_conn::send_response()
+{
+    m_write_start_ns = metric_now_ns();
+    SEND_STATUS ret = send_pending();
+    metric_direct_send(ret == SEND_DONE);
+    if (ret == SEND_BLOCKED)
+    {
+        set_deadline(TIMEOUT_WRITE);
+        m_backend->want_write(this);
+        return false;
+    }
+    if (ret == SEND_ERROR || !finish_response())
+    {
+        close_conn();
+        return false;
+    }
+    if (has_buffered_request())
+    {
+        return true;
+    }
+    set_deadline(TIMEOUT_IDLE);
+    m_backend->want_read(this);
+    return false;
+}
+
+void http_conn::advance(long sent)
+{
+    set_deadline(TIMEOUT_WRITE);
+    consume(sent);
+}
+
+// 记录已发送的字节，修改下一轮开始发送的位置；超出内存数据的部分由sendfile发送
+void http_conn::consume(long sent)
+{
+    metric_bytes_sent(sent);
+    bytes_to_send -= sent;
+    while (sent > 0 && m_iv_index < m_iv_count)
+    {
+        struct iovec &iv = m_iv[m_iv_index];
+        if ((size_t)sent < iv.iov_len)
         {
-            m_iv[0].iov_len = 0;
-            m_iv[1].iov_base = m_file_address + (bytes_have_send - m_write_idx);
-            m_iv[1].iov_len = bytes_to_send;
+            iv.iov_base = (char *)iv.iov_base + sent;
+            iv.iov_len -= sent;
+            return;
         }
-        else
+        sent -= iv.iov_len;
+        iv.iov_len = 0;
+        m_iv_index++;
+    }
+    m_file_offset += sent;
+}
+
+// 尚未发送的内存中的数据，消息头在发送完成前保持有效
+struct msghdr *http_conn::pending_msg()
+{
+    memset(&m_msg, 0, sizeof(m_msg));
+    m_msg.msg_iov = m_iv + m_iv_index;
+    m_msg.msg_iovlen = m_iv_count - m_iv_index;
+    return &m_msg;
+}
+
+bool http_conn::has_buffered_request() const
+{
+    return m_read_idx > 0 || (m_h2 && m_h2->pending());
+}
+
+// 只在读缓冲区中还没有解析过任何一行时判断；最后一个请求不完整时只看前面完整的，剩下的部分留到下一次读
+bool http_conn::can_run_inline()
+{
+    if (m_h2 || !m_read_buf || m_check_state != CHECK_STATE_REQUESTLINE || m_checked_idx != m_request_start)
+    {
+        return false;
+    }
+    const char *p = m_read_buf + m_request_start;
+    const char *end = m_read_buf + m_read_idx;
+    bool any = false;
+    while (p < end)
+    {
+        const char *head_end = (const char *)memmem(p, end - p, "\r\n\r\n", 4);
+        if (!head_end)
+            break;
+        if (!resident_request(p, head_end + 2))
+            return false;
+        p = head_end + 4;
+        any = true;
+    }
+    return any;
+}
+
+// 与parse_request_line、do_request的判断一致，但不修改读缓冲区；拿不准的请求都交给线程池
+bool http_conn::resident_request(const char *text, const char *end)
+{
+    const char *line_end = (const char *)memmem(text, end - text, "\r\n", 2);
+    if (line_end - text < 4 || strncasecmp(text, "GET ", 4) != 0)
+    {
+        return false;
+    }
+    const char *url = text + 4;
+    const char *url_end = find_either(url, line_end, ' ', '\t');
+    if (url_end - url >= 7 && strncasecmp(url, "http://", 7) == 0)
+        url += 7;
+    url = (const char *)memchr(url, '/', url_end - url);
+    if (!url || url_end - url >= MAX_FILENAME_LEN)
+    {
+        return false;
+    }
+    char raw[MAX_FILENAME_LEN], key[MAX_FILENAME_LEN];
+    memcpy(raw, url, url_end - url);
+    raw[url_end - url] = '\0';
+    if (!file_cache::normalize_url(url_end - url == 1 ? default_url : raw, key, sizeof(key)) || strcmp(key, METRICS_URL) == 0)
+    {
+        return false;
+    }
+
+    // 有请求体或要求升级协议的请求不走快速路径
+    str_view accept_encoding = {0, 0};
+    bool ranged = false;
+    for (const char *line = line_end + 2; line < end; line = line_end + 2)
+    {
+        line_end = (const char *)memmem(line, end - line, "\r\n", 2);
+        const char *colon = (const char *)memchr(line, ':', line_end - line);
+        if (!colon)
+            return false;
+        int id = known_header(line, colon - line);
+        if (id == HEADER_CONTENT_LENGTH || id == HEADER_UPGRADE)
+            return false;
+        if (id == HEADER_RANGE)
+            ranged = true;
+        if (id == HEADER_ACCEPT_ENCODING)
         {
-            m_iv[0].iov_base = m_write_buf + bytes_have_send;
-            m_iv[0].iov_len = m_iv[0].iov_len - temp;
+            const char *value_end = line_end;
+            while (value_end > colon + 1 && is_blank(value_end[-1]))
+                --value_end;
+            accept_encoding.data = colon + 1;
+            accept_encoding.len = value_end - colon - 1;
         }
+    }
 
-        if (bytes_to_send <= 0) // 数据发送完毕
-        {
-            unmap();
-            modify_fd(m_epoll_fd, m_sockfd, EPOLLIN);
+    if (m_asset_pack && m_asset_pack->find(key))
+    {
+        return true;
+    }
+    cache_entry *entry = m_file_cache ? m_file_cache->acquire(key) : 0;
+    if (!entry)
+    {
+        return false;
+    }
+    // 需要压缩时，压缩结果也必须已经在缓存中
+    bool resident = true;
+    if (!ranged && mime_lookup(key)->compressible && accepts_coding(accept_encoding, "gzip"))
+    {
+        gzip_entry *gz = m_gzip_cache ? m_gzip_cache->acquire(entry->st) : 0;
+        resident = gz != 0;
+        if (gz)
+            m_gzip_cache->release(gz);
+    }
+    m_file_cache->release(entry);
+    return resident;
+}
 
-            if (m_headers.find("Connection") != m_headers.end() && m_headers["Connection"] == "keep-alive")
-            {
-                reset();
-                return true;
-            }
-            else
-            {
-                return false;
-            }
-        }
+// 一批响应发送完毕，释放响应体；保持连接时清空写状态后返回true，读缓冲区中未处理的数据保留
+bool http_conn::finish_response()
+{
+    if (m_write_start_ns)
+    {
+        metric_observe(STAGE_WRITE, metric_now_ns() - m_write_start_ns);
+        m_write_start_ns = 0;
     }
+    unmap();
+    release_write_buf();
+    m_write_idx = 0;
+    m_iv_count = 0;
+    m_iv_index = 0;
+    bytes_to_send = 0;
+    return m_keep_alive;
 }
 
-// 往写缓冲中写入一条待发送的数据
-bool http_conn::add_response(const char *format, ...)
+// 追加一段待发送的数据，与上一段相邻时合并
+void http_conn::add_iov(char *base, long len)
 {
-    if (m_write_idx >= WRITE_BUFFER_SIZE)
+    if (len <= 0)
     {
-        return false;
+        return;
+    }
+    bytes_to_send += len;
+    if (m_iv_count > 0)
+    {
+        struct iovec &last = m_iv[m_iv_count - 1];
+        if ((char *)last.iov_base + last.iov_len == base)
+        {
+            last.iov_len += len;
+            return;
+        }
     }
-    va_list arg_list;
-    va_start(arg_list, format);
-    int len = vsnprintf(m_write_buf + m_write_idx, WRITE_BUFFER_SIZE - 1 - m_write_idx, format, arg_list);
-    if (len >= (WRITE_BUFFER_SIZE - 1 - m_write_idx))
+    m_iv[m_iv_count].iov_base = base;
+    m_iv[m_iv_count].iov_len = len;
+    m_iv_count++;
+}
+
+bool http_conn::add_raw(const char *data, int len)
+{
+    if (len > WRITE_BUFFER_SIZE - 1 - m_write_idx)
     {
         return false;
     }
+    memcpy(m_write_buf + m_write_idx, data, len);
     m_write_idx += len;
-    va_end(arg_list);
     return true;
 }
 
+bool http_conn::add_number(long n)
+{
+    char buf[24];
+    int i = sizeof(buf);
+    do
+    {
+        buf[--i] = '0' + n % 10;
+        n /= 10;
+    } while (n > 0);
+    return add_raw(buf + i, sizeof(buf) - i);
+}
+
+// first为负时是416响应的"bytes */size"
+bool http_conn::add_content_range(long first, long last, long size)
+{
+    bool ok = add_str("Content-Range: bytes ");
+    if (first < 0)
+        ok = ok && add_raw("*", 1);
+    else
+        ok = ok && add_number(first) && add_raw("-", 1) && add_number(last);
+    return ok && add_raw("/", 1) && add_number(size) && add_raw("\r\n", 2);
+}
+
 // 写入响应行
+// 每个响应恰好写一次响应行（或复制一次预先生成的响应头块），在这里按状态码计数
 bool http_conn::add_status_line(int status, const char *title)
 {
-    return add_response("%s %d %s\r\n", "HTTP/1.1", status, title);
+    m_status = status;
+    metric_status(status);
+    return add_str("HTTP/1.1 ") && add_number(status) && add_raw(" ", 1) && add_str(title) && add_raw("\r\n", 2);
 }
 
 //写入响应头
-bool http_conn::add_headers(int content_len)
+bool http_conn::add_headers(long content_len, const char *content_type)
+{
+    return add_entity_headers(content_len, content_type) && add_general_headers();
+}
+
+bool http_conn::add_entity_headers(long content_len, const char *content_type)
+{
+    bool ok = true;
+    if (content_len >= 0) // 304响应没有响应体
+    {
+        ok = ok && add_str("Content-Length: ") && add_number(content_len) && add_raw("\r\n", 2);
+        ok = ok && add_str("Content-Type: ") && add_str(content_type) && add_raw("\r\n", 2);
+    }
+    if (m_etag[0])
+    {
+        char date[HTTP_DATE_LEN + 1];
+        format_http_date(m_last_modified, date);
+        ok = ok && add_str("ETag: ") && add_str(m_etag) && add_raw("\r\n", 2);
+        ok = ok && add_str("Last-Modified: ") && add_raw(date, HTTP_DATE_LEN) && add_raw("\r\n", 2);
+        ok = ok && add_str("Accept-Ranges: bytes\r\n");
+    }
+    if (m_gzip)
+        ok = ok && add_str("Content-Encoding: gzip\r\n");
+    if (m_vary)
+        ok = ok && add_str("Vary: Accept-Encoding\r\n");
+    return ok;
+}
+
+// 每个响应都不同的部分：日期由后台线程每秒刷新一次，这里只复制
+bool http_conn::add_general_headers()
+{
+    char date[HTTP_DATE_LEN];
+    http_date::now(date);
+    return add_str("Date: ") && add_raw(date, HTTP_DATE_LEN) && add_str("\r\nConnection: ") &&
+           add_str(m_keep_alive ? "keep-alive\r\n\r\n" : "close\r\n\r\n");
+}
+
+std::atomic<std::string *> *http_conn::header_slot()
 {
-    add_response("Content-Length: %d\r\n", content_len);
-    add_response("Content-Type:%s\r\n", "text/html");
-    add_response("Connection: %s\r\n", (m_headers.find("Connection") != m_headers.end()) ? m_headers["Connection"] : "close");
-    add_response("%s", "\r\n");
+    if (m_gzip_entry)
+        return &m_gzip_entry->headers;
+    if (m_cache_entry)
+        return &m_cache_entry->headers[m_gzip ? 1 : 0];
+    return 0;
+}
+
+// 响应体来自缓存时，响应行到Vary的部分只在第一次发送时生成，之后整块复制；
+// 文件修改后缓存条目失效，新的条目重新生成，所以块中的长度与ETag总是对应当前版本
+void http_conn::add_file_headers()
+{
+    if (m_asset) // 资源包中的响应头块在启动时生成
+    {
+        m_status = 200;
+        metric_status(200);
+        add_raw(m_asset->headers, m_asset->header_len);
+        return;
+    }
+    std::atomic<std::string *> *slot = header_slot();
+    std::string *block = slot ? slot->load(std::memory_order_acquire) : 0;
+    if (block)
+    {
+        m_status = 200;
+        metric_status(200);
+        add_raw(block->data(), block->size());
+        return;
+    }
+    int start = m_write_idx;
+    if (add_status_line(200, ok_200_title) && add_entity_headers(m_file_stat.st_size, m_content_type) && slot)
+    {
+        std::string *built = new std::string(m_write_buf + start, m_write_idx - start);
+        std::string *expected = 0;
+        if (!slot->compare_exchange_strong(expected, built, std::memory_order_acq_rel)) // 其他线程已经生成
+            delete built;
+    }
+}
+
+// 当前请求在内存中的响应体交给这一批响应持有
+response_body &http_conn::hold_body()
+{
+    response_body &body = m_bodies[m_body_count++];
+    body.address = m_file_address;
+    body.size = m_file_stat.st_size;
+    body.entry = m_cache_entry;
+    body.gzip = m_gzip_entry;
+    body.asset = m_asset;
+    m_file_address = 0;
+    m_cache_entry = 0;
+    m_gzip_entry = 0;
+    m_asset = 0;
+    return body;
+}
+
+// 一个区间时直接从文件或内存中的偏移发送；多个区间时生成multipart/byteranges，
+// 分段头写入区间缓冲区，与响应体中的各段交替排列成iovec列表，响应体不复制
+bool http_conn::add_partial(int start)
+{
+    long size = m_file_stat.st_size;
+    add_status_line(206, partial_206_title);
+    if (m_range_count == 1)
+    {
+        const byte_range &r = m_ranges[0];
+        long len = r.last - r.first + 1;
+        add_content_range(r.first, r.last, size);
+        add_headers(len, m_content_type);
+        add_iov(m_write_buf + start, m_write_idx - start);
+        if (m_file_fd >= 0)
+        {
+            m_file_offset = r.first;
+            bytes_to_send += len;
+        }
+        else
+        {
+            response_body &body = hold_body();
+            add_iov(body.address + r.first, len);
+        }
+        return true;
+    }
+
+    m_range_buf = buffer_pool::alloc(RANGE_BUFFER_SIZE);
+    int offsets[MAX_RANGES + 1];
+    int idx = 0;
+    long length = 0;
+    for (int i = 0; i <= m_range_count; ++i)
+    {
+        offsets[i] = idx;
+        int n;
+        if (i < m_range_count)
+            n = snprintf(m_range_buf + idx, RANGE_BUFFER_SIZE - idx, "\r\n--%s\r\nContent-Type: %s\r\nContent-Range: bytes %ld-%ld/%ld\r\n\r\n",
+                         range_boundary.c_str(), m_content_type, m_ranges[i].first, m_ranges[i].last, size);
+        else
+            n = snprintf(m_range_buf + idx, RANGE_BUFFER_SIZE - idx, "\r\n--%s--\r\n", range_boundary.c_str());
+        if (n >= RANGE_BUFFER_SIZE - idx)
+        {
+            return false;
+        }
+        idx += n;
+        length += n + (i < m_range_count ? m_ranges[i].last - m_ranges[i].first + 1 : 0);
+    }
+    add_headers(length, multipart_type.c_str());
+    add_iov(m_write_buf + start, m_write_idx - start);
+
+    response_body &body = hold_body();
+    for (int i = 0; i < m_range_count; ++i)
+    {
+        add_iov(m_range_buf + offsets[i], offsets[i + 1] - offsets[i]);
+        add_iov(body.address + m_ranges[i].first, m_ranges[i].last - m_ranges[i].first + 1);
+    }
+    add_iov(m_range_buf + offsets[m_range_count], idx - offsets[m_range_count]);
     return true;
 }
 
-// 生成HTTP应答，并写入写缓冲区
+// 生成HTTP应答，追加到这一批响应之后
 bool http_conn::process_write(HTTP_CODE request_stat)
 {
+    if (!m_write_buf)
+    {
+        m_write_buf = buffer_pool::alloc(WRITE_BUFFER_SIZE);
+    }
+    int start = m_write_idx;
+    // 请求格式错误或上传没有读完请求体时无法确定下一个请求从哪里开始，响应后关闭连接
+    bool body_read = m_method == GET || request_stat == UPLOAD_CREATED || request_stat == UPLOAD_REPLACED;
+    m_keep_alive = request_stat != BAD_REQUEST && body_read && view_ieq(m_known[HEADER_CONNECTION], "keep-alive");
+    if (request_stat != FILE_REQUEST && request_stat != NOT_MODIFIED) // 错误页面不压缩，也没有ETag
+    {
+        m_gzip = false;
+        m_vary = false;
+        m_etag[0] = '\0';
+    }
+
     switch (request_stat)
     {
     case FILE_REQUEST:
-        add_status_line(200, ok_200_title);
-        add_headers(m_file_stat.st_size);
-        m_iv[0].iov_base = m_write_buf;
-        m_iv[0].iov_len = m_write_idx;
-        m_iv[1].iov_base = m_file_address;
-        m_iv[1].iov_len = m_file_stat.st_size;
-        m_iv_count = 2;
-        bytes_to_send = m_write_idx + m_file_stat.st_size;
+        if (m_range_count > 0)
+        {
+            return add_partial(start);
+        }
+        add_file_headers();
+        add_general_headers();
+        add_iov(m_write_buf + start, m_write_idx - start);
+        if (m_file_fd >= 0) // 响应体由sendfile发送
+        {
+            bytes_to_send += m_file_stat.st_size;
+        }
+        else
+        {
+            response_body &body = hold_body();
+            add_iov(body.address, body.address ? body.size : 0);
+        }
         return true;
+    case RANGE_NOT_SATISFIABLE:
+        add_status_line(416, error_416_title);
+        add_content_range(-1, -1, m_file_stat.st_size);
+        add_headers(strlen(error_416_form));
+        add_str(error_416_form);
+        break;
+    case NOT_MODIFIED:
+        add_status_line(304, not_modified_304_title);
+        add_headers(-1);
+        break;
     case INTERNAL_ERROR:
         add_status_line(500, error_500_title);
         add_headers(strlen(error_500_form));
-        add_response("%s", error_500_form);
+        add_str(error_500_form);
         break;
     case BAD_REQUEST:
         add_status_line(400, error_400_title);
         add_headers(strlen(error_400_form));
-        add_response("%s", error_400_form);
+        add_str(error_400_form);
         break;
     case NO_RESOURCE:
         add_status_line(404, error_404_title);
         add_headers(strlen(error_404_form));
-        add_response("%s", error_404_form);
+        add_str(error_404_form);
         break;
     case FORBIDDEN_REQUEST:
         add_status_line(403, error_403_title);
         add_headers(strlen(error_403_form));
-        add_response("%s", error_403_form);
+        add_str(error_403_form);
+        break;
+    case UPLOAD_CREATED:
+        add_status_line(201, created_201_title);
+        add_str("Location: ") && add_str(m_url) && add_raw("\r\n", 2);
+        add_headers(strlen(created_201_form));
+        add_str(created_201_form);
+        break;
+    case UPLOAD_REPLACED:
+        add_status_line(204, no_content_204_title);
+        add_headers(-1);
+        break;
+    case METHOD_NOT_ALLOWED:
+        add_status_line(405, error_405_title);
+        add_str("Allow: GET\r\n");
+        add_headers(strlen(error_405_form));
+        add_str(error_405_form);
+        break;
+    case LENGTH_REQUIRED:
+        add_status_line(411, error_411_title);
+        add_headers(strlen(error_411_form));
+        add_str(error_411_form);
+        break;
+    case PAYLOAD_TOO_LARGE:
+        add_status_line(413, error_413_title);
+        add_headers(strlen(error_413_form));
+        add_str(error_413_form);
         break;
     default:
         return false;
     }
-    m_iv[0].iov_base = m_write_buf;
-    m_iv[0].iov_len = m_write_idx;
-    m_iv_count = 1;
-    bytes_to_send = m_write_idx;
+    add_iov(m_write_buf + start, m_write_idx - start);
     return true;
 }
 
 // 由线程池中的工作线程调用，这是处理HTTP请求的入口函数
 void http_conn::process()
 {
-    // 解析HTTP请求
-    HTTP_CODE read_ret = process_read();
-    if (read_ret == NO_REQUEST)
+    while (process_batch()) // 一批响应直接发送完毕后接着处理流水线中剩下的请求
+        ;
+}
+
+// 读缓冲区中流水线发来的多个完整请求依次生成响应，合并成一批一起发送
+bool http_conn::process_batch()
+{
+    long queue_ns = 0; // 只记入这一批的第一个请求
+    if (m_queued_ns)
     {
-        modify_fd(m_epoll_fd, m_sockfd, EPOLLIN);
-        return;
+        queue_ns = metric_now_ns() - m_queued_ns;
+        metric_observe(STAGE_QUEUE, queue_ns);
+        event_backend::record_queue_delay(queue_ns);
+        m_queued_ns = 0;
+    }
+    // 以连接前言开始的连接直接使用HTTP/2
+    int preface = m_h2 ? 1 : h2_preface();
+    if (preface == 0)
+    {
+        set_deadline(TIMEOUT_HEADER);
+        m_backend->want_read(this);
+        return false;
+    }
+    if (preface > 0)
+    {
+        if (!m_h2)
+        {
+            start_h2(false);
+        }
+        return process_h2();
     }
+    int responses = 0;
+    while (true)
+    {
+        // 解析HTTP请求
+        long parse_start = metric_now_ns();
+        bool resumed = m_upload != 0; // 上一次没有收完请求体的上传
+        HTTP_CODE read_ret = resumed ? receive_upload() : process_read();
+        if (read_ret == NO_REQUEST)
+        {
+            break;
+        }
+        long parse_end = metric_now_ns();
+        if (!resumed)
+        {
+            io_stat_add(STAT_REQUESTS);
+            metric_observe(STAGE_READ, parse_end - parse_start);
+        }
+        if (read_ret == GET_REQUEST && h2_upgrade_requested() && start_h2(true)) // 升级请求已经作为流1回答
+        {
+            return process_h2();
+        }
+        if (read_ret == GET_REQUEST)
+        {
+            read_ret = do_request();
+            metric_observe(STAGE_REQUEST, metric_now_ns() - parse_end);
+            if (read_ret == NO_REQUEST) // 请求体还没有全部到达，可读时继续
+                break;
+        }
 
-    // 生成响应
-    bool write_ret = process_write(read_ret);
-    if (!write_ret)
+        // 生成响应
+        long queued_bytes = bytes_to_send;
+        if (!process_write(read_ret))
+        {
+            close_conn();
+            return false;
+        }
+        if (m_access_log)
+        {
+            m_access_log->log(m_address, m_url ? method_names[m_method] : "-", m_url, m_status, bytes_to_send - queued_bytes,
+                              queue_ns, metric_now_ns() - parse_start);
+            queue_ns = 0;
+        }
+        next_request();
+
+        // 无法再合并时先发送这一批，剩下的请求在发送完后处理
+        if (++responses >= MAX_PIPELINE || !m_keep_alive || m_file_fd >= 0 || m_range_buf || WRITE_BUFFER_SIZE - m_write_idx < RESPONSE_RESERVE)
+        {
+            break;
+        }
+    }
+    compact_read_buf();
+    if (m_read_idx == 0) // 保持连接等待下一个请求时不占用读缓冲区
     {
-        close_conn();
+        release_read_buf();
     }
-    modify_fd(m_epoll_fd, m_sockfd, EPOLLOUT);
-}
\ No newline at end of file
+
+    if (responses == 0)
+    {
+        set_deadline(m_check_state == CHECK_STATE_CONTENT || m_upload ? TIMEOUT_BODY : TIMEOUT_HEADER);
+        m_backend->want_read(this);
+        return false;
+    }
+    return send_response();
+}
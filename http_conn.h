@@ -14,33 +14,125 @@
 #include <string.h>
 #include <string>
 #include <map>
-#include <unordered_map>
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <sys/mman.h>
-#include <stdarg.h>
 #include <errno.h>
 #include <sys/uio.h>
+#include <sys/sendfile.h>
+#include <sys/random.h>
+#include <time.h>
+#include <algorithm>
+#include <atomic>
+#include "file_cache.h"
+#include "gzip_cache.h"
+#include "http_scan.h"
+#include "event_backend.h"
+#include "io_stats.h"
+#include "mem_pool.h"
+#include "mime_types.h"
+#include "http_date.h"
+#include "metrics.h"
+#include "access_log.h"
+#include "asset_pack.h"
 
 #define MAX_FILENAME_LEN 200   // 文件名的最大长度
-#define READ_BUFFER_SIZE 2048  // 读缓冲区的大小
-#define WRITE_BUFFER_SIZE 2048 // 写缓冲区的大小
+#define READ_BUFFER_SIZE 2048  // 读缓冲区的大小，只在读到请求数据时从缓冲区池中取得
+#define WRITE_BUFFER_SIZE 2048 // 写缓冲区的大小，只在生成响应时从缓冲区池中取得
+#define MAX_PIPELINE 16        // 流水线请求一次批量发送的最多响应数
+#define RESPONSE_RESERVE 512   // 写缓冲区剩余空间少于该值时不再继续生成响应
+#define RANGE_BUFFER_SIZE 2048 // 存放multipart/byteranges各段分段头的缓冲区大小
+#define MAX_IOV (2 * MAX_PIPELINE + 2 * MAX_RANGES + 2) // 一批响应最多的待发送数据段数
+#define SENDFILE_THRESHOLD (64 << 10) // 不小于该大小的文件用sendfile发送
+#define HEADER_TIMEOUT 20    // 从连接建立或请求的第一个字节开始，读完请求头的期限（秒）
+#define BODY_TIMEOUT 30      // 读取请求体时两次读之间的最长间隔（秒）
+#define KEEPALIVE_TIMEOUT 15 // 保持连接时等待下一个请求的最长时间（秒）
+#define WRITE_TIMEOUT 60     // 发送响应时没有任何进展的最长时间（秒）
+
+struct h2_session;
+struct h2_stream;
+struct upload_state;
+
+// 已经生成、等待发送完毕后释放的响应体
+struct response_body
+{
+    char *address;      // 文件映射的位置（或缓存中的内容）
+    long size;          // 映射的大小
+    cache_entry *entry; // 来自缓存时持有的条目
+    gzip_entry *gzip;   // 来自压缩缓存时持有的条目
+    const asset_variant *asset; // 来自资源包时指向的表示，不需要释放
+};
+
+void release_body(const response_body &body); // 解除映射或归还缓存条目
+
+// epoll后端使用的注册函数
+void add_fd(int epoll_fd, int fd);
+void remove_fd(int epoll_fd, int fd);
+void modify_fd(int epoll_fd, int fd, int ev);
 
 class http_conn
 {
 public:
-    static int m_epoll_fd;   // epoll描述符
-    static int m_user_count; // 用户数
+    enum TIMEOUT_KIND
+    {
+        TIMEOUT_HEADER,
+        TIMEOUT_BODY,
+        TIMEOUT_IDLE,
+        TIMEOUT_WRITE,
+        TIMEOUT_NUM
+    };
+
+    static std::atomic<int> m_user_count; // 用户数，由各反应堆与工作线程共同修改
+    static file_cache *m_file_cache;      // 共享的静态文件缓存，为NULL时不使用缓存
+    static gzip_cache *m_gzip_cache;      // 运行时压缩结果的缓存，为NULL时只使用预先压缩的.gz文件
+    static access_log *m_access_log;      // 访问日志，为NULL时不记录
+    static asset_pack *m_asset_pack;      // 启动时读入的资源包，为NULL时每个请求都查找文件系统或缓存
+    static long m_sendfile_threshold;     // 文件不小于该大小时用sendfile发送，0表示总是使用mmap
+    static int m_timeouts[TIMEOUT_NUM];   // 各种超时的秒数，0表示不超时
+    static char m_upload_dir[MAX_FILENAME_LEN]; // 接受PUT/POST上传的目录（如"/upload"），为空时不接受上传
+    static long m_upload_max;             // 一个上传请求体的最大字节数
 
-    http_conn() {}
+    http_conn() : m_sockfd(-1), m_read_buf(0), m_read_size(READ_BUFFER_SIZE), m_write_buf(0), m_range_buf(0), m_h2(0), m_upload(0), m_queued_ns(0), m_write_start_ns(0), m_deadline(0), m_timer_gen(0), m_pool_node(0) {}
     ~http_conn() {}
 
-    void init(int sockfd, const sockaddr_in &addr); // 初始化新接受的连接
-    void close_conn();                              // 关闭连接
-    void process();                                 // 处理客户端请求
-    bool read();                                    // 接受数据
-    bool write();                                   // 发送数据
+    static http_conn *create(); // 从连接对象池中取出一个对象，close_conn时归还
+    void init(int sockfd, const sockaddr_in &addr, event_backend *backend); // 初始化新接受的连接
+    void close_conn();                                                     // 关闭连接
+    void finish_close();                                                   // 释放缓冲区与响应体并归还连接对象，内核仍在发送时由事件后端在发送结束后调用
+    void process();                                                        // 处理客户端请求
+    bool read();                                                           // 接受数据
+    bool write();                                                          // 发送数据
+    void reject_overload();                                                // 过载时发送预先生成的503响应并关闭连接
+    static void reject(int fd, const sockaddr_in &addr);                   // 准入控制拒绝的新连接：发送503后关闭
+
+    // 供由内核完成读写的事件后端（io_uring）使用
+    int sockfd() const { return m_sockfd; }
+    int read_space() const { return m_read_size - m_read_idx; }    // 读缓冲区剩余空间
+    bool receive(const char *data, int len);                         // 放入后端读到的数据
+    bool body_in_file() const { return m_file_fd >= 0; }             // 最后一个响应体需要用sendfile发送
+    bool body_streaming() const { return m_upload != 0; }            // 请求体由工作线程直接从套接字splice到文件，后端只等待可读，不读取数据
+    struct msghdr *pending_msg();                                    // 尚未发送的内存数据，不包括sendfile发送的部分
+    long remaining() const { return bytes_to_send; }                 // 尚未发送的字节数
+    void advance(long sent);                                         // 事件后端完成一次发送：记录已发送的字节，刷新发送超时
+    bool finish_response();                                          // 一批响应发送完毕，保持连接时返回true；不设置截止时间
+    bool has_buffered_request() const;                               // 读缓冲区中还有流水线发来的请求数据，或HTTP/2还有可以发送的帧
+    bool can_run_inline();                                           // 缓冲的请求都已完整到达且命中内存中的文件，可以在反应堆线程上直接回答
+
+    // 超时：截止时间随读写活动更新，由所属事件后端的时间轮检查
+    long deadline() const { return m_deadline.load(std::memory_order_acquire); }
+    unsigned timer_gen() const { return m_timer_gen.load(std::memory_order_acquire); }
+    void set_busy() // 交给工作线程，处理期间不超时；记下时刻以统计排队时间
+    {
+        m_deadline.store(0, std::memory_order_release);
+        m_queued_ns = metric_now_ns();
+    }
+    // 按超时种类更新截止时间；工作线程只在交还给事件后端（want_read/want_write）之前调用，
+    // 否则定时器可能在处理期间关闭连接
+    void set_deadline(TIMEOUT_KIND kind);
+
+    static const char *doc_root(); // Web资源目录的绝对路径
 
 private:
     enum HTTP_REQUEST // HTTP请求
@@ -70,7 +162,14 @@ private:
         NO_RESOURCE,       //没有资源
         FORBIDDEN_REQUEST, //无权限
         FILE_REQUEST,      //成功获取文件
+        NOT_MODIFIED,      //客户端缓存的文件仍然有效
+        RANGE_NOT_SATISFIABLE, //请求的区间都超出了文件
         INTERNAL_ERROR,    //内部错误
+        UPLOAD_CREATED,    //上传完毕，创建了新文件
+        UPLOAD_REPLACED,   //上传完毕，替换了原有的文件
+        METHOD_NOT_ALLOWED, //不在上传目录中的PUT/POST
+        LENGTH_REQUIRED,   //上传既没有Content-Length也不是分块的
+        PAYLOAD_TOO_LARGE, //请求体超过上限
         CLOSED_CONNECTION  //关闭连接
     };
 
@@ -81,50 +180,147 @@ private:
         LINE_OPEN //行不完整
     };
 
+    enum SEND_STATUS
+    {
+        SEND_DONE,    //全部发送完毕
+        SEND_BLOCKED, //套接字发送缓冲区已满
+        SEND_ERROR    //连接出错，响应体已经释放
+    };
+
     void reset();                      // 重置连接状态
+    void release_read_buf();           // 读缓冲区中没有数据时归还给缓冲区池
+    void release_write_buf();          // 一批响应发送完毕后归还写缓冲区
+    void next_request();               // 一个请求处理完毕，准备解析读缓冲区中的下一个请求
+    void compact_read_buf();           // 把未处理的数据移到读缓冲区开头
     HTTP_CODE process_read();          // 解析HTTP请求
     bool process_write(HTTP_CODE ret); // 将HTTP响应写入写缓冲区
+    bool process_batch();              // 生成并发送一批响应，直接发送完毕且读缓冲区中还有数据时返回true
+    SEND_STATUS send_pending();        // 发送到完成或者套接字发送缓冲区满为止
+    void consume(long sent);           // 记录已发送的字节并调整待发送数据
+    bool send_response();              // 在生成响应的线程上直接发送，没有发完时才等待可写；返回值同process_batch
 
     // 读
     char *get_line() { return m_read_buf + m_start_line; }
     LINE_STATUS parse_line();
-    HTTP_CODE parse_request_line(char *text);
-    HTTP_CODE parse_headers(char *text);
+    HTTP_CODE parse_request_line(char *text, char *end);
+    HTTP_CODE parse_headers(char *text, char *end);
     HTTP_CODE parse_content(char *text);
     HTTP_CODE do_request(); // 将请求的文件映射到内存
+    bool resident_request(const char *text, const char *end); // [text, end)是一个请求的请求行和请求头，回答它不需要文件系统与压缩
+    HTTP_CODE metrics_request(); // 生成/metrics的响应体
+    HTTP_CODE open_file(const char *key, const char *path); // 按m_file_stat打开文件：sendfile、读入缓存或映射到内存
+    bool use_gzip(const char *key, const char *path);       // 客户端接受gzip时换成压缩后的内容，成功时返回true
+    bool open_gzip_sibling(const char *key, const char *path); // 使用预先压缩的同名.gz文件
+    bool not_modified(bool gzip_ok);                         // 按If-None-Match或If-Modified-Since判断是否可以回答304
+    bool if_range_matches();                                 // 没有If-Range或者它与文件的ETag/修改时间一致
+    int resolve_ranges(long size);                           // 按文件大小换算区间并去掉无法满足的，返回剩下的个数
 
     // 写
     void unmap();
-    bool add_response(const char *format, ...);
+    void add_iov(char *base, long len);
+    bool add_raw(const char *data, int len); // 直接复制，不经过格式化
+    bool add_str(const char *s) { return add_raw(s, strlen(s)); }
+    bool add_number(long n);
+    bool add_content_range(long first, long last, long size);
     bool add_status_line(int status, const char *title);
-    bool add_headers(int content_length);
+    bool add_headers(long content_length, const char *content_type = "text/html");
+    bool add_entity_headers(long content_length, const char *content_type); // 只与文件有关的响应头
+    bool add_general_headers();                                           // Date、Connection与结束的空行
+    void add_file_headers();                    // 200响应的响应行与文件的响应头，同一版本的文件只生成一次
+    std::atomic<std::string *> *header_slot(); // 当前响应体所在的缓存条目中存放响应头块的位置，没有时为NULL
+    bool add_partial(int start); // 生成206响应
+
+    // 上传（upload.cpp）
+    HTTP_CODE start_upload(const char *key); // 检查上传目标并创建临时文件，然后开始接收请求体
+    HTTP_CODE receive_upload();              // 继续接收请求体，返回NO_REQUEST表示等待更多数据；结束时释放上传状态
+    HTTP_CODE splice_upload();               // 按Content-Length或分块格式搬运请求体，收完后把临时文件改名为目标文件
+    int read_chunk_line();                   // 从套接字取出至多一行格式数据放入读缓冲区：1取到了数据，0暂时没有数据，-1出错
+    void free_upload();
+
+    // HTTP/2（http2.cpp）
+    int h2_preface() const;            // 读缓冲区开头是否为连接前言：1是，0还不能确定，-1不是
+    bool h2_upgrade_requested() const; // 请求带有Upgrade: h2c与HTTP2-Settings
+    bool start_h2(bool upgrade);       // 切换为HTTP/2，升级时先回答101；HTTP2-Settings无效时不升级，返回false
+    bool h2_apply_upgrade();           // 应用HTTP2-Settings中的设置，格式错误时返回false
+    bool process_h2();                 // 处理读缓冲区中完整的帧，生成并发送这一批帧；返回值同process_batch
+    bool h2_frame(int type, int flags, uint32_t id, const unsigned char *p, int len); // 出现连接错误时返回false
+    bool h2_settings(const unsigned char *p, int len);
+    bool h2_headers_done();
+    void h2_respond(h2_stream *st, HTTP_CODE ret); // 生成一个流的响应
+    void h2_fill();                                // 在窗口和缓冲区允许的范围内轮流发送各个流的帧
+    void h2_send_headers(h2_stream *st);
+    bool h2_finish_stream(h2_stream *st);          // 响应体交给这一批响应持有，空间不够时返回false
+    void h2_put_frame(int type, int flags, uint32_t id, const void *payload, int len);
+    bool h2_goaway(int error);                     // 发送GOAWAY，总是返回false
+    void h2_rst(uint32_t id, int error);
+    void h2_close_stream(h2_stream *st);
+    void h2_flush_out();                           // 写缓冲区中新生成的帧加入待发送数据
+    h2_stream *h2_find(uint32_t id);
+    bool h2_was_reset(uint32_t id);                // 已关闭的流是否由本端重置
+    void free_h2();
 
+    event_backend *m_backend; // 所属的事件后端
     int m_sockfd;          // 连接的socket
     sockaddr_in m_address; // 连接的地址
 
-    char m_read_buf[READ_BUFFER_SIZE]; // 读缓冲区
+    char *m_read_buf;                  // 读缓冲区，空闲时为NULL
+    int m_read_size;                   // 读缓冲区的大小，HTTP/2连接更大
     int m_read_idx;                    // 已读入缓冲区的位置
     int m_checked_idx;                 // 解析到的位置
     int m_start_line;                  // 当前行的起始位置
+    int m_request_start;               // 当前请求的起始位置
 
     CHECK_STATE m_check_state; // 主状态机当前所处的状态
 
-    HTTP_REQUEST m_method;                                  // 请求方法
-    char *m_version;                                        // HTTP版本号
-    char m_real_file[MAX_FILENAME_LEN];                     // 请求的文件路径
-    char *m_url;                                            // 请求的文件名
-    std::unordered_map<std::string, std::string> m_headers; // 请求头
-    char *m_content;                                        // 请求体
-
-    char m_write_buf[WRITE_BUFFER_SIZE]; // 写缓冲区
-    int m_write_idx;                     // 写缓冲区已写入的字节数
-    char *m_file_address;                // 目标文件映射的位置
-    struct stat m_file_stat;             // 目标文件的状态
-    struct iovec m_iv[2];                // 待发送数据，m_iv[0]为HTTP响应行与响应头，m_iv[1]为响应体
-    int m_iv_count;                      // 带发送数据的数量
-
-    int bytes_to_send;   // 将要发送的数据的字节数
-    int bytes_have_send; // 已经发送的字节数
+    HTTP_REQUEST m_method;                       // 请求方法
+    char *m_version;                             // HTTP版本号
+    const char *m_url;                           // 请求的文件名
+    header_field m_header_fields[MAX_HEADERS];   // 请求头，名字和值都指向读缓冲区
+    int m_header_count;                          // 请求头的个数
+    str_view m_known[HEADER_NUM];                // 已识别的请求头的值，未出现时data为NULL
+    long m_content_length;                       // 请求体的长度
+    char *m_content;                             // 请求体（长度由Content-Length给出，不以'\0'结尾）
+    bool m_keep_alive;                           // 当前请求的响应发送后是否保持连接
+    bool m_gzip;                                 // 当前请求的响应体是gzip压缩后的内容
+    bool m_vary;                                 // 响应随Accept-Encoding变化（可压缩的类型）
+    const char *m_content_type;                  // 按扩展名确定的Content-Type
+    char m_etag[64];                             // 文件的强ETag（带引号），为空时不发送ETag和Last-Modified
+    time_t m_last_modified;                      // 文件的修改时间
+    byte_range m_ranges[MAX_RANGES];             // Range请求的区间，do_request之后换算为文件中的[first, last]
+    int m_range_count;                           // 区间个数，0表示请求整个文件
+    int m_status;                                // 当前响应的状态码
+
+    response_body &hold_body(); // 当前请求的响应体交给这一批响应持有，直到发送完毕
+
+    char *m_write_buf;                    // 写缓冲区，依次存放一批响应的响应行与响应头，没有响应时为NULL
+    char *m_range_buf;                    // multipart/byteranges的分段头，一批中只能是最后一个响应
+    int m_write_idx;                      // 写缓冲区已写入的字节数
+    char *m_file_address;                 // 当前请求的文件映射的位置（或缓存中的内容）
+    cache_entry *m_cache_entry;           // 当前请求命中缓存时持有的条目
+    gzip_entry *m_gzip_entry;             // 当前请求使用运行时压缩的内容时持有的条目
+    const asset_variant *m_asset;         // 当前请求命中资源包时使用的表示
+    int m_file_fd;                        // 用sendfile发送时打开的文件，否则为-1；只能是一批中的最后一个响应
+    off_t m_file_offset;                  // 文件中下一个要发送的位置
+    struct stat m_file_stat;              // 当前请求的文件的状态
+    response_body m_bodies[MAX_PIPELINE]; // 一批响应持有的响应体，全部发送后释放
+    int m_body_count;
+    struct iovec m_iv[MAX_IOV];           // 待发送数据，响应头与内存中的响应体依次排列
+    int m_iv_count;                       // 待发送数据的数量
+    int m_iv_index;                       // 第一段还没有发送完的数据
+    struct msghdr m_msg;
+
+    long bytes_to_send; // 将要发送的数据的字节数
+
+    h2_session *m_h2; // HTTP/2连接的状态，HTTP/1.1时为NULL
+    upload_state *m_upload; // 正在接收请求体的上传，没有时为NULL
+
+    long m_queued_ns;      // 交给线程池的时刻（单调时钟纳秒），0表示不在队列中
+    long m_write_start_ns; // 这一批响应生成完毕、开始发送的时刻
+
+    std::atomic<long> m_deadline;      // 超时的时刻（单调时钟毫秒），0表示正在由工作线程处理
+    std::atomic<unsigned> m_timer_gen; // 每次初始化加一，时间轮据此识别被复用的连接
+    long m_request_deadline;           // 当前请求头的截止时间，0表示还没有开始读请求
+    int m_pool_node;                   // 对象所属的NUMA节点的对象池
 };
 
 #endif
\ No newline at end of file
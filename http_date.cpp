@@ -0,0 +1,129 @@
+#include "http_date.h"
+#include <string.h>
+
+std::atomic<char> http_date::m_buf[HTTP_DATE_LEN];
+std::atomic<unsigned> http_date::m_seq(0);
+pthread_once_t http_date::m_once = PTHREAD_ONCE_INIT;
+
+static const char *week_days[] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+static const char *month_names[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+
+// 把v的低width位十进制数字写到p，不足补0
+static char *put_digits(char *p, unsigned v, int width)
+{
+    for (int i = width - 1; i >= 0; --i)
+    {
+        p[i] = '0' + v % 10;
+        v /= 10;
+    }
+    return p + width;
+}
+
+// 不依赖locale；每个字段都按固定宽度写入，输出恰好HTTP_DATE_LEN字节
+void format_http_date(time_t t, char *out)
+{
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    char *p = out;
+    memcpy(p, week_days[tm.tm_wday], 3);
+    p += 3;
+    *p++ = ',';
+    *p++ = ' ';
+    p = put_digits(p, tm.tm_mday, 2);
+    *p++ = ' ';
+    memcpy(p, month_names[tm.tm_mon], 3);
+    p += 3;
+    *p++ = ' ';
+    p = put_digits(p, tm.tm_year + 1900, 4);
+    *p++ = ' ';
+    p = put_digits(p, tm.tm_hour, 2);
+    *p++ = ':';
+    p = put_digits(p, tm.tm_min, 2);
+    *p++ = ':';
+    p = put_digits(p, tm.tm_sec, 2);
+    memcpy(p, " GMT", 5);
+}
+
+// 把v写成不带前导0的小写十六进制
+static char *put_hex(char *p, unsigned long long v)
+{
+    char tmp[16];
+    int n = 0;
+    do
+    {
+        tmp[n++] = "0123456789abcdef"[v & 15];
+        v >>= 4;
+    } while (v);
+    while (n > 0)
+        *p++ = tmp[--n];
+    return p;
+}
+
+// "inode-大小-纳秒级修改时间"，三部分都是十六进制
+void format_etag(const struct stat &st, char *out, size_t len)
+{
+    if (len == 0)
+    {
+        return;
+    }
+    char buf[HTTP_ETAG_LEN];
+    char *p = buf;
+    *p++ = '"';
+    p = put_hex(p, (unsigned long)st.st_ino);
+    *p++ = '-';
+    p = put_hex(p, (unsigned long)st.st_size);
+    *p++ = '-';
+    p = put_hex(p, (unsigned long long)st.st_mtim.tv_sec * 1000000000ULL + st.st_mtim.tv_nsec);
+    *p++ = '"';
+    size_t n = p - buf < (long)len ? p - buf : len - 1;
+    memcpy(out, buf, n);
+    out[n] = '\0';
+}
+
+void http_date::refresh()
+{
+    char buf[HTTP_DATE_LEN + 1];
+    format_http_date(time(0), buf);
+    m_seq.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (int i = 0; i < HTTP_DATE_LEN; ++i)
+        m_buf[i].store(buf[i], std::memory_order_relaxed);
+    m_seq.fetch_add(1, std::memory_order_release);
+}
+
+// 睡到下一秒开始时刷新
+void *http_date::refresh_func(void *arg)
+{
+    while (true)
+    {
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        struct timespec next = {now.tv_sec + 1, 0};
+        clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &next, 0);
+        refresh();
+    }
+    return arg;
+}
+
+void http_date::start()
+{
+    refresh();
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, refresh_func, NULL) == 0)
+    {
+        pthread_detach(tid);
+    }
+}
+
+void http_date::now(char *out)
+{
+    pthread_once(&m_once, start);
+    unsigned seq;
+    do
+    {
+        seq = m_seq.load(std::memory_order_acquire);
+        for (int i = 0; i < HTTP_DATE_LEN; ++i)
+            out[i] = m_buf[i].load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+    } while ((seq & 1) || seq != m_seq.load(std::memory_order_relaxed));
+}
@@ -0,0 +1,36 @@
+#ifndef HTTP_DATE_H
+#define HTTP_DATE_H
+
+#include <stddef.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <atomic>
+
+#define HTTP_DATE_LEN 29 // "Sun, 06 Nov 1994 08:49:37 GMT"的长度
+
+#define HTTP_ETAG_LEN 52 // format_etag生成的ETag的最大长度，不含'\0'
+
+// 把时间格式化为HTTP日期（IMF-fixdate），out至少HTTP_DATE_LEN + 1字节
+void format_http_date(time_t t, char *out);
+// 按文件的inode、大小和修改时间生成强ETag（带引号），资源包与文件系统路径使用同一格式；
+// len不足时截断，与snprintf相同
+void format_etag(const struct stat &st, char *out, size_t len);
+
+// 所有线程共享的当前时间字符串，由后台线程在每秒开始时刷新一次，响应只复制不格式化
+class http_date
+{
+public:
+    static void now(char *out); // 复制当前的日期字符串（HTTP_DATE_LEN字节，不以'\0'结尾）
+
+private:
+    static void start();
+    static void *refresh_func(void *arg);
+    static void refresh();
+
+    static std::atomic<char> m_buf[HTTP_DATE_LEN];
+    static std::atomic<unsigned> m_seq; // 顺序锁：写者在修改前后各加一，奇数表示正在修改
+    static pthread_once_t m_once;
+};
+
+#endif
@@ -0,0 +1,373 @@
+#include "http_scan.h"
+#include <limits.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && !defined(HTTP_SCAN_NO_SIMD)
+#include <immintrin.h>
+#define HTTP_SCAN_X86
+#endif
+
+static const char *find_either_scalar(const char *p, const char *end, char a, char b)
+{
+    for (; p < end; ++p)
+    {
+        if (*p == a || *p == b)
+            return p;
+    }
+    return end;
+}
+
+#ifdef HTTP_SCAN_X86
+static const char *find_either_sse2(const char *p, const char *end, char a, char b)
+{
+    const __m128i va = _mm_set1_epi8(a);
+    const __m128i vb = _mm_set1_epi8(b);
+    for (; end - p >= 16; p += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb)));
+        if (mask)
+            return p + __builtin_ctz(mask);
+    }
+    return find_either_scalar(p, end, a, b);
+}
+
+__attribute__((target("avx2"))) static const char *find_either_avx2(const char *p, const char *end, char a, char b)
+{
+    const __m256i va = _mm256_set1_epi8(a);
+    const __m256i vb = _mm256_set1_epi8(b);
+    for (; end - p >= 32; p += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)p);
+        unsigned mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, va), _mm256_cmpeq_epi8(v, vb)));
+        if (mask)
+            return p + __builtin_ctz(mask);
+    }
+    return find_either_sse2(p, end, a, b);
+}
+#endif
+
+typedef const char *(*find_either_fn)(const char *, const char *, char, char);
+
+// 启动时按CPU支持的指令集选择一次
+static find_either_fn select_find_either(const char **name)
+{
+#ifdef HTTP_SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        *name = "avx2";
+        return find_either_avx2;
+    }
+    *name = "sse2";
+    return find_either_sse2;
+#else
+    *name = "scalar";
+    return find_either_scalar;
+#endif
+}
+
+static const char *find_either_name = "scalar";
+static const find_either_fn find_either_impl = select_find_either(&find_either_name);
+
+const char *find_either(const char *p, const char *end, char a, char b)
+{
+    return find_either_impl(p, end, a, b);
+}
+
+const char *http_scan_impl()
+{
+    return find_either_name;
+}
+
+// 不区分大小写的FNV-1a；请求头名只含字母、数字和'-'，或上0x20即可统一大小写
+static constexpr unsigned header_hash(const char *s, unsigned h = 2166136261u)
+{
+    return *s ? header_hash(s + 1, (h ^ (unsigned char)(*s | 0x20)) * 16777619u) : h;
+}
+
+static unsigned header_hash(const char *s, int len)
+{
+    unsigned h = 2166136261u;
+    for (int i = 0; i < len; ++i)
+        h = (h ^ (unsigned char)(s[i] | 0x20)) * 16777619u;
+    return h;
+}
+
+static const char *known_header_names[HEADER_NUM] = {"Connection", "Content-Length", "Host", "Accept-Encoding", "If-None-Match", "If-Modified-Since", "Range", "If-Range", "Upgrade", "HTTP2-Settings", "Transfer-Encoding", "Expect"};
+
+int known_header(const char *name, int len)
+{
+    int id;
+    switch (header_hash(name, len))
+    {
+    case header_hash("connection"):
+        id = HEADER_CONNECTION;
+        break;
+    case header_hash("content-length"):
+        id = HEADER_CONTENT_LENGTH;
+        break;
+    case header_hash("host"):
+        id = HEADER_HOST;
+        break;
+    case header_hash("accept-encoding"):
+        id = HEADER_ACCEPT_ENCODING;
+        break;
+    case header_hash("if-none-match"):
+        id = HEADER_IF_NONE_MATCH;
+        break;
+    case header_hash("if-modified-since"):
+        id = HEADER_IF_MODIFIED_SINCE;
+        break;
+    case header_hash("range"):
+        id = HEADER_RANGE;
+        break;
+    case header_hash("if-range"):
+        id = HEADER_IF_RANGE;
+        break;
+    case header_hash("upgrade"):
+        id = HEADER_UPGRADE;
+        break;
+    case header_hash("http2-settings"):
+        id = HEADER_HTTP2_SETTINGS;
+        break;
+    case header_hash("transfer-encoding"):
+        id = HEADER_TRANSFER_ENCODING;
+        break;
+    case header_hash("expect"):
+        id = HEADER_EXPECT;
+        break;
+    default:
+        return -1;
+    }
+    // 哈希相同的其他名字
+    if ((size_t)len != strlen(known_header_names[id]) || strncasecmp(name, known_header_names[id], len) != 0)
+        return -1;
+    return id;
+}
+
+bool parse_length(const str_view &v, long *out)
+{
+    if (v.len <= 0)
+    {
+        return false;
+    }
+    long value = 0;
+    for (int i = 0; i < v.len; ++i)
+    {
+        if (v.data[i] < '0' || v.data[i] > '9')
+            return false;
+        int digit = v.data[i] - '0';
+        if (value > (LONG_MAX - digit) / 10)
+            return false;
+        value = value * 10 + digit;
+    }
+    *out = value;
+    return true;
+}
+
+// q值是否为0："0"、"0."或"0.000"之类
+static bool zero_qvalue(const char *p, const char *end)
+{
+    if (p >= end || *p != '0')
+    {
+        return false;
+    }
+    for (++p; p < end && *p != ' ' && *p != '\t'; ++p)
+    {
+        if (*p != '.' && *p != '0')
+            return false;
+    }
+    return true;
+}
+
+bool has_token(const str_view &v, const char *token)
+{
+    if (!v.data)
+    {
+        return false;
+    }
+    size_t token_len = strlen(token);
+    const char *p = v.data, *end = v.data + v.len;
+    while (p < end)
+    {
+        const char *item_end = (const char *)memchr(p, ',', end - p);
+        if (!item_end)
+            item_end = end;
+        const char *last = item_end;
+        while (p < last && (*p == ' ' || *p == '\t'))
+            ++p;
+        while (last > p && (last[-1] == ' ' || last[-1] == '\t'))
+            --last;
+        if ((size_t)(last - p) == token_len && strncasecmp(p, token, token_len) == 0)
+        {
+            return true;
+        }
+        p = item_end + 1;
+    }
+    return false;
+}
+
+bool accepts_coding(const str_view &v, const char *coding)
+{
+    if (!v.data)
+    {
+        return false;
+    }
+    size_t coding_len = strlen(coding);
+    const char *p = v.data, *end = v.data + v.len;
+    bool star = false;
+    while (p < end)
+    {
+        const char *item_end = (const char *)memchr(p, ',', end - p);
+        if (!item_end)
+            item_end = end;
+        while (p < item_end && (*p == ' ' || *p == '\t'))
+            ++p;
+        const char *name = p;
+        while (p < item_end && *p != ';' && *p != ' ' && *p != '\t')
+            ++p;
+        size_t name_len = p - name;
+
+        // 参数中只关心q
+        bool rejected = false;
+        const char *q = (const char *)memchr(p, ';', item_end - p);
+        while (q)
+        {
+            ++q;
+            while (q < item_end && (*q == ' ' || *q == '\t'))
+                ++q;
+            if (item_end - q > 2 && (q[0] == 'q' || q[0] == 'Q') && q[1] == '=')
+                rejected = zero_qvalue(q + 2, item_end);
+            q = (const char *)memchr(q, ';', item_end - q);
+        }
+
+        if (name_len == coding_len && strncasecmp(name, coding, name_len) == 0)
+        {
+            return !rejected; // 明确列出时以它为准
+        }
+        if (name_len == 1 && *name == '*')
+        {
+            star = !rejected;
+        }
+        p = item_end + 1;
+    }
+    return star;
+}
+
+bool etag_matches(const str_view &v, const char *etag)
+{
+    if (!v.data)
+    {
+        return false;
+    }
+    size_t etag_len = strlen(etag);
+    const char *p = v.data, *end = v.data + v.len;
+    while (p < end)
+    {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == ','))
+            ++p;
+        if (p == end)
+            break;
+        if (*p == '*')
+            return true;
+        if (end - p >= 2 && p[0] == 'W' && p[1] == '/')
+            p += 2;
+        if (*p != '"') // 不是合法的实体标签，忽略整个请求头
+        {
+            return false;
+        }
+        const char *close = (const char *)memchr(p + 1, '"', end - p - 1);
+        if (!close)
+        {
+            return false;
+        }
+        if ((size_t)(close + 1 - p) == etag_len && memcmp(p, etag, etag_len) == 0)
+        {
+            return true;
+        }
+        p = close + 1;
+    }
+    return false;
+}
+
+bool parse_http_date(const str_view &v, time_t *out)
+{
+    char buf[64];
+    if (!v.data || v.len <= 0 || v.len >= (int)sizeof(buf))
+    {
+        return false;
+    }
+    memcpy(buf, v.data, v.len);
+    buf[v.len] = '\0';
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    const char *rest = strptime(buf, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    if (!rest || *rest != '\0')
+    {
+        return false;
+    }
+    *out = timegm(&tm);
+    return true;
+}
+
+// 读取一个十进制数，没有数字或溢出时返回false
+static bool scan_number(const char *&p, const char *end, long *out)
+{
+    const char *start = p;
+    while (p < end && *p >= '0' && *p <= '9')
+        ++p;
+    str_view digits = {start, (int)(p - start)};
+    return parse_length(digits, out);
+}
+
+int parse_range(const str_view &v, byte_range *out, int max)
+{
+    if (!v.data || v.len < 6 || strncasecmp(v.data, "bytes=", 6) != 0)
+    {
+        return -1;
+    }
+    const char *p = v.data + 6, *end = v.data + v.len;
+    int count = 0;
+    while (p < end)
+    {
+        while (p < end && (*p == ' ' || *p == '\t'))
+            ++p;
+        if (p < end && *p == ',') // 允许空的列表元素
+        {
+            ++p;
+            continue;
+        }
+        if (p == end)
+            break;
+        if (count == max)
+            return -1;
+
+        byte_range &r = out[count];
+        if (*p == '-') // 最后n个字节
+        {
+            ++p;
+            r.first = -1;
+            if (!scan_number(p, end, &r.last))
+                return -1;
+        }
+        else
+        {
+            if (!scan_number(p, end, &r.first) || p == end || *p != '-')
+                return -1;
+            ++p;
+            r.last = -1;
+            if (p < end && *p >= '0' && *p <= '9')
+            {
+                if (!scan_number(p, end, &r.last) || r.last < r.first)
+                    return -1;
+            }
+        }
+        ++count;
+
+        while (p < end && (*p == ' ' || *p == '\t'))
+            ++p;
+        if (p < end && *p != ',')
+            return -1;
+    }
+    return count > 0 ? count : -1;
+}
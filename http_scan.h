@@ -0,0 +1,82 @@
+#ifndef HTTP_SCAN_H
+#define HTTP_SCAN_H
+
+#include <stddef.h>
+#include <strings.h>
+#include <string.h>
+#include <time.h>
+
+#define MAX_HEADERS 32 // 一个请求最多的请求头个数
+#define MAX_RANGES 8   // Range请求头最多的区间数，超过时忽略整个请求头
+
+// 指向读缓冲区的字符串片段，不以'\0'结尾
+struct str_view
+{
+    const char *data;
+    int len;
+};
+
+// Range中的一个区间：first为-1时表示最后last个字节，last为-1时表示直到文件末尾
+struct byte_range
+{
+    long first;
+    long last;
+};
+
+struct header_field
+{
+    str_view name;
+    str_view value;
+};
+
+// 通过预先计算的哈希识别的请求头
+enum KNOWN_HEADER
+{
+    HEADER_CONNECTION,
+    HEADER_CONTENT_LENGTH,
+    HEADER_HOST,
+    HEADER_ACCEPT_ENCODING,
+    HEADER_IF_NONE_MATCH,
+    HEADER_IF_MODIFIED_SINCE,
+    HEADER_RANGE,
+    HEADER_IF_RANGE,
+    HEADER_UPGRADE,
+    HEADER_HTTP2_SETTINGS,
+    HEADER_TRANSFER_ENCODING,
+    HEADER_EXPECT,
+    HEADER_NUM
+};
+
+// 查找[p, end)中第一个等于a或b的字节，没有时返回end
+// x86上用SSE2（支持时用AVX2）每次比较16（32）个字节；定义HTTP_SCAN_NO_SIMD时只使用逐字节的实现
+const char *find_either(const char *p, const char *end, char a, char b);
+inline const char *find_eol(const char *p, const char *end) { return find_either(p, end, '\r', '\n'); }
+const char *http_scan_impl(); // 当前使用的实现，"avx2"、"sse2"或"scalar"
+
+int known_header(const char *name, int len); // 返回KNOWN_HEADER，不是已知的请求头时返回-1
+
+// 不区分大小写地比较片段与字符串
+inline bool view_ieq(const str_view &v, const char *s)
+{
+    return v.data && (size_t)v.len == strlen(s) && strncasecmp(v.data, s, v.len) == 0;
+}
+
+// 按','分隔的列表中是否有某个记号（如Connection: Upgrade或Upgrade: h2c），不区分大小写
+bool has_token(const str_view &v, const char *token);
+
+// Accept-Encoding是否接受某种编码：按','分隔，名字不区分大小写，"*"匹配任意编码，q=0表示拒绝
+bool accepts_coding(const str_view &v, const char *coding);
+
+// If-None-Match中是否有与etag（带引号）相同的实体标签，按弱比较忽略"W/"前缀，"*"匹配任意标签
+bool etag_matches(const str_view &v, const char *etag);
+
+// 解析HTTP日期（IMF-fixdate，如"Sun, 06 Nov 1994 08:49:37 GMT"）
+bool parse_http_date(const str_view &v, time_t *out);
+
+// 解析"bytes=0-99,200-,-50"形式的Range，返回区间数；语法错误或区间过多时返回-1
+int parse_range(const str_view &v, byte_range *out, int max);
+
+// 解析十进制的非负整数，不允许空串、符号和溢出
+bool parse_length(const str_view &v, long *out);
+
+#endif
@@ -0,0 +1,65 @@
+#include "io_stats.h"
+#include "thread_slot.h"
+
+static const char *io_stat_names[STAT_NUM] = {
+    "requests", "accept", "socket", "epoll_wait", "epoll_ctl", "io_uring_enter", "recv", "send", "file"};
+
+struct alignas(64) io_stat_slot
+{
+    std::atomic<unsigned long> counts[STAT_NUM];
+};
+
+// 最后一个槽位由超过线程数上限的线程共用
+static io_stat_slot io_stat_slots[MAX_THREAD_SLOTS + 1];
+
+void io_stat_add(IO_STAT kind, unsigned long n)
+{
+    int index = thread_slot();
+    if (index < 0) // 共用槽位有多个写者，必须用fetch_add
+    {
+        io_stat_slots[MAX_THREAD_SLOTS].counts[kind].fetch_add(n, std::memory_order_relaxed);
+        return;
+    }
+    std::atomic<unsigned long> &c = io_stat_slots[index].counts[kind];
+    c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+const char *io_stat_name(IO_STAT kind)
+{
+    return io_stat_names[kind];
+}
+
+void io_stats_totals(unsigned long total[STAT_NUM])
+{
+    for (int k = 0; k < STAT_NUM; ++k)
+        total[k] = 0;
+    int threads = thread_slot_count();
+    for (int i = 0; i < threads; ++i)
+        for (int k = 0; k < STAT_NUM; ++k)
+            total[k] += io_stat_slots[i].counts[k].load(std::memory_order_relaxed);
+    for (int k = 0; k < STAT_NUM; ++k)
+        total[k] += io_stat_slots[MAX_THREAD_SLOTS].counts[k].load(std::memory_order_relaxed);
+}
+
+void io_stats_report(FILE *out)
+{
+    unsigned long total[STAT_NUM];
+    io_stats_totals(total);
+
+    unsigned long syscalls = 0;
+    for (int k = STAT_REQUESTS + 1; k < STAT_NUM; ++k)
+        syscalls += total[k];
+
+    fprintf(out, "I/O stats: %lu requests, %lu syscalls", total[STAT_REQUESTS], syscalls);
+    if (total[STAT_REQUESTS] > 0)
+        fprintf(out, " (%.2f per request)", (double)syscalls / total[STAT_REQUESTS]);
+    fprintf(out, "\n");
+    for (int k = STAT_REQUESTS + 1; k < STAT_NUM; ++k)
+    {
+        fprintf(out, "  %-16s %lu", io_stat_names[k], total[k]);
+        if (total[STAT_REQUESTS] > 0)
+            fprintf(out, "\t%.2f/req", (double)total[k] / total[STAT_REQUESTS]);
+        fprintf(out, "\n");
+    }
+    fflush(out);
+}
@@ -0,0 +1,28 @@
+#ifndef IO_STATS_H
+#define IO_STATS_H
+
+#include <stdio.h>
+#include <atomic>
+
+// 请求路径上的系统调用统计，用于比较不同事件后端每个请求的系统调用次数
+enum IO_STAT
+{
+    STAT_REQUESTS,    // 处理的请求数（不是系统调用）
+    STAT_ACCEPT,      // accept
+    STAT_SOCKET,      // setsockopt / fcntl / getpeername / close
+    STAT_EPOLL_WAIT,  // epoll_wait
+    STAT_EPOLL_CTL,   // epoll_ctl
+    STAT_URING_ENTER, // io_uring_enter
+    STAT_RECV,        // recv
+    STAT_SEND,        // sendmsg / sendfile
+    STAT_FILE,        // stat / open / mmap / munmap / close 等文件操作
+    STAT_NUM
+};
+
+// 计数器按线程编号分开，只有所属线程写入，汇总时才读取其他线程的计数
+void io_stat_add(IO_STAT kind, unsigned long n = 1);
+void io_stats_totals(unsigned long total[STAT_NUM]); // 汇总所有线程的计数
+const char *io_stat_name(IO_STAT kind);
+void io_stats_report(FILE *out);
+
+#endif
@@ -2,117 +2,432 @@
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
-#include <fcntl.h>
 #include <stdlib.h>
-#include <sys/socket.h>
-#include <netinet/in.h>
-#include <arpa/inet.h>
-#include <sys/epoll.h>
+#include <pthread.h>
+#include <signal.h>
 #include "thread_pool.h"
 #include "http_conn.h"
+#include "reactor.h"
+#include "uring_reactor.h"
+#include "file_cache.h"
+#include "io_stats.h"
+#include "cpu_affinity.h"
+#include "upload.h"
 
-#define MAX_FD 65534           // 最大的文件描述符个数
-#define MAX_EVENT_NUMBER 60000 // 监听的最大的事件数量
+#define NUM_REACTORS 1 // 默认反应堆数量，1为单线程epoll循环
+
+static void usage(const char *prog)
+{
+    printf("Usage: %s [port] [threads] [-r reactors] [-b backlog] [-q queue] [-o inline|reject] [-c cache_mb] [-z gzip_mb] [-s sendfile_min] [-e epoll|uring] [-t timeouts] [-a admission] [-l access_log] [-L every] [-p] [-i] [-u upload_dir] [-C cpus] [-W cpus] [-g max_threads]\n", prog);
+    printf("  -r reactors  number of event loops, 0 for one per online CPU (default %d)\n", NUM_REACTORS);
+    printf("  -e backend   event backend of each loop (default epoll)\n");
+    printf("  -b backlog   listen backlog of each listen socket (default %d)\n", LISTEN_BACKLOG);
+    printf("  -q queue     capacity of the thread pool task queue, rounded up to a power of two (default %d)\n", MAX_REQUESTS);
+    printf("  -o policy    when the queue is full: inline runs the request on the reactor,\n");
+    printf("               reject answers 503 and closes (default inline)\n");
+    printf("  -c cache_mb  size of the static file cache in MB, 0 disables it (default %d)\n", FILE_CACHE_SIZE >> 20);
+    printf("  -z gzip_mb   size of the cache of files gzipped at runtime in MB, 0 only serves\n");
+    printf("               precompressed .gz files (default %d)\n", GZIP_CACHE_SIZE >> 20);
+    printf("  -s bytes     send files of at least this size with sendfile, 0 always uses mmap (default %d)\n", SENDFILE_THRESHOLD);
+    printf("  -t h,b,i,w   timeouts in seconds for reading the request header, gaps while reading the body,\n");
+    printf("               keep-alive idle and write stalls, 0 disables one (default %d,%d,%d,%d)\n",
+           HEADER_TIMEOUT, BODY_TIMEOUT, KEEPALIVE_TIMEOUT, WRITE_TIMEOUT);
+    printf("  -a c,q,ms    admission limits: new connections get a 503 and are closed while open connections\n");
+    printf("               reach c, connections waiting in the thread pool reach q, or the average queue\n");
+    printf("               wait exceeds ms; 0 disables one (default %d,%s,%d)\n", MAX_FD, "3/4 of the queue", ADMIT_MAX_DELAY_MS);
+    printf("  -l file      write a JSON access log to file, rotated at %ld MB (default off)\n", ACCESS_LOG_ROTATE >> 20);
+    printf("  -L every     log one of every n successful requests, errors are always logged (default 1)\n");
+    printf("  -p           preload the resource tree into memory at startup and serve it without touching\n");
+    printf("               the filesystem; later changes to the files are not picked up (default off)\n");
+    printf("  -i           answer fully buffered requests for files in the asset pack or file cache directly\n");
+    printf("               on the reactor, only the rest goes to the thread pool (default off)\n");
+    printf("  -u dir,mb    accept PUT/POST uploads to files under this directory of the resource tree; bodies\n");
+    printf("               (Content-Length or chunked) are spliced to disk and limited to mb MB each (default off, %d)\n", UPLOAD_MAX_MB);
+    printf("  -C cpus      pin reactor i to the i-th CPU of the list, e.g. 0-3,8 (default unpinned)\n");
+    printf("  -W cpus      pin workers to these CPUs with one thread pool per NUMA node; threads are split by\n");
+    printf("               the number of CPUs of each node and reactors hand requests to their own node's pool\n");
+    printf("               (default one unpinned pool)\n");
+    printf("  -g max,depth,ms,idle  grow each thread pool up to max threads while the queue holds more than depth\n");
+    printf("               connections per thread or the estimated queue wait exceeds ms; workers idle for idle\n");
+    printf("               seconds retire down to the initial count (default fixed size, %d,%d,%d)\n", POOL_GROW_DEPTH, POOL_GROW_WAIT_MS, POOL_IDLE_RETIRE_S);
+    printf("Send SIGUSR1 to print syscall counts per request.\n");
+}
+
+// 收到SIGUSR1时输出系统调用统计
+static void *stats_func(void *arg)
+{
+    sigset_t *set = (sigset_t *)arg;
+    int sig;
+    while (sigwait(set, &sig) == 0)
+    {
+        io_stats_report(stdout);
+    }
+    return 0;
+}
 
 int main(int argc, char *argv[])
 {
     int port = 80, num_threads = NUM_THREADS;
+    int num_reactors = NUM_REACTORS, backlog = LISTEN_BACKLOG;
+    int max_requests = MAX_REQUESTS;
+    bool use_uring = false;
+    long cache_size = FILE_CACHE_SIZE;
+    long gzip_size = GZIP_CACHE_SIZE;
+    OVERLOAD_POLICY overload = OVERLOAD_INLINE;
+    const char *access_log_path = 0;
+    long max_queue = -1; // 默认为任务队列容量的3/4
+    int log_every = 1;
+    bool preload = false;
+    cpu_set_t reactor_cpus, worker_cpus;
+    bool pin_reactors = false, pin_workers = false;
+    pool_sizing sizing = {0, POOL_GROW_DEPTH, POOL_GROW_WAIT_MS, POOL_IDLE_RETIRE_S};
 
-    if (argc > 1)
-        port = atoi(argv[1]);
+    int opt;
+    while ((opt = getopt(argc, argv, "r:b:q:o:c:z:s:e:t:a:l:L:piu:C:W:g:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'r':
+            num_reactors = atoi(optarg);
+            break;
+        case 'b':
+            backlog = atoi(optarg);
+            break;
+        case 'q':
+            max_requests = atoi(optarg);
+            break;
+        case 'c':
+            cache_size = atol(optarg) << 20;
+            break;
+        case 'z':
+            gzip_size = atol(optarg) << 20;
+            break;
+        case 's':
+            http_conn::m_sendfile_threshold = atol(optarg);
+            break;
+        case 't':
+            // 可以只给出前几个，其余保持默认
+            if (sscanf(optarg, "%d,%d,%d,%d", &http_conn::m_timeouts[http_conn::TIMEOUT_HEADER], &http_conn::m_timeouts[http_conn::TIMEOUT_BODY],
+                       &http_conn::m_timeouts[http_conn::TIMEOUT_IDLE], &http_conn::m_timeouts[http_conn::TIMEOUT_WRITE]) < 1)
+            {
+                usage(argv[0]);
+                exit(-1);
+            }
+            break;
+        case 'a':
+            // 可以只给出前几个，其余保持默认
+            if (sscanf(optarg, "%d,%ld,%ld", &event_backend::m_max_conns, &max_queue, &event_backend::m_max_delay_ms) < 1)
+            {
+                usage(argv[0]);
+                exit(-1);
+            }
+            break;
+        case 'l':
+            access_log_path = optarg;
+            break;
+        case 'L':
+            log_every = atoi(optarg);
+            break;
+        case 'p':
+            preload = true;
+            break;
+        case 'i':
+            event_backend::m_run_inline = true;
+            break;
+        case 'u':
+        {
+            // 目录相对资源目录，按URL的规则规范化；不能是资源目录本身
+            char dir[MAX_FILENAME_LEN];
+            long max_mb = UPLOAD_MAX_MB;
+            if (sscanf(optarg, "%198[^,],%ld", dir + 1, &max_mb) < 1)
+            {
+                usage(argv[0]);
+                exit(-1);
+            }
+            dir[0] = '/';
+            if (!file_cache::normalize_url(dir, http_conn::m_upload_dir, sizeof(http_conn::m_upload_dir)) || strcmp(http_conn::m_upload_dir, "/") == 0 || max_mb <= 0)
+            {
+                usage(argv[0]);
+                exit(-1);
+            }
+            http_conn::m_upload_max = max_mb << 20;
+            break;
+        }
+        case 'C':
+            if (!parse_cpu_list(optarg, &reactor_cpus))
+            {
+                usage(argv[0]);
+                exit(-1);
+            }
+            pin_reactors = true;
+            break;
+        case 'g':
+            // 可以只给出前几个，其余保持默认
+            if (sscanf(optarg, "%d,%d,%d,%d", &sizing.max_threads, &sizing.grow_depth, &sizing.grow_wait_ms, &sizing.idle_s) < 1)
+            {
+                usage(argv[0]);
+                exit(-1);
+            }
+            break;
+        case 'W':
+            if (!parse_cpu_list(optarg, &worker_cpus))
+            {
+                usage(argv[0]);
+                exit(-1);
+            }
+            pin_workers = true;
+            break;
+        case 'e':
+            if (strcmp(optarg, "epoll") == 0)
+                use_uring = false;
+            else if (strcmp(optarg, "uring") == 0)
+                use_uring = true;
+            else
+            {
+                usage(argv[0]);
+                exit(-1);
+            }
+            break;
+        case 'o':
+            if (strcmp(optarg, "inline") == 0)
+                overload = OVERLOAD_INLINE;
+            else if (strcmp(optarg, "reject") == 0)
+                overload = OVERLOAD_REJECT;
+            else
+            {
+                usage(argv[0]);
+                exit(-1);
+            }
+            break;
+        default:
+            usage(argv[0]);
+            exit(opt == 'h' ? 0 : -1);
+        }
+    }
+    if (optind < argc)
+        port = atoi(argv[optind++]);
     printf("Use Port %d\n", port);
 
-    if (argc > 2)
-        num_threads = atoi(argv[2]);
+    if (optind < argc)
+        num_threads = atoi(argv[optind++]);
 
-    struct sockaddr_in address;
-    address.sin_addr.s_addr = INADDR_ANY;
-    address.sin_family = AF_INET;
-    address.sin_port = htons(port);
+    if (num_reactors <= 0)
+        num_reactors = sysconf(_SC_NPROCESSORS_ONLN);
+    bool bad_timeout = false;
+    for (int i = 0; i < http_conn::TIMEOUT_NUM; i++)
+        bad_timeout = bad_timeout || http_conn::m_timeouts[i] < 0;
+    if (num_reactors <= 0 || backlog <= 0 || max_requests <= 0 || cache_size < 0 || gzip_size < 0 || http_conn::m_sendfile_threshold < 0 || log_every <= 0 || bad_timeout ||
+        event_backend::m_max_conns < 0 || event_backend::m_max_delay_ms < 0 ||
+        sizing.max_threads < 0 || sizing.grow_depth <= 0 || sizing.grow_wait_ms <= 0 || sizing.idle_s <= 0)
+    {
+        usage(argv[0]);
+        exit(-1);
+    }
 
-    int listen_fd = socket(PF_INET, SOCK_STREAM, 0);
-    assert(listen_fd >= 0);
+    signal(SIGPIPE, SIG_IGN); // 对端关闭后继续写入时由返回值处理，而不是终止进程
 
-    int reuse = 1;
-    if (setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) != 0) // 端口复用
-        exit(-1);
-    if (bind(listen_fd, (struct sockaddr *)&address, sizeof(address)) != 0)
-        exit(-1);
-    if (listen(listen_fd, 5) != 0)
-        exit(-1);
+    // 之后创建的线程都屏蔽SIGUSR1，由统计线程同步等待
+    static sigset_t stats_set;
+    sigemptyset(&stats_set);
+    sigaddset(&stats_set, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &stats_set, NULL);
+    pthread_t stats_thread;
+    pthread_create(&stats_thread, NULL, stats_func, &stats_set);
+    pthread_detach(stats_thread);
+
+    if (cache_size > 0)
+    {
+        try
+        {
+            http_conn::m_file_cache = new file_cache(http_conn::doc_root(), cache_size);
+            printf("File cache: %ld MB for %s\n", cache_size >> 20, http_conn::doc_root());
+        }
+        catch (std::exception &e)
+        {
+            printf("Create file cache failed, serving without it! Errno is: %d\n", errno);
+        }
+    }
 
-    epoll_event events[MAX_EVENT_NUMBER];
-    int epoll_fd = epoll_create(1);
+    if (gzip_size > 0)
+    {
+        try
+        {
+            http_conn::m_gzip_cache = new gzip_cache(gzip_size);
+            printf("Gzip cache: %ld MB\n", gzip_size >> 20);
+        }
+        catch (std::exception &e)
+        {
+            printf("Create gzip cache failed, compressing only with .gz files! Errno is: %d\n", errno);
+        }
+    }
 
-    epoll_event listen_event;
-    listen_event.data.fd = listen_fd;
-    listen_event.events = EPOLLIN;
-    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &listen_event);
+    if (preload)
+    {
+        long start = metric_now_ns();
+        try
+        {
+            http_conn::m_asset_pack = new asset_pack(http_conn::doc_root(), gzip_size > 0);
+            printf("Asset pack: %zu files, %zu MB in %.1f ms, %ld files left on disk\n", http_conn::m_asset_pack->count(),
+                   http_conn::m_asset_pack->bytes() >> 20, (metric_now_ns() - start) / 1e6, http_conn::m_asset_pack->skipped());
+        }
+        catch (std::exception &e)
+        {
+            printf("Build asset pack from %s failed! Errno is: %d\n", http_conn::doc_root(), errno);
+            exit(-1);
+        }
+    }
 
-    http_conn::m_user_count = 0;
-    http_conn::m_epoll_fd = epoll_fd;
-    http_conn *users = new http_conn[MAX_FD];
-    thread_pool<http_conn> *pool = new thread_pool<http_conn>(num_threads);
+    if (event_backend::m_max_conns == 0 || event_backend::m_max_conns > MAX_FD)
+        event_backend::m_max_conns = MAX_FD;
+    event_backend::m_max_queue = max_queue >= 0 ? max_queue : max_requests * 3L / 4;
 
-    while (true)
+    if (access_log_path)
     {
-        int events_num = epoll_wait(epoll_fd, events, MAX_EVENT_NUMBER, -1);
+        try
+        {
+            http_conn::m_access_log = new access_log(access_log_path, log_every);
+            printf("Access log: %s\n", access_log_path);
+        }
+        catch (std::exception &e)
+        {
+            printf("Open access log %s failed! Errno is: %d\n", access_log_path, errno);
+            exit(-1);
+        }
+    }
+
+    if (http_conn::m_upload_dir[0])
+    {
+        std::string path = std::string(http_conn::doc_root()) + http_conn::m_upload_dir;
+        struct stat st;
+        if (stat(path.c_str(), &st) < 0 || !S_ISDIR(st.st_mode))
+        {
+            printf("Upload directory %s does not exist!\n", path.c_str());
+            exit(-1);
+        }
+        printf("Uploads: %s, at most %ld MB each\n", path.c_str(), http_conn::m_upload_max >> 20);
+    }
 
-        if (events_num < 0 && errno != EINTR)
+    if (event_backend::m_run_inline)
+        printf("Run to completion: requests for cached files are answered on the reactors\n");
+
+    http_conn **users = new http_conn *[MAX_FD](); // 连接对象按需从对象池中取得
+
+    // 工作线程按NUMA节点分组，每个节点一个线程池，线程数按该节点的CPU数分配；没有绑定时只有一个池
+    int nodes = numa_node_count();
+    thread_pool<http_conn> **pools = new thread_pool<http_conn> *[nodes]();
+    if (pin_workers)
+    {
+        for (int n = 0; n < nodes; n++)
+        {
+            cpu_set_t cpus;
+            numa_node_cpus(&worker_cpus, n, &cpus);
+            if (CPU_COUNT(&cpus) == 0)
+                continue;
+            int threads = std::max(1, num_threads * CPU_COUNT(&cpus) / CPU_COUNT(&worker_cpus));
+            pool_sizing node_sizing = sizing;
+            node_sizing.max_threads = std::max(threads, sizing.max_threads * CPU_COUNT(&cpus) / CPU_COUNT(&worker_cpus));
+            pools[n] = new thread_pool<http_conn>(threads, max_requests, &cpus, &node_sizing);
+            printf("Worker pool on node %d: cpus %s\n", n, format_cpu_list(&cpus).c_str());
+        }
+    }
+    else
+    {
+        pools[0] = new thread_pool<http_conn>(num_threads, max_requests, NULL, &sizing);
+    }
+    // 注入队列的容量向上取整为2的幂，与-q不同时说明实际的容量
+    for (int n = 0; n < nodes; n++)
+    {
+        if (pools[n])
         {
-            printf("Epoll Error!\n");
+            if (pools[n]->queue_capacity() != (size_t)max_requests)
+                printf("Task queue: %d rounded up to %zu slots per pool\n", max_requests, pools[n]->queue_capacity());
             break;
         }
-        for (int i = 0; i < events_num; i++)
+    }
+    int reactor_cpu_list[CPU_SETSIZE], reactor_cpu_count = 0;
+    for (int c = 0; pin_reactors && c < CPU_SETSIZE; c++)
+    {
+        if (CPU_ISSET(c, &reactor_cpus))
+            reactor_cpu_list[reactor_cpu_count++] = c;
+    }
+    cpu_set_t main_cpus;
+    pthread_getaffinity_np(pthread_self(), sizeof(main_cpus), &main_cpus);
+
+    // 多反应堆模式下每个反应堆各自创建监听套接字，并用SO_REUSEPORT绑定同一端口
+    bool reuse_port = num_reactors > 1;
+    event_backend **reactors = new event_backend *[num_reactors];
+    for (int i = 0; i < num_reactors; i++)
+    {
+        // 绑定的反应堆交给本节点的线程池，节点上没有线程池或没有绑定时轮流使用各个线程池
+        int cpu = reactor_cpu_count > 0 ? reactor_cpu_list[i % reactor_cpu_count] : -1;
+        int node = cpu >= 0 ? numa_node_of_cpu(cpu) : i % nodes;
+        while (!pools[node])
+            node = (node + 1) % nodes;
+        if (cpu >= 0) // 在反应堆的CPU上创建，epoll与io_uring的内核数据结构分配在本节点上
+        {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpu, &set);
+            pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        }
+        try
+        {
+            if (use_uring)
+                reactors[i] = new uring_reactor(i, port, backlog, reuse_port, users, pools[node], overload);
+            else
+                reactors[i] = new reactor(i, port, backlog, reuse_port, users, pools[node], overload);
+        }
+        catch (std::exception &e)
+        {
+            printf("Create reactor %d failed! Errno is: %d\n", i, errno);
+            exit(-1);
+        }
+        if (cpu >= 0)
         {
-            int sock_fd = events[i].data.fd;
+            reactors[i]->set_cpu(cpu);
+            printf("Reactor %d on cpu %d, node %d\n", i, cpu, numa_node_of_cpu(cpu));
+        }
+    }
+    pthread_setaffinity_np(pthread_self(), sizeof(main_cpus), &main_cpus);
+    report_nic_affinity(stdout);
+    printf("Create %d %s reactors successfully!\n", num_reactors, use_uring ? "io_uring" : "epoll");
 
-            if (sock_fd == listen_fd)
-            {
-                struct sockaddr_in client_address;
-                socklen_t client_addrlength = sizeof(client_address);
-                int conn_fd = accept(listen_fd, (struct sockaddr *)&client_address, &client_addrlength);
-
-                if (conn_fd < 0)
-                {
-                    printf("Accept Error! Errno is: %d\n", errno);
-                    continue;
-                }
-                if (http_conn::m_user_count >= MAX_FD)
-                {
-                    close(conn_fd);
-                    continue;
-                }
-                users[conn_fd].init(conn_fd, client_address);
-            }
-            else if (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))
-            {
-                users[sock_fd].close_conn();
-            }
-            else if (events[i].events & EPOLLIN)
-            {
-                if (users[sock_fd].read())
-                {
-                    pool->append(users + sock_fd);
-                }
-                else
-                {
-                    users[sock_fd].close_conn();
-                }
-            }
-            else if (events[i].events & EPOLLOUT)
+    if (num_reactors == 1)
+    {
+        event_backend::run_static(reactors[0]);
+    }
+    else
+    {
+        pthread_t *threads = new pthread_t[num_reactors];
+        for (int i = 0; i < num_reactors; i++)
+        {
+            if (pthread_create(threads + i, NULL, event_backend::run_static, reactors[i]) != 0)
             {
-                if (!users[sock_fd].write())
-                {
-                    users[sock_fd].close_conn();
-                }
+                printf("Start reactor %d failed!\n", i);
+                exit(-1);
             }
         }
+        for (int i = 0; i < num_reactors; i++)
+        {
+            pthread_join(threads[i], NULL);
+        }
+        delete[] threads;
     }
 
-    close(epoll_fd);
-    close(listen_fd);
+    for (int i = 0; i < num_reactors; i++)
+    {
+        delete reactors[i];
+    }
+    delete[] reactors;
     delete[] users;
-    delete pool;
+    for (int n = 0; n < nodes; n++)
+    {
+        delete pools[n];
+    }
+    delete[] pools;
+    delete http_conn::m_file_cache;
+    delete http_conn::m_gzip_cache;
+    delete http_conn::m_access_log;
+    delete http_conn::m_asset_pack;
     return 0;
 }
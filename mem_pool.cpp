@@ -0,0 +1,55 @@
+#include "mem_pool.h"
+#include "cpu_affinity.h"
+
+#define BUFFER_CLASSES (BUFFER_MAX_SHIFT - BUFFER_MIN_SHIFT + 1)
+
+// 第一次使用时创建，避免依赖其他编译单元中静态对象的初始化顺序；
+// 每个NUMA节点一组空闲队列，线程只从自己节点的队列取用，新分配的缓冲区由本节点的线程首先写入
+static mpmc_ring<char> **buffer_free_lists()
+{
+    static mpmc_ring<char> ***lists = []
+    {
+        int nodes = numa_node_count();
+        mpmc_ring<char> ***l = new mpmc_ring<char> **[nodes];
+        for (int n = 0; n < nodes; ++n)
+        {
+            l[n] = new mpmc_ring<char> *[BUFFER_CLASSES];
+            for (int i = 0; i < BUFFER_CLASSES; ++i)
+                l[n][i] = new mpmc_ring<char>(BUFFER_POOL_BYTES >> (BUFFER_MIN_SHIFT + i));
+        }
+        return l;
+    }();
+    return lists[numa_current_node()];
+}
+
+int buffer_pool::size_class(size_t size)
+{
+    int shift = BUFFER_MIN_SHIFT;
+    while (((size_t)1 << shift) < size)
+        shift++;
+    return shift - BUFFER_MIN_SHIFT;
+}
+
+char *buffer_pool::alloc(size_t size)
+{
+    int c = size_class(size);
+    if (c >= BUFFER_CLASSES)
+    {
+        return (char *)malloc(size);
+    }
+    char *buf = buffer_free_lists()[c]->pop();
+    if (!buf)
+    {
+        buf = (char *)malloc((size_t)1 << (BUFFER_MIN_SHIFT + c));
+    }
+    return buf;
+}
+
+void buffer_pool::release(char *buf, size_t size)
+{
+    int c = size_class(size);
+    if (c >= BUFFER_CLASSES || !buffer_free_lists()[c]->push(buf))
+    {
+        free(buf);
+    }
+}
@@ -0,0 +1,79 @@
+#ifndef MEM_POOL_H
+#define MEM_POOL_H
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <vector>
+#include <exception>
+#include "mpmc_ring.h"
+
+#define SLAB_CHUNK 256           // 对象池每次分配的对象个数
+#define BUFFER_MIN_SHIFT 10      // 最小的缓冲区1KB
+#define BUFFER_MAX_SHIFT 16      // 最大的缓冲区64KB，更大的直接向系统申请
+#define BUFFER_POOL_BYTES (16 << 20) // 每个大小等级最多缓存的空闲缓冲区字节数
+
+// 对象池：对象按块分配、只构造一次，释放后放回空闲队列，内存直到池销毁才归还系统。
+// 因此已经释放的对象仍然可以安全地读取（用于识别对象是否已经被复用）
+template <typename T>
+class slab_pool
+{
+public:
+    explicit slab_pool(size_t max_objects) : m_free(max_objects + SLAB_CHUNK)
+    {
+        if (pthread_mutex_init(&m_mutex, NULL) != 0)
+        {
+            throw std::exception();
+        }
+    }
+    ~slab_pool()
+    {
+        for (size_t i = 0; i < m_chunks.size(); ++i)
+            delete[] m_chunks[i];
+        pthread_mutex_destroy(&m_mutex);
+    }
+
+    // 同时存在的对象不能超过max_objects
+    T *alloc()
+    {
+        T *obj = m_free.pop();
+        if (obj)
+        {
+            return obj;
+        }
+        pthread_mutex_lock(&m_mutex);
+        obj = m_free.pop();
+        if (!obj) // 空闲对象用完，再分配一块
+        {
+            T *chunk = new T[SLAB_CHUNK];
+            m_chunks.push_back(chunk);
+            for (int i = 1; i < SLAB_CHUNK; ++i)
+                m_free.push(chunk + i);
+            obj = chunk;
+        }
+        pthread_mutex_unlock(&m_mutex);
+        return obj;
+    }
+
+    void release(T *obj) { m_free.push(obj); }
+
+    size_t allocated() const { return m_chunks.size() * SLAB_CHUNK; }
+
+private:
+    mpmc_ring<T> m_free;
+    std::vector<T *> m_chunks;
+    pthread_mutex_t m_mutex;
+};
+
+// 按2的幂分级的缓冲区池，每级的空闲缓冲区放在无锁队列中，超过缓存上限时归还系统
+class buffer_pool
+{
+public:
+    static char *alloc(size_t size);
+    static void release(char *buf, size_t size);
+
+private:
+    static int size_class(size_t size);
+};
+
+#endif
@@ -0,0 +1,212 @@
+#include "metrics.h"
+#include <stdarg.h>
+#include "io_stats.h"
+#include "thread_slot.h"
+
+static const char *stage_names[STAGE_NUM] = {"accept", "queue", "read", "request", "write"};
+static const char *dispatch_names[DISPATCH_NUM] = {"inline", "pool", "overflow"};
+
+struct histogram
+{
+    std::atomic<unsigned long> buckets[HIST_BUCKETS];
+    std::atomic<unsigned long> sum_ns;
+};
+
+struct alignas(64) metric_slot
+{
+    histogram stages[STAGE_NUM];
+    std::atomic<unsigned long> status[MAX_STATUS];
+    std::atomic<unsigned long> bytes_sent;
+    std::atomic<unsigned long> dispatch[DISPATCH_NUM];
+    std::atomic<unsigned long> direct_sends[2]; // 没有发完、发送完毕
+};
+
+// 槽位在线程第一次记录时分配，进程退出前不释放；超过线程数上限的线程共用shared_metrics
+static std::atomic<metric_slot *> metric_slots[MAX_THREAD_SLOTS];
+static metric_slot shared_metrics;
+static thread_local bool metric_shared = false;
+
+static metric_slot *thread_metrics()
+{
+    static thread_local metric_slot *slot = 0;
+    if (!slot)
+    {
+        int index = thread_slot();
+        if (index < 0)
+        {
+            metric_shared = true;
+            slot = &shared_metrics;
+            return slot;
+        }
+        slot = new metric_slot();
+        metric_slots[index].store(slot, std::memory_order_release);
+    }
+    return slot;
+}
+
+// 自己的槽位只有一个写者，不需要原子加；共用槽位有多个写者，必须用fetch_add
+static inline void bump(std::atomic<unsigned long> &c, unsigned long n)
+{
+    if (metric_shared)
+        c.fetch_add(n, std::memory_order_relaxed);
+    else
+        c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+// 对数-线性分桶：先按最高位确定2的幂区间，再用其后HIST_SUB_BITS位确定区间内的桶
+static int bucket_index(unsigned long ns)
+{
+    if (ns < (1UL << HIST_MIN_SHIFT))
+        return 0;
+    int e = 63 - __builtin_clzl(ns);
+    if (e >= HIST_MAX_SHIFT)
+        return HIST_BUCKETS - 1;
+    int sub = (ns >> (e - HIST_SUB_BITS)) & ((1 << HIST_SUB_BITS) - 1);
+    return 1 + ((e - HIST_MIN_SHIFT) << HIST_SUB_BITS) + sub;
+}
+
+// 桶中最大的值（纳秒），与bucket_index对应
+static unsigned long bucket_upper(int index)
+{
+    if (index == 0)
+        return (1UL << HIST_MIN_SHIFT) - 1;
+    int e = HIST_MIN_SHIFT + ((index - 1) >> HIST_SUB_BITS);
+    int sub = (index - 1) & ((1 << HIST_SUB_BITS) - 1);
+    return ((unsigned long)((1 << HIST_SUB_BITS) + sub + 1) << (e - HIST_SUB_BITS)) - 1;
+}
+
+void metric_observe(METRIC_STAGE stage, long ns)
+{
+    if (ns < 0)
+        ns = 0;
+    histogram &h = thread_metrics()->stages[stage];
+    bump(h.buckets[bucket_index(ns)], 1);
+    bump(h.sum_ns, ns);
+}
+
+void metric_status(int status)
+{
+    if (status > 0 && status < MAX_STATUS)
+        bump(thread_metrics()->status[status], 1);
+}
+
+void metric_bytes_sent(long n)
+{
+    bump(thread_metrics()->bytes_sent, n);
+}
+
+void metric_dispatch(DISPATCH_MODE mode)
+{
+    bump(thread_metrics()->dispatch[mode], 1);
+}
+
+void metric_direct_send(bool complete)
+{
+    bump(thread_metrics()->direct_sends[complete], 1);
+}
+
+static void append(std::string &out, const char *format, ...) __attribute__((format(printf, 2, 3)));
+static void append(std::string &out, const char *format, ...)
+{
+    char buf[256];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+    if (len > 0)
+        out.append(buf, len < (int)sizeof(buf) ? len : (int)sizeof(buf) - 1);
+}
+
+void metrics_render(std::string &out, const metric_gauges &gauges)
+{
+    // 各线程写入时没有加锁，汇总结果是近似的快照，计数器本身不会倒退
+    unsigned long stages[STAGE_NUM][HIST_BUCKETS] = {{0}};
+    unsigned long sums[STAGE_NUM] = {0};
+    unsigned long status[MAX_STATUS] = {0};
+    unsigned long bytes_sent = 0;
+    unsigned long dispatch[DISPATCH_NUM] = {0};
+    unsigned long direct_sends[2] = {0};
+
+    int threads = thread_slot_count();
+    for (int i = 0; i <= threads; ++i)
+    {
+        metric_slot *slot = i < threads ? metric_slots[i].load(std::memory_order_acquire) : &shared_metrics;
+        if (!slot) // 线程已经登记但还没有分配槽位
+            continue;
+        for (int s = 0; s < STAGE_NUM; ++s)
+        {
+            for (int b = 0; b < HIST_BUCKETS; ++b)
+                stages[s][b] += slot->stages[s].buckets[b].load(std::memory_order_relaxed);
+            sums[s] += slot->stages[s].sum_ns.load(std::memory_order_relaxed);
+        }
+        for (int c = 0; c < MAX_STATUS; ++c)
+            status[c] += slot->status[c].load(std::memory_order_relaxed);
+        bytes_sent += slot->bytes_sent.load(std::memory_order_relaxed);
+        for (int d = 0; d < DISPATCH_NUM; ++d)
+            dispatch[d] += slot->dispatch[d].load(std::memory_order_relaxed);
+        for (int c = 0; c < 2; ++c)
+            direct_sends[c] += slot->direct_sends[c].load(std::memory_order_relaxed);
+    }
+
+    out += "# HELP webserver_stage_duration_seconds Time spent in each stage of a request.\n"
+           "# TYPE webserver_stage_duration_seconds histogram\n";
+    for (int s = 0; s < STAGE_NUM; ++s)
+    {
+        unsigned long count = 0;
+        for (int b = 0; b < HIST_BUCKETS - 1; ++b)
+        {
+            count += stages[s][b];
+            append(out, "webserver_stage_duration_seconds_bucket{stage=\"%s\",le=\"%.9g\"} %lu\n", stage_names[s], bucket_upper(b) / 1e9, count);
+        }
+        count += stages[s][HIST_BUCKETS - 1];
+        append(out, "webserver_stage_duration_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %lu\n", stage_names[s], count);
+        append(out, "webserver_stage_duration_seconds_sum{stage=\"%s\"} %.9g\n", stage_names[s], sums[s] / 1e9);
+        append(out, "webserver_stage_duration_seconds_count{stage=\"%s\"} %lu\n", stage_names[s], count);
+    }
+
+    out += "# HELP webserver_responses_total Responses sent, by status code.\n"
+           "# TYPE webserver_responses_total counter\n";
+    for (int c = 0; c < MAX_STATUS; ++c)
+    {
+        if (status[c])
+            append(out, "webserver_responses_total{code=\"%d\"} %lu\n", c, status[c]);
+    }
+
+    out += "# HELP webserver_sent_bytes_total Bytes written to client sockets.\n"
+           "# TYPE webserver_sent_bytes_total counter\n";
+    append(out, "webserver_sent_bytes_total %lu\n", bytes_sent);
+
+    out += "# HELP webserver_dispatch_total Batches of buffered requests answered on the reactor or handed to the thread pool.\n"
+           "# TYPE webserver_dispatch_total counter\n";
+    for (int d = 0; d < DISPATCH_NUM; ++d)
+        append(out, "webserver_dispatch_total{mode=\"%s\"} %lu\n", dispatch_names[d], dispatch[d]);
+
+    out += "# HELP webserver_direct_sends_total Response batches sent right after they were generated, by whether the socket took all of it.\n"
+           "# TYPE webserver_direct_sends_total counter\n";
+    append(out, "webserver_direct_sends_total{result=\"complete\"} %lu\n", direct_sends[1]);
+    append(out, "webserver_direct_sends_total{result=\"blocked\"} %lu\n", direct_sends[0]);
+
+    unsigned long io[STAT_NUM];
+    io_stats_totals(io);
+    out += "# HELP webserver_requests_total Requests parsed.\n"
+           "# TYPE webserver_requests_total counter\n";
+    append(out, "webserver_requests_total %lu\n", io[STAT_REQUESTS]);
+    out += "# HELP webserver_syscalls_total System calls on the request path, by kind.\n"
+           "# TYPE webserver_syscalls_total counter\n";
+    for (int k = STAT_REQUESTS + 1; k < STAT_NUM; ++k)
+        append(out, "webserver_syscalls_total{kind=\"%s\"} %lu\n", io_stat_name((IO_STAT)k), io[k]);
+
+    out += "# HELP webserver_connections_active Open client connections.\n"
+           "# TYPE webserver_connections_active gauge\n";
+    append(out, "webserver_connections_active %ld\n", gauges.active_connections);
+    out += "# HELP webserver_queue_depth Connections waiting in the thread pool queues.\n"
+           "# TYPE webserver_queue_depth gauge\n";
+    append(out, "webserver_queue_depth %ld\n", gauges.queue_depth);
+    out += "# HELP webserver_worker_threads Worker threads in all thread pools.\n"
+           "# TYPE webserver_worker_threads gauge\n";
+    append(out, "webserver_worker_threads %ld\n", gauges.worker_threads);
+    out += "# HELP webserver_worker_resizes_total Worker threads started or retired by adaptive pool sizing.\n"
+           "# TYPE webserver_worker_resizes_total counter\n";
+    append(out, "webserver_worker_resizes_total{direction=\"grow\"} %lu\n", gauges.workers_started);
+    append(out, "webserver_worker_resizes_total{direction=\"shrink\"} %lu\n", gauges.workers_retired);
+}
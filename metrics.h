@@ -0,0 +1,65 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdio.h>
+#include <time.h>
+#include <string>
+#include <atomic>
+
+#define METRICS_URL "/metrics"  // 保留的URL，返回Prometheus文本格式的指标
+#define HIST_SUB_BITS 2          // 每个2的幂区间再分成2^HIST_SUB_BITS个桶，相对误差不超过25%
+#define HIST_MIN_SHIFT 10        // 小于2^10纳秒（约1微秒）的值都落在第一个桶
+#define HIST_MAX_SHIFT 35        // 不小于2^35纳秒（约34秒）的值只计入+Inf
+#define HIST_BUCKETS (1 + ((HIST_MAX_SHIFT - HIST_MIN_SHIFT) << HIST_SUB_BITS) + 1) // 最后一个是+Inf
+#define MAX_STATUS 600           // 按状态码计数的上限
+
+// 请求经过的各个阶段
+enum METRIC_STAGE
+{
+    STAGE_ACCEPT,  // 接受连接并完成注册
+    STAGE_QUEUE,   // 在线程池队列中等待
+    STAGE_READ,    // 解析请求（process_read）
+    STAGE_REQUEST, // 查找文件、生成响应体（do_request）
+    STAGE_WRITE,   // 响应生成后到最后一个字节发送完毕
+    STAGE_NUM
+};
+
+// 读完数据的连接交给谁处理
+enum DISPATCH_MODE
+{
+    DISPATCH_INLINE,   // 命中内存中的文件，在反应堆线程上直接回答
+    DISPATCH_POOL,     // 交给线程池
+    DISPATCH_OVERFLOW, // 任务队列已满，按过载策略处理
+    DISPATCH_NUM
+};
+
+// 与io_stats一样按线程分开，只有所属线程写入，不需要原子的读-改-写；
+// 抓取时汇总各线程的数据，不影响请求路径
+void metric_observe(METRIC_STAGE stage, long ns); // 记录一个阶段的耗时（纳秒）
+void metric_status(int status);                   // 记录一个响应的状态码
+void metric_bytes_sent(long n);                   // 记录发送的字节数
+void metric_dispatch(DISPATCH_MODE mode);         // 记录一次分派
+void metric_direct_send(bool complete);           // 记录一次直接发送，没有发完时要等待可写事件
+
+// 单调时钟的纳秒数，0表示没有开始计时
+static inline long metric_now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+// 由调用者给出的即时状态
+struct metric_gauges
+{
+    long active_connections;
+    long queue_depth;              // 所有线程池中等待处理的连接数
+    long worker_threads;           // 所有线程池的工作线程数
+    unsigned long workers_started; // 自适应伸缩增加的线程数
+    unsigned long workers_retired; // 因空闲退出的线程数
+};
+
+// 汇总所有线程的指标，按Prometheus文本格式写入out
+void metrics_render(std::string &out, const metric_gauges &gauges);
+
+#endif
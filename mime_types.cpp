@@ -0,0 +1,48 @@
+#include "mime_types.h"
+
+// 编译期确定的扩展名表，最后一项是默认类型
+static const mime_type_entry mime_table[] = {
+    {".html", "text/html; charset=utf-8", true},
+    {".htm", "text/html; charset=utf-8", true},
+    {".css", "text/css; charset=utf-8", true},
+    {".js", "application/javascript; charset=utf-8", true},
+    {".json", "application/json", true},
+    {".txt", "text/plain; charset=utf-8", true},
+    {".md", "text/markdown; charset=utf-8", true},
+    {".xml", "application/xml", true},
+    {".svg", "image/svg+xml", true},
+    {".jpeg", "image/jpeg", false},
+    {".jpg", "image/jpeg", false},
+    {".png", "image/png", false},
+    {".gif", "image/gif", false},
+    {".webp", "image/webp", false},
+    {".ico", "image/x-icon", false},
+    {".woff", "font/woff", false},
+    {".woff2", "font/woff2", false},
+    {".pdf", "application/pdf", false},
+    {".mp4", "video/mp4", false},
+    {".webm", "video/webm", false},
+    {".mp3", "audio/mpeg", false},
+    {".wasm", "application/wasm", false},
+    {".gz", "application/gzip", false},
+    {".zip", "application/zip", false},
+    {0, DEFAULT_MIME_TYPE, false},
+};
+
+const mime_type_entry *mime_lookup(const char *path)
+{
+    const char *ext = strrchr(path, '.');
+    const mime_type_entry *e = mime_table;
+    if (!ext || strchr(ext, '/'))
+    {
+        while (e->ext)
+            ++e;
+        return e;
+    }
+    for (; e->ext; ++e)
+    {
+        if (strcasecmp(ext, e->ext) == 0)
+            break;
+    }
+    return e;
+}
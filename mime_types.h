@@ -0,0 +1,20 @@
+#ifndef MIME_TYPES_H
+#define MIME_TYPES_H
+
+#include <string.h>
+#include <strings.h>
+
+#define DEFAULT_MIME_TYPE "application/octet-stream" // 扩展名不在表中时使用
+
+struct mime_type_entry
+{
+    const char *ext;   // 扩展名，包括'.'
+    const char *type;  // Content-Type
+    bool compressible; // 是否值得gzip压缩（文本类型）
+};
+
+// 按文件扩展名查找Content-Type，不区分大小写
+const mime_type_entry *mime_lookup(const char *path);
+inline const char *mime_type(const char *path) { return mime_lookup(path)->type; }
+
+#endif
@@ -0,0 +1,118 @@
+#ifndef MPMC_RING_H
+#define MPMC_RING_H
+
+#include <stddef.h>
+#include <atomic>
+#include <exception>
+
+#define CACHE_LINE_SIZE 64
+
+// 有界无锁多生产者多消费者环形队列（Vyukov）
+// 容量在构造时确定（向上取整为2的幂），入队出队都不分配内存；
+// 入队与出队位置各占一个缓存行，避免生产者与消费者之间的伪共享
+template <typename T>
+class mpmc_ring
+{
+public:
+    explicit mpmc_ring(size_t capacity)
+    {
+        if (capacity == 0)
+        {
+            throw std::exception();
+        }
+        size_t size = 2;
+        while (size < capacity)
+            size <<= 1;
+        m_cells = new cell[size];
+        m_mask = size - 1;
+        for (size_t i = 0; i < size; ++i)
+            m_cells[i].seq.store(i, std::memory_order_relaxed);
+        m_enqueue_pos.store(0, std::memory_order_relaxed);
+        m_dequeue_pos.store(0, std::memory_order_relaxed);
+    }
+
+    ~mpmc_ring() { delete[] m_cells; }
+
+    size_t capacity() const { return m_mask + 1; }
+
+    // 队列中的元素个数，并发修改时只是近似值
+    size_t size() const
+    {
+        size_t enq = m_enqueue_pos.load(std::memory_order_relaxed);
+        size_t deq = m_dequeue_pos.load(std::memory_order_relaxed);
+        return enq > deq ? enq - deq : 0;
+    }
+
+    // 入队，队列满时返回false
+    bool push(T *item)
+    {
+        size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+        cell *c;
+        while (true)
+        {
+            c = &m_cells[pos & m_mask];
+            size_t seq = c->seq.load(std::memory_order_acquire);
+            long diff = (long)seq - (long)pos;
+            if (diff == 0)
+            {
+                if (m_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = m_enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+        c->data = item;
+        c->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // 出队，队列空时返回NULL
+    T *pop()
+    {
+        size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+        cell *c;
+        while (true)
+        {
+            c = &m_cells[pos & m_mask];
+            size_t seq = c->seq.load(std::memory_order_acquire);
+            long diff = (long)seq - (long)(pos + 1);
+            if (diff == 0)
+            {
+                if (m_dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0)
+            {
+                return 0;
+            }
+            else
+            {
+                pos = m_dequeue_pos.load(std::memory_order_relaxed);
+            }
+        }
+        T *item = c->data;
+        c->seq.store(pos + m_mask + 1, std::memory_order_release);
+        return item;
+    }
+
+private:
+    struct cell
+    {
+        std::atomic<size_t> seq;
+        T *data;
+    };
+
+    alignas(CACHE_LINE_SIZE) cell *m_cells;
+    size_t m_mask;
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> m_enqueue_pos;
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> m_dequeue_pos;
+    char m_pad[CACHE_LINE_SIZE - sizeof(std::atomic<size_t>)];
+};
+
+#endif
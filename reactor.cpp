@@ -0,0 +1,149 @@
+#include "reactor.h"
+
+reactor::reactor(int id, int port, int backlog, bool reuse_port, http_conn **users, thread_pool<http_conn> *pool, OVERLOAD_POLICY overload)
+    : event_backend(id, port, backlog, reuse_port, users, pool, overload)
+{
+    m_epoll_fd = epoll_create(1);
+    if (m_epoll_fd < 0)
+    {
+        throw std::exception();
+    }
+
+    // 监听套接字非阻塞，每次可读时循环accept直到没有新连接
+    fcntl(m_listen_fd, F_SETFL, fcntl(m_listen_fd, F_GETFL) | O_NONBLOCK);
+
+    epoll_event listen_event;
+    listen_event.data.fd = m_listen_fd;
+    listen_event.events = EPOLLIN;
+    epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, m_listen_fd, &listen_event);
+
+    m_events = new epoll_event[MAX_EVENT_NUMBER];
+}
+
+reactor::~reactor()
+{
+    close(m_epoll_fd);
+    delete[] m_events;
+}
+
+void reactor::add(http_conn *conn)
+{
+    add_fd(m_epoll_fd, conn->sockfd());
+    start_timer(conn);
+}
+
+void reactor::want_read(http_conn *conn)
+{
+    modify_fd(m_epoll_fd, conn->sockfd(), EPOLLIN);
+}
+
+void reactor::want_write(http_conn *conn)
+{
+    modify_fd(m_epoll_fd, conn->sockfd(), EPOLLOUT);
+}
+
+bool reactor::remove(http_conn *conn)
+{
+    m_users[conn->sockfd()] = 0; // 关闭之前清除，套接字号被新连接复用时不会覆盖新的连接
+    remove_fd(m_epoll_fd, conn->sockfd());
+    return true;
+}
+
+// 接受新连接，连接之后的事件都注册在本反应堆的epoll上
+// 监听套接字是水平触发的，一次最多接受ACCEPT_BATCH个，剩下的在下一次epoll_wait后继续，不会饿死已有的连接
+void reactor::handle_accept()
+{
+    for (int i = 0; i < ACCEPT_BATCH; ++i)
+    {
+        struct sockaddr_in client_address;
+        socklen_t client_addrlength = sizeof(client_address);
+        long start = metric_now_ns();
+        int conn_fd = accept4(m_listen_fd, (struct sockaddr *)&client_address, &client_addrlength, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        io_stat_add(STAT_ACCEPT);
+
+        if (conn_fd < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) // 已经接受完
+                return;
+            if (errno == EINTR || errno == ECONNABORTED) // 连接在接受前已经被对方重置
+                continue;
+            if (accept_failed(errno)) // 暂停期间不再监听，到期后在run中恢复
+            {
+                epoll_event ev;
+                ev.data.fd = m_listen_fd;
+                ev.events = 0;
+                epoll_ctl(m_epoll_fd, EPOLL_CTL_MOD, m_listen_fd, &ev);
+                return;
+            }
+            continue;
+        }
+        if (!admit(conn_fd, client_address))
+        {
+            continue;
+        }
+        http_conn *conn = http_conn::create();
+        m_users[conn_fd] = conn;
+        conn->init(conn_fd, client_address, this);
+        metric_observe(STAGE_ACCEPT, metric_now_ns() - start);
+    }
+}
+
+void reactor::run()
+{
+    while (true)
+    {
+        int events_num = epoll_wait(m_epoll_fd, m_events, MAX_EVENT_NUMBER, timer_wait_ms());
+        io_stat_add(STAT_EPOLL_WAIT);
+
+        if (events_num < 0 && errno != EINTR)
+        {
+            printf("Reactor %d: Epoll Error!\n", m_id);
+            break;
+        }
+        for (int i = 0; i < events_num; i++)
+        {
+            int sock_fd = m_events[i].data.fd;
+
+            if (sock_fd == m_listen_fd)
+            {
+                handle_accept();
+                continue;
+            }
+            http_conn *conn = m_users[sock_fd];
+            if (!conn)
+            {
+                continue;
+            }
+            if (m_events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+            {
+                conn->close_conn();
+            }
+            else if (m_events[i].events & EPOLLIN)
+            {
+                if (conn->read())
+                {
+                    dispatch(conn);
+                }
+                else
+                {
+                    conn->close_conn();
+                }
+            }
+            else if (m_events[i].events & EPOLLOUT)
+            {
+                if (!conn->write())
+                {
+                    conn->close_conn();
+                }
+            }
+        }
+        expire_timers();
+        if (accept_resume())
+        {
+            epoll_event ev;
+            ev.data.fd = m_listen_fd;
+            ev.events = EPOLLIN;
+            epoll_ctl(m_epoll_fd, EPOLL_CTL_MOD, m_listen_fd, &ev);
+        }
+    }
+}
@@ -0,0 +1,30 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <sys/epoll.h>
+#include "event_backend.h"
+#include "http_conn.h"
+
+#define MAX_EVENT_NUMBER 60000 // 监听的最大的事件数量
+
+// 基于epoll的反应堆（默认后端）：边缘触发加EPOLLONESHOT，读写都在反应堆线程上完成
+class reactor : public event_backend
+{
+public:
+    reactor(int id, int port, int backlog, bool reuse_port, http_conn **users, thread_pool<http_conn> *pool, OVERLOAD_POLICY overload);
+    ~reactor();
+
+    void run();
+    void add(http_conn *conn);
+    void want_read(http_conn *conn);
+    void want_write(http_conn *conn);
+    bool remove(http_conn *conn);
+
+private:
+    void handle_accept();
+
+    int m_epoll_fd;
+    epoll_event *m_events;
+};
+
+#endif
@@ -0,0 +1,299 @@
+// HTTP/2的测试：RFC 7541附录C中请求示例的HPACK解码，以及已关闭的流上收到帧时的连接错误（RFC 9113 5.1）。
+// 连接测试通过socketpair驱动真实的http_conn，以连接前言直接开始HTTP/2。
+// 用法: h2_test，在仓库根目录下运行（资源目录为./resource）
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <string>
+#include <vector>
+#include "../http_conn.h"
+#include "../http2.h"
+#include "../hpack.h"
+
+static int failures = 0;
+
+#define CHECK(cond, ...)                  \
+    do                                    \
+    {                                     \
+        if (!(cond))                      \
+        {                                 \
+            printf("FAIL " __VA_ARGS__); \
+            printf("\n");                 \
+            failures++;                   \
+        }                                 \
+    } while (0)
+
+static std::string unhex(const char *hex)
+{
+    std::string s;
+    for (const char *p = hex; *p;)
+    {
+        if (*p == ' ')
+        {
+            ++p;
+            continue;
+        }
+        unsigned v;
+        sscanf(p, "%2x", &v);
+        s += (char)v;
+        p += 2;
+    }
+    return s;
+}
+
+// 一个头部块与解码后应得到的字段，字段以"name: value"表示
+struct hpack_case
+{
+    const char *name;
+    const char *hex;
+    const char *fields[6];
+};
+
+// 同一组中的头部块依次用同一个解码器解码，后面的块引用前面加入动态表的条目
+static void hpack_sequence(const hpack_case *cases, int count)
+{
+    hpack_decoder decoder;
+    for (int i = 0; i < count; ++i)
+    {
+        const hpack_case &c = cases[i];
+        std::string block = unhex(c.hex);
+        char out[1024];
+        header_field fields[16];
+        bool overflow = false;
+        int n = decoder.decode((const unsigned char *)block.data(), block.size(), out, sizeof(out), fields, 16, &overflow);
+        int want = 0;
+        while (want < 6 && c.fields[want])
+            want++;
+        CHECK(n == want && !overflow, "%s: decoded %d fields, want %d", c.name, n, want);
+        for (int j = 0; j < n && j < want; ++j)
+        {
+            std::string got = std::string(fields[j].name.data, fields[j].name.len) + ": " + std::string(fields[j].value.data, fields[j].value.len);
+            CHECK(got == c.fields[j], "%s: field %d is \"%s\", want \"%s\"", c.name, j, got.c_str(), c.fields[j]);
+        }
+    }
+}
+
+static void hpack_vectors()
+{
+    // C.2：每个示例都从空的动态表开始
+    static const hpack_case c2[] = {
+        {"C.2.1", "400a 6375 7374 6f6d 2d6b 6579 0d63 7573 746f 6d2d 6865 6164 6572", {"custom-key: custom-header"}},
+        {"C.2.2", "040c 2f73 616d 706c 652f 7061 7468", {":path: /sample/path"}},
+        {"C.2.3", "1008 7061 7373 776f 7264 0673 6563 7265 74", {"password: secret"}},
+        {"C.2.4", "82", {":method: GET"}},
+    };
+    for (int i = 0; i < 4; ++i)
+        hpack_sequence(&c2[i], 1);
+
+    // C.3：不使用Huffman编码的三个请求
+    static const hpack_case c3[] = {
+        {"C.3.1", "8286 8441 0f77 7777 2e65 7861 6d70 6c65 2e63 6f6d",
+         {":method: GET", ":scheme: http", ":path: /", ":authority: www.example.com"}},
+        {"C.3.2", "8286 84be 5808 6e6f 2d63 6163 6865",
+         {":method: GET", ":scheme: http", ":path: /", ":authority: www.example.com", "cache-control: no-cache"}},
+        {"C.3.3", "8287 85bf 400a 6375 7374 6f6d 2d6b 6579 0c63 7573 746f 6d2d 7661 6c75 65",
+         {":method: GET", ":scheme: https", ":path: /index.html", ":authority: www.example.com", "custom-key: custom-value"}},
+    };
+    hpack_sequence(c3, 3);
+
+    // C.4：同样的请求使用Huffman编码
+    static const hpack_case c4[] = {
+        {"C.4.1", "8286 8441 8cf1 e3c2 e5f2 3a6b a0ab 90f4 ff",
+         {":method: GET", ":scheme: http", ":path: /", ":authority: www.example.com"}},
+        {"C.4.2", "8286 84be 5886 a8eb 1064 9cbf",
+         {":method: GET", ":scheme: http", ":path: /", ":authority: www.example.com", "cache-control: no-cache"}},
+        {"C.4.3", "8287 85bf 4088 25a8 49e9 5ba9 7d7f 8925 a849 e95b b8e8 b4bf",
+         {":method: GET", ":scheme: https", ":path: /index.html", ":authority: www.example.com", "custom-key: custom-value"}},
+    };
+    hpack_sequence(c4, 3);
+
+    // 下标0与超出动态表的下标都是解码错误
+    static const char *const bad[] = {"80", "be", "4000"};
+    for (int i = 0; i < 3; ++i)
+    {
+        hpack_decoder decoder;
+        std::string block = unhex(bad[i]);
+        char out[64];
+        header_field fields[4];
+        bool overflow = false;
+        int n = decoder.decode((const unsigned char *)block.data(), block.size(), out, sizeof(out), fields, 4, &overflow);
+        CHECK(n < 0, "hpack %s: decoded %d fields, want an error", bad[i], n);
+    }
+}
+
+// 不监视任何事件的后端，只记下http_conn最后把连接交还到哪种状态
+class probe_backend : public event_backend
+{
+public:
+    enum STATE
+    {
+        WAIT_READ,
+        WAIT_WRITE,
+        CLOSED
+    };
+    STATE state;
+
+    probe_backend() : event_backend(0, 0, 1, false, 0, 0, OVERLOAD_INLINE), state(WAIT_READ) {}
+    void run() {}
+    void add(http_conn *) { state = WAIT_READ; }
+    void want_read(http_conn *) { state = WAIT_READ; }
+    void want_write(http_conn *) { state = WAIT_WRITE; }
+    bool remove(http_conn *conn)
+    {
+        state = CLOSED;
+        close(conn->sockfd());
+        return true;
+    }
+};
+
+static std::string frame(int type, int flags, uint32_t id, const std::string &payload)
+{
+    unsigned char h[H2_FRAME_HEADER];
+    h[0] = payload.size() >> 16;
+    h[1] = payload.size() >> 8;
+    h[2] = payload.size();
+    h[3] = type;
+    h[4] = flags;
+    h[5] = id >> 24;
+    h[6] = id >> 16;
+    h[7] = id >> 8;
+    h[8] = id;
+    return std::string((const char *)h, sizeof(h)) + payload;
+}
+
+// GET /，头部块只用静态表
+static std::string get_headers(uint32_t id, bool end_stream)
+{
+    return frame(H2_HEADERS, H2_FLAG_END_HEADERS | (end_stream ? H2_FLAG_END_STREAM : 0), id, unhex("8286 84"));
+}
+
+// 一个HTTP/2连接：每次送入一段数据，处理后收下服务器发出的全部帧
+class h2_client
+{
+public:
+    h2_client() : m_goaway(-1)
+    {
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, m_fds) < 0)
+        {
+            perror("socketpair");
+            exit(1);
+        }
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        m_conn = http_conn::create();
+        m_conn->init(m_fds[0], addr, &m_backend);
+        feed(std::string(H2_PREFACE, H2_PREFACE_LEN) + frame(H2_SETTINGS, 0, 0, ""));
+    }
+
+    ~h2_client()
+    {
+        if (m_backend.state != probe_backend::CLOSED)
+            m_conn->close_conn();
+        close(m_fds[1]);
+    }
+
+    void feed(const std::string &data)
+    {
+        if (m_backend.state == probe_backend::CLOSED)
+            return;
+        send(m_fds[1], data.data(), data.size(), MSG_NOSIGNAL);
+        if (!m_conn->read())
+        {
+            m_conn->close_conn();
+            return;
+        }
+        m_conn->process();
+        char buf[4096];
+        for (;;)
+        {
+            ssize_t n;
+            while ((n = recv(m_fds[1], buf, sizeof(buf), 0)) > 0)
+                m_in.append(buf, n);
+            if (m_backend.state != probe_backend::WAIT_WRITE)
+                break;
+            if (!m_conn->write())
+                m_conn->close_conn();
+        }
+        parse();
+    }
+
+    int goaway() const { return m_goaway; } // GOAWAY的错误码，没有收到时为-1
+    bool ended(uint32_t id) const           // 流上是否已经收到带END_STREAM的帧
+    {
+        for (size_t i = 0; i < m_ended.size(); ++i)
+            if (m_ended[i] == id)
+                return true;
+        return false;
+    }
+
+private:
+    void parse()
+    {
+        const unsigned char *p = (const unsigned char *)m_in.data();
+        size_t off = 0;
+        while (m_in.size() - off >= H2_FRAME_HEADER)
+        {
+            size_t len = (p[off] << 16) | (p[off + 1] << 8) | p[off + 2];
+            if (m_in.size() - off < H2_FRAME_HEADER + len)
+                break;
+            int type = p[off + 3], flags = p[off + 4];
+            uint32_t id = ((uint32_t)p[off + 5] << 24 | p[off + 6] << 16 | p[off + 7] << 8 | p[off + 8]) & 0x7fffffff;
+            const unsigned char *payload = p + off + H2_FRAME_HEADER;
+            if (type == H2_GOAWAY && len >= 8)
+                m_goaway = (payload[4] << 24) | (payload[5] << 16) | (payload[6] << 8) | payload[7];
+            if ((type == H2_DATA || type == H2_HEADERS) && (flags & H2_FLAG_END_STREAM))
+                m_ended.push_back(id);
+            off += H2_FRAME_HEADER + len;
+        }
+        m_in.erase(0, off);
+    }
+
+    int m_fds[2];
+    probe_backend m_backend;
+    http_conn *m_conn;
+    std::string m_in;
+    int m_goaway;
+    std::vector<uint32_t> m_ended;
+};
+
+// 流1的请求带END_STREAM，回答完毕后流1关闭，然后送入after
+static void after_closed(const char *name, const std::string &after, int want_goaway)
+{
+    h2_client c;
+    c.feed(get_headers(1, true));
+    CHECK(c.ended(1) && c.goaway() < 0, "%s: stream 1 was not answered", name);
+    c.feed(after);
+    CHECK(c.goaway() == want_goaway, "%s: GOAWAY error %d, want %d", name, c.goaway(), want_goaway);
+    if (want_goaway < 0) // 连接仍然可用
+    {
+        c.feed(get_headers(3, true));
+        CHECK(c.ended(3), "%s: stream 3 was not answered", name);
+    }
+}
+
+static void closed_streams()
+{
+    std::string inc = unhex("0000 0100");
+    after_closed("HEADERS on a closed stream", get_headers(1, true), H2_STREAM_CLOSED);
+    after_closed("trailers on a closed stream", frame(H2_HEADERS, H2_FLAG_END_HEADERS | H2_FLAG_END_STREAM, 1, unhex("4003 7a7a 7a01 31")), H2_STREAM_CLOSED);
+    after_closed("DATA on a closed stream", frame(H2_DATA, H2_FLAG_END_STREAM, 1, "x"), H2_STREAM_CLOSED);
+    after_closed("WINDOW_UPDATE on a closed stream", frame(H2_WINDOW_UPDATE, 0, 1, inc), -1);
+    after_closed("WINDOW_UPDATE on an idle stream", frame(H2_WINDOW_UPDATE, 0, 5, inc), H2_PROTOCOL_ERROR);
+    after_closed("PRIORITY on a closed stream", frame(H2_PRIORITY, 0, 1, unhex("0000 0000 10")), -1);
+
+    // 请求没有END_STREAM时，回答完毕后本端以RST_STREAM关闭流，对端随后到达的帧被忽略
+    h2_client c;
+    c.feed(get_headers(1, false));
+    CHECK(c.ended(1), "reset stream: stream 1 was not answered");
+    c.feed(frame(H2_DATA, 0, 1, "body") + frame(H2_HEADERS, H2_FLAG_END_HEADERS | H2_FLAG_END_STREAM, 1, unhex("4003 7a7a 7a01 31")));
+    CHECK(c.goaway() < 0, "reset stream: GOAWAY error %d for frames sent before the reset", c.goaway());
+}
+
+int main()
+{
+    hpack_vectors();
+    closed_streams();
+    printf("h2_test: %d failures\n", failures);
+    return failures ? 1 : 0;
+}
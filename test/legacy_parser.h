@@ -0,0 +1,275 @@
+#ifndef LEGACY_PARSER_H
+#define LEGACY_PARSER_H
+
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <string>
+#include <unordered_map>
+
+#define LEGACY_READ_BUFFER_SIZE 2048
+
+// 改造前逐字节扫描的请求解析状态机，仅用于差分测试。
+// 解析部分与原实现相同，只有三处改动：会让原实现崩溃的输入返回LEGACY_CRASH；
+// "/"不再用strcpy写回读缓冲区；do_request只按stat的结果给出状态码，不映射文件
+class legacy_parser
+{
+public:
+    enum HTTP_CODE
+    {
+        NO_REQUEST,        //请求不完整
+        GET_REQUEST,       //获得完整请求
+        BAD_REQUEST,       //错误请求
+        NO_RESOURCE,       //没有资源
+        FORBIDDEN_REQUEST, //无权限
+        FILE_REQUEST,      //成功获取文件
+        LEGACY_CRASH       //原实现在这里崩溃或抛出异常
+    };
+
+    legacy_parser(const char *doc_root) : m_doc_root(doc_root), m_read_idx(0), m_checked_idx(0), m_start_line(0), m_check_state(CHECK_STATE_REQUESTLINE), m_url(0), m_version(0) {}
+
+    // 追加收到的数据后重新解析，返回值同原来的process_read；缓冲区满时返回LEGACY_CRASH（原实现关闭连接）
+    HTTP_CODE feed(const char *data, int len)
+    {
+        if (m_read_idx + len > LEGACY_READ_BUFFER_SIZE)
+        {
+            return LEGACY_CRASH;
+        }
+        memcpy(m_read_buf + m_read_idx, data, len);
+        m_read_idx += len;
+        return process_read();
+    }
+
+    // 原实现在响应发送完毕后按Connection头决定是否保持连接
+    bool keep_alive()
+    {
+        return m_headers.find("Connection") != m_headers.end() && m_headers["Connection"] == "keep-alive";
+    }
+
+    static int status(HTTP_CODE code)
+    {
+        switch (code)
+        {
+        case BAD_REQUEST:
+            return 400;
+        case NO_RESOURCE:
+            return 404;
+        case FORBIDDEN_REQUEST:
+            return 403;
+        case FILE_REQUEST:
+            return 200;
+        default:
+            return 0;
+        }
+    }
+
+private:
+    enum CHECK_STATE
+    {
+        CHECK_STATE_REQUESTLINE, //正在分析请求行
+        CHECK_STATE_HEADER,      //正在分析头部字段
+        CHECK_STATE_CONTENT      //正在解析请求体
+    };
+    enum LINE_STATUS
+    {
+        LINE_OK,  //获得完整行
+        LINE_BAD, //出错
+        LINE_OPEN //行不完整
+    };
+
+    std::string m_doc_root;
+    char m_read_buf[LEGACY_READ_BUFFER_SIZE];
+    int m_read_idx, m_checked_idx, m_start_line;
+    CHECK_STATE m_check_state;
+    char *m_url, *m_version;
+    std::unordered_map<std::string, std::string> m_headers;
+
+    char *get_line() { return m_read_buf + m_start_line; }
+
+    static bool to_int(const std::string &s, int *out) // 原实现直接调用stoi，无法转换时抛出异常
+    {
+        try
+        {
+            *out = stoi(s);
+            return true;
+        }
+        catch (...)
+        {
+            return false;
+        }
+    }
+
+    HTTP_CODE process_read()
+    {
+        LINE_STATUS line_status = LINE_OK;
+        HTTP_CODE ret = NO_REQUEST;
+        char *text = 0;
+        while (((m_check_state == CHECK_STATE_CONTENT) && (line_status == LINE_OK)) || ((line_status = parse_line()) == LINE_OK))
+        {
+            text = get_line();
+            m_start_line = m_checked_idx;
+
+            switch (m_check_state)
+            {
+            case CHECK_STATE_REQUESTLINE:
+            {
+                ret = parse_request_line(text);
+                if (ret == BAD_REQUEST || ret == LEGACY_CRASH)
+                    return ret;
+                break;
+            }
+            case CHECK_STATE_HEADER:
+            {
+                ret = parse_headers(text);
+                if (ret == BAD_REQUEST || ret == LEGACY_CRASH)
+                    return ret;
+                else if (ret == GET_REQUEST)
+                    return do_request();
+                break;
+            }
+            case CHECK_STATE_CONTENT:
+            {
+                ret = parse_content(text);
+                if (ret == GET_REQUEST)
+                    return do_request();
+                line_status = LINE_OPEN;
+                break;
+            }
+            }
+        }
+        return NO_REQUEST;
+    }
+
+    LINE_STATUS parse_line()
+    {
+        char temp;
+        for (; m_checked_idx < m_read_idx; ++m_checked_idx)
+        {
+            temp = m_read_buf[m_checked_idx];
+            if (temp == '\r')
+            {
+                if ((m_checked_idx + 1) == m_read_idx)
+                {
+                    return LINE_OPEN;
+                }
+                else if (m_read_buf[m_checked_idx + 1] == '\n')
+                {
+                    m_read_buf[m_checked_idx++] = '\0';
+                    m_read_buf[m_checked_idx++] = '\0';
+                    return LINE_OK;
+                }
+                return LINE_BAD;
+            }
+            else if (temp == '\n')
+            {
+                if ((m_checked_idx > 1) && (m_read_buf[m_checked_idx - 1] == '\r'))
+                {
+                    m_read_buf[m_checked_idx - 1] = '\0';
+                    m_read_buf[m_checked_idx++] = '\0';
+                    return LINE_OK;
+                }
+                return LINE_BAD;
+            }
+        }
+        return LINE_OPEN;
+    }
+
+    HTTP_CODE parse_request_line(char *text)
+    {
+        m_url = strpbrk(text, " \t");
+        if (!m_url)
+        {
+            return BAD_REQUEST;
+        }
+        *m_url++ = '\0';
+
+        char *method = text;
+        if (strcasecmp(method, "GET") != 0)
+            return BAD_REQUEST;
+
+        m_version = strpbrk(m_url, " \t");
+        if (!m_version)
+        {
+            return BAD_REQUEST;
+        }
+        *m_version++ = '\0';
+        if (strcasecmp(m_version, "HTTP/1.1") != 0)
+        {
+            return BAD_REQUEST;
+        }
+
+        if (strncasecmp(m_url, "http://", 7) == 0)
+            m_url += 7;
+
+        m_url = strchr(m_url, '/');
+        if (!m_url)
+        {
+            return LEGACY_CRASH; // strcpy写入空指针
+        }
+        if (strlen(m_url) == 1)
+        {
+            m_url = (char *)"/index.html";
+        }
+        m_check_state = CHECK_STATE_HEADER;
+        return NO_REQUEST;
+    }
+
+    HTTP_CODE parse_headers(char *text)
+    {
+        if (text[0] == '\0')
+        {
+            int len;
+            if (m_headers.find("Content-Length") != m_headers.end())
+            {
+                if (!to_int(m_headers["Content-Length"], &len))
+                    return LEGACY_CRASH;
+                if (len > 0)
+                {
+                    m_check_state = CHECK_STATE_CONTENT;
+                    return NO_REQUEST;
+                }
+            }
+            return GET_REQUEST;
+        }
+        char *value = strpbrk(text, ":");
+        if (!value)
+        {
+            return LEGACY_CRASH; // 写入空指针
+        }
+        *value++ = '\0';
+        m_headers[text] = ++value; // 原实现跳过冒号后的一个字符，不论是不是空格
+        return NO_REQUEST;
+    }
+
+    HTTP_CODE parse_content(char *) // 原实现只比较已读入的长度，不看内容本身
+    {
+        int len = 0;
+        to_int(m_headers["Content-Length"], &len);
+        if (m_read_idx >= (len + m_checked_idx))
+        {
+            return GET_REQUEST;
+        }
+        return NO_REQUEST;
+    }
+
+    HTTP_CODE do_request()
+    {
+        std::string real_file = m_doc_root + m_url;
+        struct stat st;
+        if (stat(real_file.c_str(), &st) < 0)
+        {
+            return NO_RESOURCE;
+        }
+        if (!(st.st_mode & S_IROTH))
+        {
+            return FORBIDDEN_REQUEST;
+        }
+        if (S_ISDIR(st.st_mode))
+        {
+            return BAD_REQUEST;
+        }
+        return FILE_REQUEST;
+    }
+};
+
+#endif
@@ -0,0 +1,405 @@
+// 请求解析的差分测试：改造前的状态机（legacy_parser.h）与当前的http_conn对同一输入给出的结果比较。
+// 当前实现通过socketpair驱动真实的http_conn，请求分几段到达，检查增量解析；
+// 另外逐个比较向量化的find_either、known_header与parse_length和逐字节的参考实现。
+// 用法: parse_diff [cases] [seed]，在仓库根目录下运行（资源目录为./resource）
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/socket.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "../http_conn.h"
+#include "../http_scan.h"
+#include "legacy_parser.h"
+
+static int failures = 0;
+
+#define CHECK(cond, ...)                  \
+    do                                    \
+    {                                     \
+        if (!(cond))                      \
+        {                                 \
+            printf("FAIL " __VA_ARGS__); \
+            printf("\n");                 \
+            failures++;                   \
+        }                                 \
+    } while (0)
+
+static unsigned rand_state = 1;
+static unsigned next_rand()
+{
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 17;
+    rand_state ^= rand_state << 5;
+    return rand_state;
+}
+static int rand_below(int n) { return next_rand() % n; }
+
+// 不监视任何事件的后端，只记下http_conn最后把连接交还到哪种状态
+class probe_backend : public event_backend
+{
+public:
+    enum STATE
+    {
+        WAIT_READ,
+        WAIT_WRITE,
+        CLOSED
+    };
+    STATE state;
+
+    probe_backend() : event_backend(0, 0, 1, false, 0, 0, OVERLOAD_INLINE), state(WAIT_READ) {}
+    void run() {}
+    void add(http_conn *) { state = WAIT_READ; }
+    void want_read(http_conn *) { state = WAIT_READ; }
+    void want_write(http_conn *) { state = WAIT_WRITE; }
+    bool remove(http_conn *conn)
+    {
+        state = CLOSED;
+        close(conn->sockfd());
+        return true;
+    }
+};
+
+// 一个请求的结果：status为0表示请求还不完整，连接在等待更多数据
+struct outcome
+{
+    int status;
+    bool keep_alive;
+};
+
+static std::string describe(const std::string &req)
+{
+    std::string s;
+    for (size_t i = 0; i < req.size() && s.size() < 160; ++i)
+    {
+        char c = req[i];
+        if (c == '\r')
+            s += "\\r";
+        else if (c == '\n')
+            s += "\\n";
+        else if (c == '\t')
+            s += "\\t";
+        else
+            s += c;
+    }
+    return s;
+}
+
+static outcome run_legacy(const std::vector<std::string> &parts)
+{
+    legacy_parser parser(http_conn::doc_root());
+    legacy_parser::HTTP_CODE ret = legacy_parser::NO_REQUEST;
+    for (size_t i = 0; i < parts.size() && ret == legacy_parser::NO_REQUEST; ++i)
+        ret = parser.feed(parts[i].data(), parts[i].size());
+    outcome o = {0, false};
+    if (ret == legacy_parser::LEGACY_CRASH)
+        o.status = -1;
+    else if (ret != legacy_parser::NO_REQUEST)
+        o.status = legacy_parser::status(ret);
+    o.keep_alive = o.status > 0 && parser.keep_alive();
+    return o;
+}
+
+static outcome run_current(const std::vector<std::string> &parts)
+{
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds) < 0)
+    {
+        perror("socketpair");
+        exit(1);
+    }
+    probe_backend backend;
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    http_conn *conn = http_conn::create();
+    conn->init(fds[0], addr, &backend);
+
+    std::string response;
+    char buf[4096];
+    for (size_t i = 0; i < parts.size() && backend.state == probe_backend::WAIT_READ && response.empty(); ++i)
+    {
+        send(fds[1], parts[i].data(), parts[i].size(), MSG_NOSIGNAL);
+        if (!conn->read())
+        {
+            conn->close_conn();
+            break;
+        }
+        conn->process();
+        for (;;)
+        {
+            ssize_t n;
+            while ((n = recv(fds[1], buf, sizeof(buf), 0)) > 0)
+                response.append(buf, n);
+            if (backend.state != probe_backend::WAIT_WRITE)
+                break;
+            if (!conn->write())
+                conn->close_conn();
+        }
+    }
+
+    outcome o = {0, false};
+    if (!response.empty() && sscanf(response.c_str(), "HTTP/1.1 %d", &o.status) != 1)
+        o.status = -2;
+    o.keep_alive = o.status > 0 && backend.state == probe_backend::WAIT_READ;
+    if (backend.state != probe_backend::CLOSED)
+        conn->close_conn();
+    close(fds[1]);
+    return o;
+}
+
+// 把请求在随机位置切成1到4段，模拟分几次到达
+static std::vector<std::string> split(const std::string &req)
+{
+    std::vector<size_t> cuts;
+    int pieces = rand_below(4);
+    for (int i = 0; i < pieces; ++i)
+        cuts.push_back(1 + rand_below(req.size()));
+    cuts.push_back(req.size());
+    std::sort(cuts.begin(), cuts.end());
+    std::vector<std::string> parts;
+    size_t start = 0;
+    for (size_t i = 0; i < cuts.size(); ++i)
+    {
+        if (cuts[i] > start)
+            parts.push_back(req.substr(start, cuts[i] - start));
+        start = cuts[i];
+    }
+    return parts;
+}
+
+template <size_t N>
+static const char *pick(const char *const (&list)[N])
+{
+    return list[rand_below(N)];
+}
+
+// 生成的请求只使用两个实现本来就应当一致的语法；已知的有意差异放在adversarial中单独检查
+static std::string generate(const std::vector<std::string> &files)
+{
+    static const char *const methods[] = {"GET", "GET", "GET", "GET", "GET", "GET", "get", "Get", "HEAD", "DELETE", "GETX"};
+    static const char *const seps[] = {" ", " ", " ", "\t"};
+    static const char *const prefixes[] = {"", "", "", "http://localhost", "HTTP://example.com:8080", "https://h"};
+    static const char *const paths[] = {"/", "/index.html", "//index.html", "/./index.html", "/images", "/images/", "/images/../index.html",
+                                        "/images/./../index.html", "/missing.html", "/images/missing.png", "/a%20b", "/index.html.bak"};
+    static const char *const versions[] = {"HTTP/1.1", "HTTP/1.1", "HTTP/1.1", "HTTP/1.1", "HTTP/1.1", "http/1.1", "HTTP/1.0", "HTTP/1.10"};
+    static const char *const headers[] = {"Host: localhost", "User-Agent: parse_diff/1.0", "Accept: */*", "Accept-Language: en, zh;q=0.8",
+                                          "Connection: keep-alive", "Connection: close", "Cache-Control: no-cache", "X-Empty: ",
+                                          "X-Tabs: \ta\t", "Cookie: a=1; b=2"};
+
+    std::string path = rand_below(3) == 0 && !files.empty() ? files[rand_below(files.size())] : pick(paths);
+    std::string req = std::string(pick(methods)) + pick(seps) + pick(prefixes) + path + pick(seps) + pick(versions) + "\r\n";
+    int count = rand_below(7);
+    for (int i = 0; i < count; ++i)
+        req += std::string(pick(headers)) + "\r\n";
+    if (rand_below(6) == 0) // 接近读缓冲区一半的长请求头
+        req += "X-Long: " + std::string(600 + rand_below(300), 'x') + "\r\n";
+    std::string body;
+    if (rand_below(4) == 0)
+    {
+        int len = rand_below(24);
+        req += "Content-Length: " + std::to_string(len) + "\r\n";
+        body.assign(len, 'b');
+    }
+    return req + "\r\n" + body;
+}
+
+// 原实现会崩溃、永远等待或者被有意修改过的输入：分别给出两个实现各自应有的结果
+struct adversarial_case
+{
+    const char *request;
+    int legacy_status; // 0为等待更多数据，-1为原实现崩溃
+    bool legacy_keep;
+    int status;        // 当前实现应有的状态码
+    bool keep;
+};
+
+static const adversarial_case adversarial[] = {
+    {"GET / HTTP/1.1\n\n", 0, false, 400, false},                                         // 没有'\r'的行尾，原实现永远等待
+    {"GET / HTTP/1.1\r\r\n\r\n", 0, false, 400, false},                                   // '\r'后面不是'\n'
+    {"GET index.html HTTP/1.1\r\n\r\n", -1, false, 400, false},                           // URL中没有'/'
+    {"GET / HTTP/1.1\r\nNoColon\r\n\r\n", -1, false, 400, false},                         // 请求头没有':'
+    {"GET / HTTP/1.1\r\nContent-Length: abc\r\n\r\n", -1, false, 400, false},             // stoi抛出异常
+    {"GET / HTTP/1.1\r\nContent-Length: 2abc\r\n\r\nxx", 200, false, 400, false},         // 数字后面有多余字符
+    {"GET / HTTP/1.1\r\nContent-Length: -1\r\n\r\n", 200, false, 400, false},             // 负数
+    {"GET / HTTP/1.1\r\nConnection:keep-alive\r\n\r\n", 200, false, 200, true},           // 冒号后没有空格，原实现丢掉值的第一个字符
+    {"GET / HTTP/1.1\r\nconnection: keep-alive\r\n\r\n", 200, false, 200, true},          // 请求头名不区分大小写
+    {"GET / HTTP/1.1\r\nConnection: Keep-Alive\r\n\r\n", 200, false, 200, true},          // 值不区分大小写
+    {"GET / HTTP/1.1\r\ncontent-length: 2\r\n\r\n", 200, false, 0, false},                // 小写的Content-Length要等待请求体
+    {"GET /index.html?v=1 HTTP/1.1\r\n\r\n", 404, false, 200, false},                     // 查询串不是文件名的一部分
+    {"GET /index.html/ HTTP/1.1\r\n\r\n", 404, false, 200, false},                        // 规范化去掉末尾的'/'
+    {"GET /images/x/../../index.html HTTP/1.1\r\n\r\n", 404, false, 200, false},          // 按URL而不是按文件系统处理".."
+    {"GET /../index.html HTTP/1.1\r\n\r\n", 404, false, 400, false},                      // 越过资源根目录
+    {"GET /images HTTP/1.1\r\nConnection: keep-alive\r\n\r\n", 400, true, 400, false},    // 400之后总是关闭连接
+    {"POST / HTTP/1.1\r\nContent-Length: 1\r\n\r\nx", 400, false, 405, false},            // 没有配置上传目录
+    {"PUT /x HTTP/1.1\r\n\r\n", 400, false, 405, false},
+};
+
+static void differential(int cases)
+{
+    std::vector<std::string> files;
+    std::string images = std::string(http_conn::doc_root()) + "/images";
+    DIR *d = opendir(images.c_str());
+    while (d)
+    {
+        struct dirent *ent = readdir(d);
+        if (!ent)
+        {
+            closedir(d);
+            break;
+        }
+        if (ent->d_name[0] != '.')
+            files.push_back(std::string("/images/") + ent->d_name);
+    }
+
+    int compared = 0, ok = 0, bad = 0, missing = 0, kept = 0;
+    for (int i = 0; i < cases; ++i)
+    {
+        // 原实现的请求体跨两次读到达时永远等待（见split_body），所以它总是一次收到整个请求
+        std::string req = generate(files);
+        std::vector<std::string> parts = split(req);
+        outcome old_o = run_legacy(std::vector<std::string>(1, req));
+        outcome new_o = run_current(parts);
+        if (old_o.status == -1) // 生成的请求不应该让原实现崩溃
+        {
+            CHECK(false, "legacy crashed on generated request: %s", describe(req).c_str());
+            continue;
+        }
+        bool keep = old_o.keep_alive && old_o.status != 400; // 当前实现在400之后总是关闭连接
+        CHECK(old_o.status == new_o.status && keep == new_o.keep_alive, "%s (%zu parts): legacy %d%s, current %d%s", describe(req).c_str(), parts.size(),
+              old_o.status, keep ? " keep-alive" : "", new_o.status, new_o.keep_alive ? " keep-alive" : "");
+        compared++;
+        ok += old_o.status == 200;
+        bad += old_o.status == 400;
+        missing += old_o.status == 404;
+        kept += keep;
+    }
+    printf("parse_diff: %d generated requests compared (200: %d, 400: %d, 404: %d, keep-alive: %d)\n", compared, ok, bad, missing, kept);
+
+    for (size_t i = 0; i < sizeof(adversarial) / sizeof(adversarial[0]); ++i)
+    {
+        const adversarial_case &c = adversarial[i];
+        std::string req = c.request;
+        for (int round = 0; round < 4; ++round) // 整个到达与随机分段到达
+        {
+            std::vector<std::string> parts = round == 0 ? std::vector<std::string>(1, req) : split(req);
+            outcome old_o = run_legacy(std::vector<std::string>(1, req));
+            outcome new_o = run_current(parts);
+            CHECK(old_o.status == c.legacy_status && old_o.keep_alive == c.legacy_keep, "%s: legacy %d%s, expected %d", describe(req).c_str(),
+                  old_o.status, old_o.keep_alive ? " keep-alive" : "", c.legacy_status);
+            CHECK(new_o.status == c.status && new_o.keep_alive == c.keep, "%s: current %d%s, expected %d%s", describe(req).c_str(), new_o.status,
+                  new_o.keep_alive ? " keep-alive" : "", c.status, c.keep ? " keep-alive" : "");
+        }
+    }
+    printf("parse_diff: %zu adversarial requests checked\n", sizeof(adversarial) / sizeof(adversarial[0]));
+}
+
+// 请求体在中间被分开：原实现等待请求体时继续用parse_line扫描已经到达的部分，
+// m_checked_idx越过了请求体，剩下的部分到达后永远凑不够长度
+static void split_body()
+{
+    std::string head = "GET /index.html HTTP/1.1\r\nConnection: keep-alive\r\nContent-Length: 9\r\n\r\n";
+    for (int cut = 1; cut < 9; ++cut)
+    {
+        std::vector<std::string> parts;
+        parts.push_back(head + std::string(cut, 'b'));
+        parts.push_back(std::string(9 - cut, 'b'));
+        outcome old_o = run_legacy(parts);
+        outcome new_o = run_current(parts);
+        CHECK(old_o.status == 0, "legacy split body at %d: %d, expected to wait forever", cut, old_o.status);
+        CHECK(new_o.status == 200 && new_o.keep_alive, "split body at %d: current %d%s, expected 200 keep-alive", cut, new_o.status,
+              new_o.keep_alive ? " keep-alive" : "");
+    }
+    printf("parse_diff: request bodies split across reads checked\n");
+}
+
+// 在各种对齐和长度下，与逐字节查找比较；目标字节放在向量块的每个位置以及块之间的边界上
+static void scan_diff()
+{
+    static char buf[320];
+    int checked = 0;
+    for (int round = 0; round < 200; ++round)
+    {
+        for (size_t i = 0; i < sizeof(buf); ++i)
+            buf[i] = "abc \t:\r\n\x80\xff"[rand_below(4) == 0 ? rand_below(10) : 0];
+        for (int offset = 0; offset < 64; ++offset)
+        {
+            int len = rand_below(sizeof(buf) - offset);
+            const char *p = buf + offset, *end = p + len;
+            char a = "\r \t:\x80"[rand_below(5)], b = "\n\t:\xff\r"[rand_below(5)];
+            const char *expect = p;
+            while (expect < end && *expect != a && *expect != b)
+                ++expect;
+            CHECK(find_either(p, end, a, b) == expect, "find_either(%s) offset %d len %d: got %ld, want %ld", http_scan_impl(), offset, len,
+                  (long)(find_either(p, end, a, b) - p), (long)(expect - p));
+            checked++;
+        }
+    }
+    // 只有一个目标字节，依次放在每个位置上
+    for (int len = 0; len <= 96; ++len)
+    {
+        for (int at = 0; at <= len; ++at)
+        {
+            memset(buf, 'x', sizeof(buf));
+            if (at < len)
+                buf[at] = '\n';
+            CHECK(find_eol(buf, buf + len) == buf + at, "find_eol len %d at %d", len, at);
+            checked++;
+        }
+    }
+    printf("parse_diff: %d find_either checks (%s)\n", checked, http_scan_impl());
+}
+
+static void header_diff()
+{
+    static const char *const names[] = {"Connection", "Content-Length", "Host", "Accept-Encoding", "If-None-Match", "If-Modified-Since", "Range",
+                                        "If-Range", "Upgrade", "HTTP2-Settings", "Transfer-Encoding", "Expect"};
+    static const char *const others[] = {"Connectio", "Connections", "Content-Type", "Hosts", "X-Host", "Accept", "Range-", "", "-", "Expect:"};
+    for (int id = 0; id < HEADER_NUM; ++id)
+    {
+        std::string name = names[id];
+        for (int round = 0; round < 8; ++round)
+        {
+            for (size_t i = 0; i < name.size(); ++i) // 随机改变大小写
+                name[i] = rand_below(2) ? toupper(name[i]) : tolower(name[i]);
+            CHECK(known_header(name.data(), name.size()) == id, "known_header(%s) != %d", name.c_str(), id);
+        }
+    }
+    for (size_t i = 0; i < sizeof(others) / sizeof(others[0]); ++i)
+        CHECK(known_header(others[i], strlen(others[i])) == -1, "known_header(%s) should be -1", others[i]);
+
+    static const char *const lengths[] = {"0", "7", "0012", "9223372036854775807", "9223372036854775808", "", "-1", "+1", "1 ", "1a", "99999999999999999999"};
+    for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); ++i)
+    {
+        const char *s = lengths[i];
+        // 参考：只含数字、非空、不溢出
+        bool ok = *s != '\0' && strspn(s, "0123456789") == strlen(s);
+        errno = 0;
+        long want = ok ? strtol(s, NULL, 10) : 0;
+        ok = ok && errno == 0;
+        str_view v = {s, (int)strlen(s)};
+        long got = -1;
+        bool parsed = parse_length(v, &got);
+        CHECK(parsed == ok && (!ok || got == want), "parse_length(\"%s\"): got %d %ld, want %d %ld", s, parsed, got, ok, want);
+    }
+    printf("parse_diff: known_header and parse_length checked\n");
+}
+
+int main(int argc, char *argv[])
+{
+    int cases = argc > 1 ? atoi(argv[1]) : 3000;
+    rand_state = argc > 2 ? atoi(argv[2]) : 20261018;
+    if (rand_state == 0)
+        rand_state = 1;
+    scan_diff();
+    header_diff();
+    differential(cases);
+    split_body();
+    printf("parse_diff: %d failures\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,58 @@
+// file_cache::normalize_url的测试：规范化结果与越过资源根目录的拒绝
+// 用法: url_test
+#include <stdio.h>
+#include <string.h>
+#include "../file_cache.h"
+
+struct url_case
+{
+    const char *url;
+    const char *expect; // NULL表示应当被拒绝
+};
+
+static const url_case cases[] = {
+    {"/", "/"},
+    {"/index.html", "/index.html"},
+    {"//a///b/", "/a/b"},
+    {"/a/./b/.", "/a/b"},
+    {"/a/b?x=1#y", "/a/b"},
+    {"/a/..", "/"},
+    {"/images/../index.html", "/index.html"},
+    {"/images/x/../../index.html", "/index.html"},
+    {"/a/b/../..", "/"},
+    {"/a/b/../../", "/"},
+    {"/x/y/../../z", "/z"},
+    {"/a/bb/ccc/../../d", "/a/d"},
+    {"/a/../..", NULL},
+    {"/..", NULL},
+    {"/a/b/../../..", NULL},
+    {"/../index.html", NULL},
+    {"a/b", NULL},
+};
+
+int main()
+{
+    int failed = 0;
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i)
+    {
+        const url_case &c = cases[i];
+        // 先用垃圾数据填满输出缓冲区，结果不能依赖其中原有的内容
+        char out[64];
+        memset(out, '/', sizeof(out));
+        bool ok = file_cache::normalize_url(c.url, out, sizeof(out));
+        if (ok != (c.expect != NULL) || (ok && strcmp(out, c.expect) != 0))
+        {
+            printf("FAIL %s: got %s, want %s\n", c.url, ok ? out : "(rejected)", c.expect ? c.expect : "(rejected)");
+            failed++;
+        }
+    }
+    // 输出缓冲区放不下时拒绝
+    char small[4];
+    if (file_cache::normalize_url("/abcd", small, sizeof(small)))
+    {
+        printf("FAIL /abcd: accepted into a 4-byte buffer\n");
+        failed++;
+    }
+    printf("url_test: %zu cases, %d failed\n", sizeof(cases) / sizeof(cases[0]) + 1, failed);
+    return failed ? 1 : 0;
+}
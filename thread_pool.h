@@ -2,127 +2,508 @@
 #define THREAD_POOL_H
 
 #include <stdio.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
 #include <pthread.h>
-#include <list>
+#include <sched.h>
 #include <exception>
+#include <atomic>
 #include <semaphore.h>
+#include "work_steal_deque.h"
+#include "mpmc_ring.h"
+#include "cpu_affinity.h"
 
 #define NUM_THREADS 16     // 默认线程数量
 #define MAX_REQUESTS 60000 // 默认最大请求队列长度
+#define SPIN_ROUNDS 64     // 工作线程休眠前自旋查找任务的轮数
+#define INJECT_BATCH 32    // 工作线程一次从注入队列搬入本地队列的最大任务数
+#define POOL_ADJUST_MS 100       // 自适应伸缩检查队列的间隔
+#define POOL_GROW_DEPTH 4        // 默认：平均每个工作线程排队的任务数超过该值时增加线程
+#define POOL_GROW_WAIT_MS 20     // 默认：估计的排队时间超过该值时增加线程
+#define POOL_IDLE_RETIRE_S 30    // 默认：工作线程连续空闲这么久后停用
 
-// 线程池
+static inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield" ::: "memory");
+#endif
+}
+
+// 自适应伸缩的参数；max_threads不大于初始线程数时线程数固定
+struct pool_sizing
+{
+    int max_threads;
+    int grow_depth;   // 平均每个线程排队的任务数上限
+    int grow_wait_ms; // 估计的排队时间上限，按队列长度除以最近的完成速率估计
+    int idle_s;       // 空闲线程退出前等待的秒数，线程数不低于初始线程数
+};
+
+// 线程池：每个工作线程拥有一个本地工作窃取队列，外部线程通过无锁注入队列提交任务
+// 工作线程依次从本地队列、注入队列、其他线程的本地队列获取任务，都为空时短暂自旋后休眠
+// 给出cpus时工作线程只在这些CPU上运行；NUMA机器上每个节点一个线程池，由同一节点的反应堆提交任务
+// 给出sizing时由一个调节线程定期检查队列，排队过多时增加线程直到上限，空闲线程过一段时间后停用；
+// 停用的线程不退出而是在自己的信号量上等待，再次增加线程时优先唤醒它们。线程从不退出，
+// 文件缓存、统计与访问日志按线程分配的槽位总数不超过各线程池的线程数上限
 template <typename T>
 class thread_pool
 {
 public:
-    thread_pool(int thread_number = NUM_THREADS, int max_requests = MAX_REQUESTS);
+    thread_pool(int thread_number = NUM_THREADS, int max_requests = MAX_REQUESTS, const cpu_set_t *cpus = NULL, const pool_sizing *sizing = NULL);
     ~thread_pool();
-    bool append(T *request); // 添加任务到任务队列
+    bool append(T *request); // 添加任务到任务队列，队列满时返回false
+    size_t queue_size() const; // 注入队列与各本地队列中等待的任务数，近似值
+    size_t queue_capacity() const { return m_inject.capacity(); } // 注入队列的容量，max_requests向上取整为2的幂
+
+    // 所有线程池汇总：当前的工作线程数，自适应伸缩增加和退出的线程数
+    static long total_threads() { return s_threads.load(std::memory_order_relaxed); }
+    static size_t total_queue_size(); // 所有线程池中等待的任务数之和，近似值
+    static unsigned long total_started() { return s_started.load(std::memory_order_relaxed); }
+    static unsigned long total_retired() { return s_retired.load(std::memory_order_relaxed); }
 
 private:
-    int m_thread_number, m_max_requests;
-    pthread_t *m_threads;        // 线程数组
-    std::list<T *> m_task_queue; // 任务队列
-    pthread_mutex_t m_task_queue_mutex;
-    sem_t m_task_queue_sem;
-    bool m_stop;
+    enum WORKER_STATE
+    {
+        WORKER_EMPTY,   // 没有线程
+        WORKER_RUNNING,
+        WORKER_RETIRED  // 线程已经停用，在wake上等待调节线程重新启用
+    };
+
+    struct worker
+    {
+        work_steal_deque<T> deque; // 本地任务队列
+        thread_pool *pool;
+        int index;
+        unsigned rand_state; // 选择窃取目标用的随机数状态
+        pthread_t thread;
+        sem_t wake; // 停用的线程在此等待
+        std::atomic<int> state;
+        std::atomic<unsigned long> done; // 处理完的任务数，只有所属线程写入
+    };
+
+    int m_thread_number;
+    int m_max_threads; // 工作线程槽位数，固定大小时等于m_thread_number
+    int m_node; // 所有工作线程都绑定在同一节点上时为该节点，否则为-1
+    worker *m_workers; // 工作线程数组，所有槽位一次分配，窃取时遍历全部槽位
+    std::atomic<int> m_running; // 正在运行的工作线程数
+
+    mpmc_ring<T> m_inject; // 注入队列，外部线程提交的任务
+
+    sem_t m_park_sem;                // 休眠的工作线程在此等待
+    std::atomic<int> m_sleepers;     // 正在休眠（或准备休眠）的工作线程数
+    std::atomic<bool> m_stop;
+
+    pthread_attr_t m_attr; // 创建工作线程用的属性，包括绑定的CPU
+    pool_sizing m_sizing;
+    pthread_t m_adjuster;
+    bool m_adaptive;
+
+    static std::atomic<long> s_threads;
+    static std::atomic<unsigned long> s_started, s_retired;
+    static std::atomic<thread_pool *> s_pools[NUMA_MAX_NODES]; // 存在的线程池，每个节点一个，汇总队列长度用
+
+    T *find_task(worker *self);
+    void wake_one();
+    bool unregister_sleeper();
+    bool start_worker(worker *w); // 启用一个槽位：唤醒停用的线程，没有线程时创建
+    void park(worker *self);      // 休眠等待任务，空闲太久并且线程数高于初始值时停用，直到被重新启用
+    void adjust(unsigned long &last_done);
 
     static void *thread_func_static(void *arg);
-    void thread_func();
+    void thread_func(worker *self);
+    static void *adjuster_func_static(void *arg);
 };
 
 template <typename T>
-thread_pool<T>::thread_pool(int thread_number, int max_requests) : m_thread_number(thread_number), m_max_requests(max_requests), m_stop(false)
+std::atomic<long> thread_pool<T>::s_threads(0);
+template <typename T>
+std::atomic<unsigned long> thread_pool<T>::s_started(0);
+template <typename T>
+std::atomic<unsigned long> thread_pool<T>::s_retired(0);
+template <typename T>
+std::atomic<thread_pool<T> *> thread_pool<T>::s_pools[NUMA_MAX_NODES];
+
+template <typename T>
+thread_pool<T>::thread_pool(int thread_number, int max_requests, const cpu_set_t *cpus, const pool_sizing *sizing)
+    : m_thread_number(thread_number), m_max_threads(thread_number), m_node(-1), m_running(0),
+      m_inject(max_requests > 0 ? max_requests : 1), m_sleepers(0), m_stop(false), m_adaptive(false)
 {
     if ((thread_number <= 0) || (max_requests <= 0))
     {
         throw std::exception();
     }
+    if (sizing && sizing->max_threads > thread_number)
+    {
+        m_sizing = *sizing;
+        m_max_threads = sizing->max_threads;
+        m_adaptive = true;
+    }
 
-    m_threads = new pthread_t[m_thread_number];
-    if (!m_threads)
+    if (sem_init(&m_park_sem, 0, 0) != 0)
     {
         throw std::exception();
     }
+
+    // 线程创建时就绑定，栈和线程局部数据从一开始就在所属节点上
+    pthread_attr_init(&m_attr);
+    m_node = affinity_attr(&m_attr, cpus);
+
+    m_workers = new worker[m_max_threads];
+    for (int i = 0; i < m_max_threads; ++i)
+    {
+        m_workers[i].pool = this;
+        m_workers[i].index = i;
+        m_workers[i].rand_state = 2654435761u * (i + 1);
+        m_workers[i].state = WORKER_EMPTY;
+        m_workers[i].done = 0;
+        sem_init(&m_workers[i].wake, 0, 0);
+    }
     for (int i = 0; i < thread_number; ++i)
     {
-        if (pthread_create(m_threads + i, NULL, thread_func_static, this) != 0)
-        {
-            delete[] m_threads;
-            throw std::exception();
-        }
-        if (pthread_detach(m_threads[i]))
+        if (!start_worker(m_workers + i))
         {
-            delete[] m_threads;
+            m_stop = true;
+            for (int j = 0; j < i; ++j)
+                sem_post(&m_park_sem);
+            for (int j = 0; j < i; ++j)
+                pthread_join(m_workers[j].thread, NULL);
+            s_threads -= i;
+            for (int j = 0; j < m_max_threads; ++j)
+                sem_destroy(&m_workers[j].wake);
+            delete[] m_workers;
+            pthread_attr_destroy(&m_attr);
+            sem_destroy(&m_park_sem);
             throw std::exception();
         }
     }
-    printf("Create %d threads successfully!\n", thread_number);
-
-    if (pthread_mutex_init(&m_task_queue_mutex, NULL) != 0)
+    if (m_adaptive && pthread_create(&m_adjuster, NULL, adjuster_func_static, this) != 0)
     {
-        throw std::exception();
+        m_adaptive = false; // 没有调节线程时保持初始线程数
     }
-    if (sem_init(&m_task_queue_sem, 0, 0) != 0)
+    for (int i = 0; i < NUMA_MAX_NODES; ++i)
     {
-        throw std::exception();
+        thread_pool *empty = 0;
+        if (s_pools[i].compare_exchange_strong(empty, this))
+            break;
     }
+    printf("Create %d threads successfully!\n", thread_number);
 }
 
 template <typename T>
 thread_pool<T>::~thread_pool()
 {
+    for (int i = 0; i < NUMA_MAX_NODES; ++i)
+    {
+        thread_pool *self = this;
+        if (s_pools[i].compare_exchange_strong(self, 0))
+            break;
+    }
     m_stop = true;
-    delete[] m_threads;
-    pthread_mutex_destroy(&m_task_queue_mutex);
-    sem_destroy(&m_task_queue_sem);
+    if (m_adaptive)
+        pthread_join(m_adjuster, NULL);
+    for (int i = 0; i < m_max_threads; ++i)
+    {
+        sem_post(&m_park_sem);
+        sem_post(&m_workers[i].wake);
+    }
+    for (int i = 0; i < m_max_threads; ++i)
+    {
+        if (m_workers[i].state.load() != WORKER_EMPTY)
+            pthread_join(m_workers[i].thread, NULL);
+    }
+    s_threads -= m_running.load();
+    for (int i = 0; i < m_max_threads; ++i)
+        sem_destroy(&m_workers[i].wake);
+    delete[] m_workers;
+    pthread_attr_destroy(&m_attr);
+    sem_destroy(&m_park_sem);
+}
+
+template <typename T>
+bool thread_pool<T>::start_worker(worker *w)
+{
+    if (w->state.load() == WORKER_RETIRED)
+    {
+        w->state = WORKER_RUNNING;
+        m_running++;
+        s_threads++;
+        sem_post(&w->wake);
+        return true;
+    }
+    w->state = WORKER_RUNNING;
+    m_running++;
+    if (pthread_create(&w->thread, &m_attr, thread_func_static, w) != 0)
+    {
+        m_running--;
+        w->state = WORKER_EMPTY;
+        return false;
+    }
+    s_threads++;
+    return true;
+}
+
+template <typename T>
+size_t thread_pool<T>::queue_size() const
+{
+    size_t size = m_inject.size();
+    for (int i = 0; i < m_max_threads; ++i)
+        size += m_workers[i].deque.size();
+    return size;
+}
+
+// 线程池只在所有反应堆停止后才销毁，汇总时不会遇到正在销毁的线程池
+template <typename T>
+size_t thread_pool<T>::total_queue_size()
+{
+    size_t size = 0;
+    for (int i = 0; i < NUMA_MAX_NODES; ++i)
+    {
+        thread_pool *pool = s_pools[i].load();
+        if (pool)
+            size += pool->queue_size();
+    }
+    return size;
+}
+
+// 唤醒一个休眠的工作线程
+template <typename T>
+void thread_pool<T>::wake_one()
+{
+    int sleepers = m_sleepers.load(std::memory_order_seq_cst);
+    while (sleepers > 0)
+    {
+        if (m_sleepers.compare_exchange_weak(sleepers, sleepers - 1, std::memory_order_seq_cst))
+        {
+            sem_post(&m_park_sem);
+            return;
+        }
+    }
+}
+
+// 撤销自己的休眠登记；返回false表示已经有人为唤醒一个线程减过计数，对应的sem_post必须由自己消费
+template <typename T>
+bool thread_pool<T>::unregister_sleeper()
+{
+    int sleepers = m_sleepers.load(std::memory_order_seq_cst);
+    while (sleepers > 0)
+    {
+        if (m_sleepers.compare_exchange_weak(sleepers, sleepers - 1, std::memory_order_seq_cst))
+            return true;
+    }
+    return false;
 }
 
 template <typename T>
 bool thread_pool<T>::append(T *request)
 {
-    pthread_mutex_lock(&m_task_queue_mutex);
-    if (m_task_queue.size() > m_max_requests)
+    if (!m_inject.push(request))
     {
-        pthread_mutex_unlock(&m_task_queue_mutex);
         return false;
     }
-    m_task_queue.push_back(request);
-    pthread_mutex_unlock(&m_task_queue_mutex);
-    sem_post(&m_task_queue_sem);
+    wake_one();
     return true;
 }
 
+// 依次查找本地队列、注入队列和其他工作线程的本地队列
 template <typename T>
-void *thread_pool<T>::thread_func_static(void *arg)
+T *thread_pool<T>::find_task(worker *self)
+{
+    T *request = self->deque.pop();
+    if (request)
+        return request;
+
+    request = m_inject.pop();
+    if (request)
+    {
+        // 注入队列积压时搬一批到本地队列，空闲的工作线程可以从这里窃取
+        size_t backlog = m_inject.size();
+        long batch = backlog / m_running.load(std::memory_order_relaxed);
+        if (batch > INJECT_BATCH)
+            batch = INJECT_BATCH;
+        if (batch > self->deque.free_slots())
+            batch = self->deque.free_slots();
+        bool moved = false;
+        for (long i = 0; i < batch; ++i)
+        {
+            T *next = m_inject.pop();
+            if (!next)
+                break;
+            self->deque.push(next);
+            moved = true;
+        }
+        if (moved)
+            wake_one();
+        return request;
+    }
+
+    // 已经退出的线程的本地队列为空，窃取时直接跳过
+    if (m_max_threads > 1)
+    {
+        unsigned x = self->rand_state; // xorshift
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        self->rand_state = x;
+        int start = x % m_max_threads;
+        for (int i = 0; i < m_max_threads; ++i)
+        {
+            worker *victim = m_workers + (start + i) % m_max_threads;
+            if (victim == self)
+                continue;
+            request = victim->deque.steal();
+            if (request)
+                return request;
+        }
+    }
+    return 0;
+}
+
+// 已经登记为休眠、复查也没有任务时调用。固定大小时一直等到被唤醒；
+// 自适应时最多等idle_s秒，超时后撤销登记，线程数高于初始值时停用，等到调节线程重新启用或线程池析构
+template <typename T>
+void thread_pool<T>::park(worker *self)
+{
+    if (!m_adaptive)
+    {
+        sem_wait(&m_park_sem);
+        return;
+    }
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += m_sizing.idle_s;
+    while (sem_timedwait(&m_park_sem, &deadline) != 0)
+    {
+        if (errno == EINTR)
+            continue;
+        if (!unregister_sleeper()) // 唤醒已经在路上
+        {
+            sem_wait(&m_park_sem);
+            return;
+        }
+        int running = m_running.load();
+        while (running > m_thread_number && !m_stop)
+        {
+            if (m_running.compare_exchange_weak(running, running - 1))
+            {
+                s_threads--;
+                s_retired++;
+                printf("Thread pool: worker %d retired after %d s idle, %d threads\n", self->index, m_sizing.idle_s, running - 1);
+                self->state = WORKER_RETIRED;
+                while (sem_wait(&self->wake) != 0 && errno == EINTR)
+                    ;
+                return;
+            }
+        }
+        return; // 已经是最少的线程数，重新登记后继续等待
+    }
+}
+
+// 排队时间按Little定律估计：队列长度除以上一个间隔内的完成速率；完成速率为0而队列不空时，
+// 说明所有线程都阻塞在处理中，同样需要增加线程。有线程在休眠时积压不是线程不够造成的
+template <typename T>
+void thread_pool<T>::adjust(unsigned long &last_done)
+{
+    unsigned long done = 0;
+    for (int i = 0; i < m_max_threads; ++i)
+        done += m_workers[i].done.load(std::memory_order_relaxed);
+    unsigned long completed = done - last_done;
+    last_done = done;
+
+    long depth = queue_size();
+    int running = m_running.load();
+    if (depth == 0 || running >= m_max_threads || m_sleepers.load() > 0)
+    {
+        return;
+    }
+    long wait_ms = completed ? depth * POOL_ADJUST_MS / completed : LONG_MAX;
+    if (depth <= (long)running * m_sizing.grow_depth && wait_ms <= m_sizing.grow_wait_ms)
+    {
+        return;
+    }
+    int grow = running / 4 > 1 ? running / 4 : 1;
+    if (grow > m_max_threads - running)
+        grow = m_max_threads - running;
+    // 先重新启用停用的线程，不够时才创建新线程
+    int started = 0;
+    for (int i = 0; i < m_max_threads && started < grow; ++i)
+    {
+        if (m_workers[i].state.load() == WORKER_RETIRED && start_worker(m_workers + i))
+            started++;
+    }
+    for (int i = 0; i < m_max_threads && started < grow; ++i)
+    {
+        if (m_workers[i].state.load() == WORKER_EMPTY && start_worker(m_workers + i))
+            started++;
+    }
+    if (started > 0)
+    {
+        s_started += started;
+        if (wait_ms == LONG_MAX)
+            printf("Thread pool: %d -> %d threads (queue %ld, no completions)\n", running, running + started, depth);
+        else
+            printf("Thread pool: %d -> %d threads (queue %ld, wait ~%ld ms)\n", running, running + started, depth, wait_ms);
+    }
+}
+
+template <typename T>
+void *thread_pool<T>::adjuster_func_static(void *arg)
 {
     thread_pool *pool = (thread_pool *)arg;
-    pool->thread_func();
+    unsigned long last_done = 0;
+    struct timespec interval = {0, POOL_ADJUST_MS * 1000000L};
+    while (!pool->m_stop)
+    {
+        nanosleep(&interval, NULL);
+        pool->adjust(last_done);
+    }
     return pool;
 }
 
 template <typename T>
-void thread_pool<T>::thread_func()
+void *thread_pool<T>::thread_func_static(void *arg)
 {
+    worker *self = (worker *)arg;
+    self->pool->thread_func(self);
+    return self->pool;
+}
 
+template <typename T>
+void thread_pool<T>::thread_func(worker *self)
+{
+    if (m_node >= 0)
+    {
+        numa_set_thread_node(m_node);
+    }
     while (!m_stop)
     {
-        sem_wait(&m_task_queue_sem);
-        pthread_mutex_lock(&m_task_queue_mutex);
-        if (m_task_queue.empty())
+        T *request = 0;
+        for (int spin = 0; spin < SPIN_ROUNDS && !request && !m_stop; ++spin)
         {
-            pthread_mutex_unlock(&m_task_queue_mutex);
-            continue;
+            request = find_task(self);
+            if (!request)
+                cpu_relax();
         }
-        T *request = m_task_queue.front();
-        m_task_queue.pop_front();
-        pthread_mutex_unlock(&m_task_queue_mutex);
         if (!request)
         {
-            continue;
+            // 先登记为休眠再复查一次，避免与append之间丢失唤醒
+            m_sleepers.fetch_add(1, std::memory_order_seq_cst);
+            request = find_task(self);
+            if (request)
+            {
+                if (!unregister_sleeper()) // 唤醒已经在路上，消费掉对应的sem_post，否则下次休眠会被它直接唤醒
+                    sem_wait(&m_park_sem);
+            }
+            else
+            {
+                park(self);
+                continue;
+            }
         }
         request->process();
+        self->done.store(self->done.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
     }
 }
 
-#endif
\ No newline at end of file
+#endif
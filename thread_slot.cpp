@@ -0,0 +1,21 @@
+#include "thread_slot.h"
+
+static std::atomic<int> next_thread_slot(0);
+
+int thread_slot()
+{
+    static thread_local int slot = -2; // -2表示还没有分配
+    if (slot == -2)
+    {
+        int s = next_thread_slot.fetch_add(1);
+        slot = s < MAX_THREAD_SLOTS ? s : -1;
+    }
+    return slot;
+}
+
+// 编号先分配再使用，汇总方看到的数量可能包含还没有写入槽位的线程
+int thread_slot_count()
+{
+    int n = next_thread_slot.load();
+    return n < MAX_THREAD_SLOTS ? n : MAX_THREAD_SLOTS;
+}
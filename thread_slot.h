@@ -0,0 +1,14 @@
+#ifndef THREAD_SLOT_H
+#define THREAD_SLOT_H
+
+#include <atomic>
+
+#define MAX_THREAD_SLOTS 1024 // 按线程分开的计数、日志队列与冒险指针最多支持的线程数
+
+// 进程内的线程编号：线程第一次调用时分配，从0开始连续递增，线程退出后不回收。
+// 指标、系统调用统计、访问日志与缓存的冒险指针都按这个编号找自己的槽位，
+// 超过MAX_THREAD_SLOTS的线程得到-1，由各模块决定共用一个槽位还是跳过
+int thread_slot();
+int thread_slot_count(); // 已经分配的编号数，不超过MAX_THREAD_SLOTS
+
+#endif
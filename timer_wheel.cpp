@@ -0,0 +1,184 @@
+#include "timer_wheel.h"
+
+#define TIMER_ROOT_MASK ((1 << TIMER_ROOT_BITS) - 1)
+#define TIMER_LEVEL_MASK ((1 << TIMER_LEVEL_BITS) - 1)
+#define TIMER_MAX_TICKS ((1UL << (TIMER_ROOT_BITS + (TIMER_LEVELS - 1) * TIMER_LEVEL_BITS)) - 1)
+
+static void init_head(timer_node *head)
+{
+    head->prev = head;
+    head->next = head;
+}
+
+timer_wheel::timer_wheel() : m_current(0), m_count(0), m_free(0)
+{
+    for (int i = 0; i <= TIMER_ROOT_MASK; ++i)
+        init_head(&m_root[i]);
+    for (int l = 0; l < TIMER_LEVELS - 1; ++l)
+        for (int i = 0; i <= TIMER_LEVEL_MASK; ++i)
+            init_head(&m_levels[l][i]);
+    m_current = tick_of(now_ms());
+}
+
+timer_wheel::~timer_wheel()
+{
+    for (size_t i = 0; i < m_chunks.size(); ++i)
+        delete[] m_chunks[i];
+}
+
+long timer_wheel::now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts); // vDSO实现，不进入内核
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
+
+// 按距离到期的刻度数放入对应层的槽中
+void timer_wheel::link(timer_node *node)
+{
+    long idx = (long)(node->expires - m_current);
+    timer_node *head = 0;
+    if (idx < 0) // 已经到期，下一个刻度处理
+    {
+        head = &m_root[m_current & TIMER_ROOT_MASK];
+    }
+    else if (idx <= TIMER_ROOT_MASK)
+    {
+        head = &m_root[node->expires & TIMER_ROOT_MASK];
+    }
+    else
+    {
+        if ((unsigned long)idx > TIMER_MAX_TICKS)
+        {
+            node->expires = m_current + TIMER_MAX_TICKS;
+            idx = TIMER_MAX_TICKS;
+        }
+        for (int l = 0; l < TIMER_LEVELS - 1; ++l)
+        {
+            int shift = TIMER_ROOT_BITS + l * TIMER_LEVEL_BITS;
+            if ((unsigned long)idx < (1UL << (shift + TIMER_LEVEL_BITS)))
+            {
+                head = &m_levels[l][(node->expires >> shift) & TIMER_LEVEL_MASK];
+                break;
+            }
+        }
+    }
+    node->next = head;
+    node->prev = head->prev;
+    head->prev->next = node;
+    head->prev = node;
+}
+
+void timer_wheel::unlink(timer_node *node)
+{
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    node->prev = 0;
+    node->next = 0;
+}
+
+// 把上层的一个槽按剩余时间重新分散到下层
+void timer_wheel::cascade(int level, int index)
+{
+    timer_node *head = &m_levels[level][index];
+    timer_node *node = head->next;
+    init_head(head);
+    while (node != head)
+    {
+        timer_node *next = node->next;
+        link(node);
+        node = next;
+    }
+}
+
+timer_node *timer_wheel::add(long timeout_ms, void *data, unsigned gen)
+{
+    if (!m_free)
+    {
+        timer_node *chunk = new timer_node[TIMER_NODE_CHUNK];
+        m_chunks.push_back(chunk);
+        for (int i = 0; i < TIMER_NODE_CHUNK; ++i)
+        {
+            chunk[i].next = m_free;
+            m_free = chunk + i;
+        }
+    }
+    timer_node *node = m_free;
+    m_free = node->next;
+    node->prev = 0;
+    node->data = data;
+    node->gen = gen;
+    reschedule(node, timeout_ms);
+    return node;
+}
+
+void timer_wheel::reschedule(timer_node *node, long timeout_ms)
+{
+    if (node->prev)
+    {
+        unlink(node);
+        m_count--;
+    }
+    if (timeout_ms < 0)
+    {
+        timeout_ms = 0;
+    }
+    else if (timeout_ms > (long)TIMER_MAX_TICKS * TIMER_TICK_MS)
+    {
+        timeout_ms = (long)TIMER_MAX_TICKS * TIMER_TICK_MS;
+    }
+    node->expires = tick_of(now_ms() + timeout_ms + TIMER_TICK_MS - 1); // 向上取整，不会提前到期
+    link(node);
+    m_count++;
+}
+
+void timer_wheel::remove(timer_node *node)
+{
+    if (node->prev)
+    {
+        unlink(node);
+        m_count--;
+    }
+    node->next = m_free;
+    m_free = node;
+}
+
+timer_node *timer_wheel::expire()
+{
+    unsigned long now = tick_of(now_ms());
+    if (m_count == 0) // 空轮直接跳到当前时间
+    {
+        m_current = now + 1;
+        return 0;
+    }
+
+    timer_node *expired = 0;
+    timer_node **tail = &expired;
+    while ((long)(now - m_current) >= 0)
+    {
+        int index = m_current & TIMER_ROOT_MASK;
+        if (index == 0) // 第0层转完一圈，从上层取下一个槽
+        {
+            for (int l = 0; l < TIMER_LEVELS - 1; ++l)
+            {
+                int slot = (m_current >> (TIMER_ROOT_BITS + l * TIMER_LEVEL_BITS)) & TIMER_LEVEL_MASK;
+                cascade(l, slot);
+                if (slot != 0)
+                    break;
+            }
+        }
+
+        timer_node *head = &m_root[index];
+        while (head->next != head)
+        {
+            timer_node *node = head->next;
+            unlink(node);
+            m_count--;
+            *tail = node;
+            tail = &node->next;
+        }
+        m_current++;
+    }
+    *tail = 0;
+    return expired;
+}
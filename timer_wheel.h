@@ -0,0 +1,58 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <time.h>
+#include <vector>
+
+#define TIMER_TICK_MS 100   // 时间轮的精度
+#define TIMER_ROOT_BITS 8   // 第0层256个槽，覆盖25.6秒
+#define TIMER_LEVEL_BITS 6  // 其余每层64个槽
+#define TIMER_LEVELS 4      // 共4层，最长约77天，更远的定时器按最长时间处理
+#define TIMER_NODE_CHUNK 1024 // 定时器节点每次分配的个数
+
+// 定时器节点，由时间轮分配和回收
+struct timer_node
+{
+    timer_node *prev;
+    timer_node *next;
+    unsigned long expires; // 到期的刻度
+    void *data;            // 使用者的数据
+    unsigned gen;          // 使用者的代数，用于识别已经被复用的数据
+};
+
+// 分层时间轮（与Linux内核早期的定时器相同）：添加、删除、重新调度都是O(1)，
+// 第0层每个刻度处理一个槽，转完一圈时把上一层的一个槽按剩余时间分散到下层。
+// 不是线程安全的，只能在所属的反应堆线程上使用
+class timer_wheel
+{
+public:
+    timer_wheel();
+    ~timer_wheel();
+
+    timer_node *add(long timeout_ms, void *data, unsigned gen); // 分配节点并在timeout_ms后到期
+    void reschedule(timer_node *node, long timeout_ms);           // 已到期或仍在轮中的节点改为timeout_ms后到期
+    void remove(timer_node *node);                               // 删除并回收节点
+
+    // 推进到当前时间，返回到期节点组成的链表（通过next连接）；
+    // 返回的节点已经不在轮中，使用者必须对每个节点调用reschedule或remove
+    timer_node *expire();
+
+    bool empty() const { return m_count == 0; }
+    static long now_ms(); // 单调时钟的毫秒数
+
+private:
+    void link(timer_node *node);
+    void unlink(timer_node *node);
+    void cascade(int level, int index);
+    unsigned long tick_of(long ms) const { return (unsigned long)(ms / TIMER_TICK_MS); }
+
+    timer_node m_root[1 << TIMER_ROOT_BITS];                     // 第0层，每个槽是带哨兵的双向循环链表
+    timer_node m_levels[TIMER_LEVELS - 1][1 << TIMER_LEVEL_BITS]; // 第1到3层
+    unsigned long m_current;                                      // 下一个要处理的刻度
+    long m_count;                                                 // 轮中的节点数
+
+    timer_node *m_free;                  // 回收的节点
+    std::vector<timer_node *> m_chunks;  // 分配的节点块
+};
+
+#endif
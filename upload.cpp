@@ -0,0 +1,266 @@
+#include "upload.h"
+#include <fcntl.h>
+#include <ctype.h>
+
+static const char continue_100[] = "HTTP/1.1 100 Continue\r\n\r\n";
+
+upload_state::upload_state()
+    : fd(-1), chunked(false), existed(false), state(UPLOAD_DATA), left(0), total(0), body_offset(0)
+{
+    pipe[0] = pipe[1] = -1;
+    temp[0] = '\0';
+    target[0] = '\0';
+}
+
+upload_state::~upload_state()
+{
+    if (fd >= 0)
+        close(fd);
+    if (pipe[0] >= 0)
+    {
+        close(pipe[0]);
+        close(pipe[1]);
+    }
+    if (temp[0])
+        unlink(temp);
+}
+
+void http_conn::free_upload()
+{
+    if (m_upload)
+    {
+        delete m_upload;
+        m_upload = 0;
+    }
+}
+
+// 只接受上传目录之下的文件；目标所在的目录必须已经存在，不会自动创建
+http_conn::HTTP_CODE http_conn::start_upload(const char *key)
+{
+    size_t dir_len = strlen(m_upload_dir);
+    if (dir_len == 0 || strncmp(key, m_upload_dir, dir_len) != 0 || key[dir_len] != '/' || key[dir_len + 1] == '\0')
+    {
+        return METHOD_NOT_ALLOWED;
+    }
+    const str_view &coding = m_known[HEADER_TRANSFER_ENCODING];
+    if (coding.data && (!view_ieq(coding, "chunked") || m_known[HEADER_CONTENT_LENGTH].data))
+    {
+        return BAD_REQUEST;
+    }
+    if (!coding.data && !m_known[HEADER_CONTENT_LENGTH].data)
+    {
+        return LENGTH_REQUIRED;
+    }
+    if (m_content_length > m_upload_max)
+    {
+        return PAYLOAD_TOO_LARGE;
+    }
+
+    upload_state *u = m_upload = new upload_state();
+    if (snprintf(u->target, sizeof(u->target), "%s%s", doc_root(), key) >= (int)sizeof(u->target))
+    {
+        free_upload();
+        return BAD_REQUEST;
+    }
+    struct stat st;
+    io_stat_add(STAT_FILE);
+    if (stat(u->target, &st) == 0)
+    {
+        if (!S_ISREG(st.st_mode))
+        {
+            free_upload();
+            return BAD_REQUEST;
+        }
+        u->existed = true;
+    }
+    // 临时文件与目标在同一个目录中，改名是原子的
+    const char *name = strrchr(u->target, '/') + 1;
+    if (snprintf(u->temp, sizeof(u->temp), "%.*s.%s.XXXXXX", (int)(name - u->target), u->target, name) >= (int)sizeof(u->temp))
+    {
+        u->temp[0] = '\0';
+        free_upload();
+        return BAD_REQUEST;
+    }
+    u->fd = mkostemp(u->temp, O_CLOEXEC);
+    io_stat_add(STAT_FILE, 2);
+    if (u->fd < 0)
+    {
+        HTTP_CODE ret = errno == ENOENT || errno == ENOTDIR ? NO_RESOURCE : errno == EACCES ? FORBIDDEN_REQUEST : INTERNAL_ERROR;
+        u->temp[0] = '\0';
+        free_upload();
+        return ret;
+    }
+    fchmod(u->fd, 0644); // mkostemp创建的文件只有所有者可读，上传后的文件要能被GET访问
+    if (pipe2(u->pipe, O_CLOEXEC) < 0)
+    {
+        free_upload();
+        return INTERNAL_ERROR;
+    }
+    u->chunked = coding.data != 0;
+    u->state = u->chunked ? UPLOAD_SIZE : UPLOAD_DATA;
+    u->left = u->chunked ? 0 : m_content_length;
+    u->body_offset = m_checked_idx - m_request_start;
+
+    // 客户端等待100 Continue才发送请求体；这一批前面还有没发出的响应时不能插到它们前面，
+    // 由客户端等待超时后自己发送
+    if (view_ieq(m_known[HEADER_EXPECT], "100-continue") && m_read_idx == m_checked_idx && bytes_to_send == 0)
+    {
+        send(m_sockfd, continue_100, sizeof(continue_100) - 1, MSG_NOSIGNAL);
+        io_stat_add(STAT_SEND);
+    }
+    return receive_upload();
+}
+
+http_conn::HTTP_CODE http_conn::receive_upload()
+{
+    HTTP_CODE ret = splice_upload();
+    if (ret != NO_REQUEST)
+    {
+        free_upload();
+    }
+    return ret;
+}
+
+// 分块格式的行要在用户空间解析：先窥视套接字中的数据，只取到行尾为止，块数据留给splice
+int http_conn::read_chunk_line()
+{
+    int space = std::min(m_read_size - m_read_idx, UPLOAD_LINE_MAX);
+    if (space <= 0 || m_read_idx - m_checked_idx >= UPLOAD_LINE_MAX) // 行太长
+    {
+        return -1;
+    }
+    char *p = m_read_buf + m_read_idx;
+    int n = recv(m_sockfd, p, space, MSG_PEEK);
+    io_stat_add(STAT_RECV);
+    if (n <= 0)
+    {
+        return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    }
+    const char *lf = (const char *)memchr(p, '\n', n);
+    if (lf)
+        n = lf - p + 1;
+    n = recv(m_sockfd, p, n, 0);
+    io_stat_add(STAT_RECV);
+    if (n <= 0)
+    {
+        return -1;
+    }
+    m_read_idx += n;
+    return 1;
+}
+
+// 随请求头一起读到的那部分请求体从读缓冲区写入，之后的数据经过管道从套接字直接搬到文件
+http_conn::HTTP_CODE http_conn::splice_upload()
+{
+    upload_state *u = m_upload;
+    while (u->state != UPLOAD_DONE)
+    {
+        int buffered = m_read_idx - m_checked_idx;
+        if (buffered == 0 && m_read_idx > m_request_start + u->body_offset) // 格式行已经处理完，重新使用这部分空间
+        {
+            m_read_idx = m_checked_idx = m_request_start + u->body_offset;
+        }
+        if (u->state == UPLOAD_DATA)
+        {
+            if (u->left == 0)
+            {
+                u->state = u->chunked ? UPLOAD_DATA_END : UPLOAD_DONE;
+                continue;
+            }
+            long n;
+            if (buffered > 0)
+            {
+                n = ::write(u->fd, m_read_buf + m_checked_idx, std::min((long)buffered, u->left));
+                io_stat_add(STAT_FILE);
+                if (n <= 0)
+                    return INTERNAL_ERROR;
+                m_checked_idx += n;
+            }
+            else
+            {
+                n = splice(m_sockfd, NULL, u->pipe[1], NULL, std::min(u->left, (long)UPLOAD_SPLICE_SIZE), SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+                io_stat_add(STAT_RECV);
+                if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                {
+                    return NO_REQUEST;
+                }
+                if (n <= 0) // 请求体结束之前连接被关闭
+                {
+                    return BAD_REQUEST;
+                }
+                for (long moved = 0; moved < n;)
+                {
+                    long m = splice(u->pipe[0], NULL, u->fd, NULL, n - moved, SPLICE_F_MOVE);
+                    io_stat_add(STAT_FILE);
+                    if (m <= 0)
+                        return INTERNAL_ERROR;
+                    moved += m;
+                }
+            }
+            u->left -= n;
+            u->total += n;
+            continue;
+        }
+
+        // 其余状态按行解析，行在读缓冲区中不完整时从套接字再取
+        char *line = m_read_buf + m_checked_idx;
+        char *lf = (char *)memchr(line, '\n', buffered);
+        if (!lf)
+        {
+            int ret = read_chunk_line();
+            if (ret < 0)
+                return BAD_REQUEST;
+            if (ret == 0)
+                return NO_REQUEST;
+            continue;
+        }
+        if (lf == line || lf[-1] != '\r')
+        {
+            return BAD_REQUEST;
+        }
+        char *line_end = lf - 1;
+        m_checked_idx = lf + 1 - m_read_buf;
+        if (u->state == UPLOAD_SIZE)
+        {
+            // 块长度是十六进制，后面可以有";"开始的扩展
+            long size = 0;
+            char *p = line;
+            for (; p < line_end && isxdigit((unsigned char)*p); ++p)
+            {
+                if (size > (LONG_MAX >> 4))
+                    return BAD_REQUEST;
+                size = size * 16 + (isdigit((unsigned char)*p) ? *p - '0' : (*p | 0x20) - 'a' + 10);
+            }
+            if (p == line || (p < line_end && *p != ';' && *p != ' ' && *p != '\t'))
+            {
+                return BAD_REQUEST;
+            }
+            if (size > m_upload_max - u->total)
+            {
+                return PAYLOAD_TOO_LARGE;
+            }
+            u->left = size;
+            u->state = size > 0 ? UPLOAD_DATA : UPLOAD_TRAILER;
+        }
+        else if (u->state == UPLOAD_DATA_END)
+        {
+            if (line_end != line)
+                return BAD_REQUEST;
+            u->state = UPLOAD_SIZE;
+        }
+        else if (line_end == line) // 尾部字段被忽略，空行结束请求体
+        {
+            u->state = UPLOAD_DONE;
+        }
+    }
+
+    io_stat_add(STAT_FILE, 2);
+    int fd = u->fd;
+    u->fd = -1;
+    if (close(fd) < 0 || rename(u->temp, u->target) < 0)
+    {
+        return INTERNAL_ERROR;
+    }
+    u->temp[0] = '\0';
+    return u->existed ? UPLOAD_REPLACED : UPLOAD_CREATED;
+}
@@ -0,0 +1,39 @@
+#ifndef UPLOAD_H
+#define UPLOAD_H
+
+#include "http_conn.h"
+
+#define UPLOAD_MAX_MB 64              // 默认：一个请求体的最大长度（MB）
+#define UPLOAD_SPLICE_SIZE (64 << 10) // 每次从套接字搬到管道的最多字节数，与管道的默认容量相同
+#define UPLOAD_LINE_MAX 256           // 分块长度行与尾部字段行的最大长度
+
+// 请求体的解码状态
+enum UPLOAD_STATE
+{
+    UPLOAD_DATA,     // 请求体数据：Content-Length的整个请求体或者一个块的数据
+    UPLOAD_SIZE,     // 块长度行
+    UPLOAD_DATA_END, // 块数据之后的"\r\n"
+    UPLOAD_TRAILER,  // 最后一个块之后的尾部字段，空行结束
+    UPLOAD_DONE
+};
+
+// 正在接收的上传：请求体先写入目标目录中的临时文件，完整收到后改名为目标文件，
+// 读者和缓存永远看不到写了一半的文件
+struct upload_state
+{
+    int fd;          // 临时文件
+    int pipe[2];     // 套接字到文件的splice经过的管道
+    bool chunked;
+    bool existed;    // 目标文件原来就存在：完成后回答204，否则201
+    UPLOAD_STATE state;
+    long left;       // 当前块（或整个请求体）还没有收到的字节数
+    long total;      // 已经写入文件的字节数
+    int body_offset; // 请求体在读缓冲区中相对请求开头的位置，分块的格式行处理完后从这里重新使用读缓冲区
+    char temp[PATH_MAX];
+    char target[PATH_MAX];
+
+    upload_state();
+    ~upload_state(); // 没有完成的上传删除临时文件
+};
+
+#endif
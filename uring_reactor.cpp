@@ -0,0 +1,596 @@
+#include "uring_reactor.h"
+
+static int io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+uring_reactor::uring_reactor(int id, int port, int backlog, bool reuse_port, http_conn **users, thread_pool<http_conn> *pool, OVERLOAD_POLICY overload)
+    : event_backend(id, port, backlog, reuse_port, users, pool, overload), m_sqe_tail(0), m_sqe_flushed(0),
+      m_thread(pthread_self()), m_notify(MAX_FD), m_sleeping(false), m_timer_armed(false)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_COOP_TASKRUN;
+    m_ring_fd = io_uring_setup(URING_ENTRIES, &params);
+    if (m_ring_fd < 0 && errno == EINVAL) // 旧内核不支持COOP_TASKRUN
+    {
+        memset(&params, 0, sizeof(params));
+        m_ring_fd = io_uring_setup(URING_ENTRIES, &params);
+    }
+    if (m_ring_fd < 0)
+    {
+        throw std::exception();
+    }
+
+    // 映射提交队列、完成队列和提交项数组
+    m_sq_entries = params.sq_entries;
+    m_sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    m_cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (m_cq_size > m_sq_size)
+            m_sq_size = m_cq_size;
+        m_cq_size = m_sq_size;
+    }
+    m_sq_ptr = mmap(0, m_sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_SQ_RING);
+    if (m_sq_ptr == MAP_FAILED)
+    {
+        close(m_ring_fd);
+        throw std::exception();
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        m_cq_ptr = m_sq_ptr;
+    }
+    else
+    {
+        m_cq_ptr = mmap(0, m_cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_CQ_RING);
+        if (m_cq_ptr == MAP_FAILED)
+        {
+            munmap(m_sq_ptr, m_sq_size);
+            close(m_ring_fd);
+            throw std::exception();
+        }
+    }
+    m_sqes = (struct io_uring_sqe *)mmap(0, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_SQES);
+    if (m_sqes == MAP_FAILED)
+    {
+        if (m_cq_ptr != m_sq_ptr)
+            munmap(m_cq_ptr, m_cq_size);
+        munmap(m_sq_ptr, m_sq_size);
+        close(m_ring_fd);
+        throw std::exception();
+    }
+
+    char *sq = (char *)m_sq_ptr;
+    m_sq_head = (unsigned *)(sq + params.sq_off.head);
+    m_sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    m_sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    m_sq_array = (unsigned *)(sq + params.sq_off.array);
+    for (unsigned i = 0; i < m_sq_entries; ++i) // 提交项与数组下标一一对应
+        m_sq_array[i] = i;
+    m_sqe_tail = m_sqe_flushed = *m_sq_tail;
+
+    char *cq = (char *)m_cq_ptr;
+    m_cq_head = (unsigned *)(cq + params.cq_off.head);
+    m_cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    m_cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    m_cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    // 接收缓冲区通过PROVIDE_BUFFERS交给内核，recv时由内核从中挑选，随第一次io_uring_enter一起提交
+    // 没有使用注册缓冲区环（IORING_REGISTER_PBUF_RING）：在6.18内核上注册返回成功，但无论环由用户映射
+    // 还是由内核分配（IOU_PBUF_RING_MMAP），带IOSQE_BUFFER_SELECT的recv都返回-ENOBUFS，且注册后偶发
+    // 环所在页面不可写；PROVIDE_BUFFERS归还缓冲区多占一个提交项，但与接收的提交合并在同一次io_uring_enter中
+    m_buffers = new char[(size_t)URING_BUFFERS * READ_BUFFER_SIZE];
+    provide_buffers(0, URING_BUFFERS);
+
+    m_wake_fd = eventfd(0, EFD_CLOEXEC);
+    if (m_wake_fd < 0)
+    {
+        throw std::exception();
+    }
+
+    m_conns = new conn_state[MAX_FD];
+    for (int i = 0; i < MAX_FD; ++i)
+    {
+        m_conns[i].requests.store(0, std::memory_order_relaxed);
+        m_conns[i].gen = 0;
+        m_conns[i].send_armed = false;
+        m_conns[i].recv_armed = false;
+        m_conns[i].poll_armed = false;
+        m_conns[i].poll_in_armed = false;
+        m_conns[i].closing = 0;
+    }
+}
+
+uring_reactor::~uring_reactor()
+{
+    close(m_wake_fd);
+    munmap(m_sqes, m_sq_entries * sizeof(struct io_uring_sqe));
+    if (m_cq_ptr != m_sq_ptr)
+        munmap(m_cq_ptr, m_cq_size);
+    munmap(m_sq_ptr, m_sq_size);
+    close(m_ring_fd);
+    delete[] m_buffers;
+    delete[] m_conns;
+}
+
+// 取一个空闲的提交项，提交队列满时先交给内核
+struct io_uring_sqe *uring_reactor::get_sqe()
+{
+    unsigned head = __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+    if (m_sqe_tail - head >= m_sq_entries)
+    {
+        submit(0);
+    }
+    struct io_uring_sqe *sqe = &m_sqes[m_sqe_tail & *m_sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    m_sqe_tail++;
+    return sqe;
+}
+
+// 提交所有已填写的提交项，并等待至少wait_nr个完成事件
+int uring_reactor::submit(unsigned wait_nr)
+{
+    unsigned to_submit = m_sqe_tail - m_sqe_flushed;
+    if (to_submit == 0 && wait_nr == 0)
+    {
+        return 0;
+    }
+    __atomic_store_n(m_sq_tail, m_sqe_tail, __ATOMIC_RELEASE);
+    m_sqe_flushed = m_sqe_tail;
+    io_stat_add(STAT_URING_ENTER);
+    return io_uring_enter(m_ring_fd, to_submit, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0);
+}
+
+// 把从bid开始的count个缓冲区还给内核
+void uring_reactor::provide_buffers(int bid, int count)
+{
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+    sqe->fd = count;
+    sqe->addr = (unsigned long)(m_buffers + (size_t)bid * READ_BUFFER_SIZE);
+    sqe->len = READ_BUFFER_SIZE;
+    sqe->off = bid;
+    sqe->buf_group = URING_BUFFER_GROUP;
+    sqe->user_data = pack(OP_PROVIDE, 0, bid);
+}
+
+void uring_reactor::arm_accept()
+{
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = m_listen_fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->user_data = pack(OP_ACCEPT, 0, m_listen_fd);
+}
+
+void uring_reactor::arm_listen_poll()
+{
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = m_listen_fd;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = pack(OP_LISTEN, 0, m_listen_fd);
+}
+
+void uring_reactor::arm_wake()
+{
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = m_wake_fd;
+    sqe->addr = (unsigned long)&m_wake_buf;
+    sqe->len = sizeof(m_wake_buf);
+    sqe->user_data = pack(OP_WAKE, 0, m_wake_fd);
+}
+
+// 时间轮不为空时每个刻度唤醒一次事件循环
+void uring_reactor::arm_timer()
+{
+    m_timer_ts.tv_sec = 0;
+    m_timer_ts.tv_nsec = TIMER_TICK_MS * 1000000L;
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->fd = -1;
+    sqe->addr = (unsigned long)&m_timer_ts;
+    sqe->len = 1;
+    sqe->user_data = pack(OP_TIMER, 0, 0);
+    m_timer_armed = true;
+}
+
+void uring_reactor::arm_recv(int fd)
+{
+    http_conn *conn = m_users[fd];
+    if (conn->read_space() <= 0) // 读缓冲区已满仍然没有完整的请求
+    {
+        conn->close_conn();
+        return;
+    }
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->len = conn->read_space();
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUFFER_GROUP;
+    sqe->user_data = pack(OP_RECV, m_conns[fd].gen, fd);
+    m_conns[fd].recv_armed = true;
+}
+
+// 一批响应的响应头和内存中的响应体用一个sendmsg发送，没有写完时重新提交剩余部分
+// 不用IOSQE_IO_LINK把多个send串起来：一个sendmsg的iovec已经覆盖整批响应，链接的send遇到短写时
+// 链上后面的发送会被取消（-ECANCELED），仍要重新提交剩余部分，只多占提交项
+void uring_reactor::arm_send(int fd)
+{
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long)m_users[fd]->pending_msg();
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = pack(OP_SEND, m_conns[fd].gen, fd);
+    m_conns[fd].send_armed = true;
+}
+
+// sendfile发送的响应体仍由http_conn::write()完成，这里只等待套接字可写
+void uring_reactor::arm_poll_out(int fd)
+{
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = POLLOUT;
+    sqe->user_data = pack(OP_POLL_OUT, m_conns[fd].gen, fd);
+    m_conns[fd].poll_armed = true;
+}
+
+// 上传的请求体由工作线程splice到文件，不能先被recv读到提供的缓冲区中，这里只等待套接字可读
+void uring_reactor::arm_poll_in(int fd)
+{
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = pack(OP_POLL_IN, m_conns[fd].gen, fd);
+    m_conns[fd].poll_in_armed = true;
+}
+
+// 按user_data取消，其中带有连接的代数，不会误取消复用同一套接字号的新连接的操作
+void uring_reactor::cancel(int op, int fd)
+{
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = pack(op, m_conns[fd].gen, fd);
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_ALL;
+    sqe->user_data = pack(OP_CANCEL, 0, fd);
+}
+
+// 取消该连接上仍在进行的每个操作后关闭套接字，之后到达的完成事件因为代数不同被丢弃。
+// 发送仍在进行时内核还会读取连接的写缓冲和响应体，套接字和连接对象保留到发送的完成事件到达，返回false；
+// 套接字没有关闭，这期间套接字号不会被新连接复用
+bool uring_reactor::close_fd(int fd, http_conn *conn)
+{
+    conn_state &st = m_conns[fd];
+    if (st.recv_armed)
+        cancel(OP_RECV, fd);
+    if (st.poll_armed)
+        cancel(OP_POLL_OUT, fd);
+    if (st.poll_in_armed)
+        cancel(OP_POLL_IN, fd);
+    bool sending = st.send_armed && conn;
+    if (sending)
+    {
+        cancel(OP_SEND, fd);
+        st.closing = conn;
+    }
+    st.gen++;
+    st.send_armed = false;
+    st.recv_armed = false;
+    st.poll_armed = false;
+    st.poll_in_armed = false;
+    m_users[fd] = 0;
+    if (!sending)
+    {
+        close(fd);
+        io_stat_add(STAT_SOCKET);
+    }
+    return !sending;
+}
+
+void uring_reactor::add(http_conn *conn)
+{
+    start_timer(conn);
+    arm_recv(conn->sockfd());
+}
+
+// 由工作线程调用时只记录请求，真正的提交在反应堆线程上完成
+void uring_reactor::notify(http_conn *conn, int request)
+{
+    conn_state *st = m_conns + conn->sockfd();
+    int prev = st->requests.fetch_or(request, std::memory_order_seq_cst);
+    if (prev != 0) // 已经在通知队列中
+    {
+        return;
+    }
+    m_notify.push(st);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_sleeping.load(std::memory_order_seq_cst) && m_sleeping.exchange(false))
+    {
+        eventfd_write(m_wake_fd, 1);
+    }
+}
+
+void uring_reactor::want_read(http_conn *conn)
+{
+    notify(conn, REQ_READ);
+}
+
+void uring_reactor::want_write(http_conn *conn)
+{
+    notify(conn, REQ_WRITE);
+}
+
+bool uring_reactor::remove(http_conn *conn)
+{
+    if (pthread_equal(pthread_self(), m_thread))
+    {
+        return close_fd(conn->sockfd(), conn);
+    }
+    // 工作线程处理连接时没有进行中的发送。套接字由反应堆关闭，在此之前套接字号不会被复用；
+    // 连接对象随后就被归还，通知之前先清除
+    m_users[conn->sockfd()] = 0;
+    notify(conn, REQ_CLOSE);
+    return true;
+}
+
+void uring_reactor::handle_requests()
+{
+    conn_state *st;
+    while ((st = m_notify.pop()) != 0)
+    {
+        int fd = st - m_conns;
+        int requests = st->requests.exchange(0, std::memory_order_seq_cst);
+        http_conn *conn = m_users[fd];
+        if (requests & REQ_CLOSE)
+        {
+            close_fd(fd, 0);
+        }
+        else if (!conn)
+        {
+            continue;
+        }
+        else if (requests & REQ_WRITE)
+        {
+            if (conn->body_in_file())
+                arm_poll_out(fd);
+            else
+                arm_send(fd);
+        }
+        else if (requests & REQ_READ)
+        {
+            if (conn->body_streaming())
+                arm_poll_in(fd);
+            else
+                arm_recv(fd);
+        }
+    }
+}
+
+void uring_reactor::handle_accept(int res, unsigned flags)
+{
+    long start = metric_now_ns();
+    io_stat_add(STAT_ACCEPT);
+    // 多次触发的accept被内核终止时重新提交；出错后暂停接受时等到期后在run中提交。
+    // 描述符用尽时内核在取连接之前就失败，立即重新提交会一直失败，先等到有新连接到达
+    bool paused = res < 0 && res != -ECONNABORTED && accept_failed(-res);
+    if (!(flags & IORING_CQE_F_MORE) && !paused)
+    {
+        if (res == -EMFILE || res == -ENFILE)
+            arm_listen_poll();
+        else
+            arm_accept();
+    }
+    if (res < 0)
+    {
+        return;
+    }
+    int conn_fd = res;
+    struct sockaddr_in client_address;
+    socklen_t client_addrlength = sizeof(client_address);
+    memset(&client_address, 0, sizeof(client_address));
+    getpeername(conn_fd, (struct sockaddr *)&client_address, &client_addrlength);
+    io_stat_add(STAT_SOCKET);
+    if (!admit(conn_fd, client_address))
+    {
+        return;
+    }
+    http_conn *conn = http_conn::create();
+    m_users[conn_fd] = conn;
+    conn->init(conn_fd, client_address, this);
+    metric_observe(STAGE_ACCEPT, metric_now_ns() - start);
+}
+
+void uring_reactor::handle_recv(int fd, int res, unsigned flags)
+{
+    http_conn *conn = m_users[fd];
+    m_conns[fd].recv_armed = false;
+
+    if (res == -ENOBUFS) // 缓冲区暂时用完
+    {
+        arm_recv(fd);
+        return;
+    }
+    if (res <= 0) // 连接关闭或出错
+    {
+        if (flags & IORING_CQE_F_BUFFER)
+            provide_buffers(flags >> IORING_CQE_BUFFER_SHIFT, 1);
+        conn->close_conn();
+        return;
+    }
+
+    int bid = flags >> IORING_CQE_BUFFER_SHIFT;
+    bool ok = conn->receive(m_buffers + (size_t)bid * READ_BUFFER_SIZE, res);
+    provide_buffers(bid, 1);
+    if (ok)
+    {
+        dispatch(conn);
+    }
+    else
+    {
+        conn->close_conn();
+    }
+}
+
+void uring_reactor::handle_send(int fd, int res)
+{
+    http_conn *conn = m_users[fd];
+    m_conns[fd].send_armed = false;
+
+    if (res <= 0)
+    {
+        conn->close_conn();
+        return;
+    }
+    conn->advance(res);
+    if (conn->remaining() > 0)
+    {
+        arm_send(fd);
+    }
+    else if (conn->finish_response())
+    {
+        if (conn->has_buffered_request()) // 流水线中还有已经读到的请求
+        {
+            dispatch(conn);
+        }
+        else
+        {
+            conn->set_deadline(http_conn::TIMEOUT_IDLE);
+            arm_recv(fd);
+        }
+    }
+    else
+    {
+        conn->close_conn();
+    }
+}
+
+void uring_reactor::handle_cqe(struct io_uring_cqe *cqe)
+{
+    int op = cqe->user_data >> 56;
+    unsigned gen = (cqe->user_data >> 32) & 0xffffff;
+    int fd = cqe->user_data & 0xffffffff;
+
+    switch (op)
+    {
+    case OP_ACCEPT:
+        handle_accept(cqe->res, cqe->flags);
+        return;
+    case OP_WAKE:
+        arm_wake();
+        return;
+    case OP_CANCEL:
+        return;
+    case OP_TIMER:
+        m_timer_armed = false;
+        return;
+    case OP_LISTEN:
+        arm_accept();
+        return;
+    case OP_PROVIDE:
+        if (cqe->res < 0)
+        {
+            printf("Reactor %d: cannot provide io_uring buffers, errno is: %d\n", m_id, -cqe->res);
+        }
+        return;
+    default:
+        break;
+    }
+
+    if (op == OP_SEND && m_conns[fd].closing) // 关闭时仍在进行的发送结束了，现在才可以释放
+    {
+        http_conn *conn = m_conns[fd].closing;
+        m_conns[fd].closing = 0;
+        close(fd);
+        io_stat_add(STAT_SOCKET);
+        conn->finish_close();
+        return;
+    }
+    if (gen != (m_conns[fd].gen & 0xffffff) || !m_users[fd]) // 已经关闭的旧连接
+    {
+        if (cqe->flags & IORING_CQE_F_BUFFER)
+            provide_buffers(cqe->flags >> IORING_CQE_BUFFER_SHIFT, 1);
+        return;
+    }
+
+    switch (op)
+    {
+    case OP_RECV:
+        handle_recv(fd, cqe->res, cqe->flags);
+        break;
+    case OP_SEND:
+        handle_send(fd, cqe->res);
+        break;
+    case OP_POLL_OUT:
+        m_conns[fd].poll_armed = false;
+        if (cqe->res < 0 || !m_users[fd]->write())
+        {
+            m_users[fd]->close_conn();
+        }
+        break;
+    case OP_POLL_IN:
+        m_conns[fd].poll_in_armed = false;
+        if (cqe->res < 0)
+            m_users[fd]->close_conn();
+        else
+            dispatch(m_users[fd]);
+        break;
+    default:
+        break;
+    }
+}
+
+void uring_reactor::run()
+{
+    m_thread = pthread_self();
+    arm_accept();
+    arm_wake();
+
+    while (true)
+    {
+        handle_requests();
+
+        // 通知队列为空才阻塞等待；工作线程看到m_sleeping后通过eventfd唤醒
+        m_sleeping.store(true, std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        unsigned wait_nr = m_notify.size() == 0 ? 1 : 0;
+        if (wait_nr == 0)
+            m_sleeping.store(false, std::memory_order_seq_cst);
+        if (!m_timer_armed && timer_wait_ms() >= 0)
+            arm_timer();
+
+        int ret = submit(wait_nr);
+        m_sleeping.store(false, std::memory_order_seq_cst);
+        if (ret < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+        {
+            printf("Reactor %d: io_uring_enter Error! Errno is: %d\n", m_id, errno);
+            break;
+        }
+
+        unsigned head = *m_cq_head;
+        while (head != __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE))
+        {
+            struct io_uring_cqe cqe = m_cqes[head & *m_cq_mask];
+            __atomic_store_n(m_cq_head, ++head, __ATOMIC_RELEASE);
+            handle_cqe(&cqe);
+        }
+        expire_timers();
+        if (accept_resume())
+            arm_accept();
+    }
+}
@@ -0,0 +1,113 @@
+#ifndef URING_REACTOR_H
+#define URING_REACTOR_H
+
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <atomic>
+#include "event_backend.h"
+#include "http_conn.h"
+#include "mpmc_ring.h"
+
+#define URING_ENTRIES 4096    // 提交队列长度
+#define URING_BUFFERS 1024    // 提供给内核的接收缓冲区个数
+#define URING_BUFFER_GROUP 0  // 接收缓冲区组号
+
+// 基于io_uring的反应堆：多次触发的accept、由内核挑选缓冲区的recv、一次发送一批响应的sendmsg
+// 每轮循环积累的提交一次io_uring_enter交给内核，同时等待完成事件
+// 工作线程不能直接提交（提交队列只属于反应堆线程），通过通知队列和eventfd把请求转交给反应堆
+class uring_reactor : public event_backend
+{
+public:
+    uring_reactor(int id, int port, int backlog, bool reuse_port, http_conn **users, thread_pool<http_conn> *pool, OVERLOAD_POLICY overload);
+    ~uring_reactor();
+
+    void run();
+    void add(http_conn *conn);
+    void want_read(http_conn *conn);
+    void want_write(http_conn *conn);
+    bool remove(http_conn *conn);
+
+private:
+    enum URING_OP
+    {
+        OP_ACCEPT = 1,
+        OP_RECV,
+        OP_SEND,
+        OP_POLL_OUT,
+        OP_POLL_IN,
+        OP_WAKE,
+        OP_CANCEL,
+        OP_PROVIDE,
+        OP_TIMER,
+        OP_LISTEN // 描述符用尽时等待监听套接字上的新连接，到达后再提交accept
+    };
+
+    enum CONN_REQUEST // 工作线程转交给反应堆的请求
+    {
+        REQ_READ = 1,
+        REQ_WRITE = 2,
+        REQ_CLOSE = 4
+    };
+
+    struct conn_state
+    {
+        std::atomic<int> requests; // 待处理的CONN_REQUEST
+        unsigned gen;              // 连接每次关闭加一，用于丢弃旧连接的完成事件
+        bool send_armed;
+        bool recv_armed;
+        bool poll_armed;
+        bool poll_in_armed;
+        http_conn *closing; // 关闭时发送仍在进行的连接，发送的完成事件到达后才关闭套接字并释放
+    };
+
+    static __u64 pack(int op, unsigned gen, int fd) { return ((__u64)op << 56) | ((__u64)(gen & 0xffffff) << 32) | (unsigned)fd; }
+
+    struct io_uring_sqe *get_sqe();
+    int submit(unsigned wait_nr);
+    void notify(http_conn *conn, int request);
+
+    void arm_accept();
+    void arm_listen_poll();
+    void arm_wake();
+    void arm_timer();
+    void arm_recv(int fd);
+    void arm_send(int fd);
+    void arm_poll_out(int fd);
+    void arm_poll_in(int fd);
+    void provide_buffers(int bid, int count);
+    void cancel(int op, int fd);
+    bool close_fd(int fd, http_conn *conn);
+
+    void handle_requests();
+    void handle_cqe(struct io_uring_cqe *cqe);
+    void handle_accept(int res, unsigned flags);
+    void handle_recv(int fd, int res, unsigned flags);
+    void handle_send(int fd, int res);
+
+    int m_ring_fd;
+    unsigned m_sq_entries;
+    void *m_sq_ptr, *m_cq_ptr;
+    size_t m_sq_size, m_cq_size;
+    unsigned *m_sq_head, *m_sq_tail, *m_sq_mask, *m_sq_array;
+    unsigned *m_cq_head, *m_cq_tail, *m_cq_mask;
+    struct io_uring_sqe *m_sqes;
+    struct io_uring_cqe *m_cqes;
+    unsigned m_sqe_tail;    // 本地已填写的提交项
+    unsigned m_sqe_flushed; // 已经对内核可见的提交项
+
+    char *m_buffers;
+
+    conn_state *m_conns;
+    pthread_t m_thread;
+    mpmc_ring<conn_state> m_notify; // 工作线程转交请求的连接，按套接字记录，连接对象可能已经归还
+    int m_wake_fd;
+    unsigned long long m_wake_buf;
+    std::atomic<bool> m_sleeping;
+    struct __kernel_timespec m_timer_ts; // 时间轮的刻度
+    bool m_timer_armed;
+};
+
+#endif
@@ -0,0 +1,102 @@
+#ifndef WORK_STEAL_DEQUE_H
+#define WORK_STEAL_DEQUE_H
+
+#include <atomic>
+
+#define WORK_STEAL_DEQUE_SIZE 256 // 每个工作线程本地队列的容量，必须为2的幂
+
+// Chase-Lev 工作窃取双端队列（固定容量）
+// 只有所属线程可以调用push/pop（从bottom端操作），其他线程通过steal从top端窃取
+// 内存序参照 Lê et al., "Correct and Efficient Work-Stealing for Weak Memory Models"
+template <typename T>
+class work_steal_deque
+{
+public:
+    work_steal_deque() : m_top(0), m_bottom(0)
+    {
+        for (int i = 0; i < WORK_STEAL_DEQUE_SIZE; ++i)
+            m_buffer[i].store(0, std::memory_order_relaxed);
+    }
+
+    // 本地队列剩余空间，仅所属线程调用
+    long free_slots() const
+    {
+        long b = m_bottom.load(std::memory_order_relaxed);
+        long t = m_top.load(std::memory_order_acquire);
+        return WORK_STEAL_DEQUE_SIZE - (b - t);
+    }
+
+    // 队列中的任务数，其他线程调用时是近似值
+    long size() const
+    {
+        long t = m_top.load(std::memory_order_relaxed);
+        long b = m_bottom.load(std::memory_order_relaxed);
+        return b > t ? b - t : 0;
+    }
+
+    // 压入一个任务，队列满时返回false，仅所属线程调用
+    bool push(T *item)
+    {
+        long b = m_bottom.load(std::memory_order_relaxed);
+        long t = m_top.load(std::memory_order_acquire);
+        if (b - t >= WORK_STEAL_DEQUE_SIZE)
+        {
+            return false;
+        }
+        m_buffer[b & (WORK_STEAL_DEQUE_SIZE - 1)].store(item, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        m_bottom.store(b + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // 弹出最近压入的任务，队列空时返回NULL，仅所属线程调用
+    T *pop()
+    {
+        long b = m_bottom.load(std::memory_order_relaxed) - 1;
+        m_bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        long t = m_top.load(std::memory_order_relaxed);
+
+        if (t > b) // 队列为空
+        {
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+            return 0;
+        }
+        T *item = m_buffer[b & (WORK_STEAL_DEQUE_SIZE - 1)].load(std::memory_order_relaxed);
+        if (t == b) // 最后一个元素，与窃取者竞争
+        {
+            if (!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            {
+                item = 0;
+            }
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return item;
+    }
+
+    // 从队列另一端窃取最早压入的任务，失败时返回NULL，任意线程可调用
+    T *steal()
+    {
+        long t = m_top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        long b = m_bottom.load(std::memory_order_acquire);
+
+        if (t >= b)
+        {
+            return 0;
+        }
+        T *item = m_buffer[t & (WORK_STEAL_DEQUE_SIZE - 1)].load(std::memory_order_relaxed);
+        if (!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+        {
+            return 0;
+        }
+        return item;
+    }
+
+private:
+    alignas(64) std::atomic<long> m_top;
+    alignas(64) std::atomic<long> m_bottom;
+    alignas(64) std::atomic<T *> m_buffer[WORK_STEAL_DEQUE_SIZE];
+};
+
+#endif